@@ -45,62 +45,103 @@ namespace Pickle
     : Scalar (new_arrayref (len, const_cast<SV**> (&ss [0] .imp))) {}
 
   static inline SV*
-  lookup_array (const string& name)
+  lookup_array (const char* name, STRLEN len)
   {
     dTHX;
-    return newRV ((SV*) get_av (const_cast<char*> (name .c_str ()), 1));
+    return newRV ((SV*) GvAVn (fetch_gv (aTHX_ name, len, SVt_PVAV)));
   }
 
-  Arrayref::Arrayref (const string& name) : Scalar (lookup_array (name)) {}
-  Arrayref::Arrayref (const char* name) : Scalar (lookup_array (name)) {}
+  Arrayref::Arrayref (const string& name)
+    : Scalar (lookup_array (name .data (), name .size ())) {}
+  Arrayref::Arrayref (const char* name)
+    : Scalar (lookup_array (name, strlen (name))) {}
+
+  // Push SV, whose reference is given away, and return the new size.
+  static inline size_t
+  push_sv (pTHX_ SV* rv, SV* sv)
+  {
+    AV* av = (AV*) SvRV (rv);
+    av_push (av, sv);
+    return 1 + av_len (av);
+  }
 
   size_t
   Arrayref::push (const Scalar& t)
   {
     dTHX;
-    av_push ((AV*) SvRV (imp), SvREFCNT_inc (t.imp));
-    return size ();
+    return push_sv (aTHX_ imp, SvREFCNT_inc (t.imp));
   }
 
-  Arrayref&
-  Arrayref::clear ()
+  size_t
+  Arrayref::push (const Interpreter& i, const Scalar& t)
   {
-    dTHX;
-    av_clear ((AV*) SvRV (imp));
-    return *this;
+    dInterpOf (i);
+    return push_sv (aTHX_ imp, SvREFCNT_inc (t.imp));
   }
 
+#ifdef PICKLE_RVALUE_REFS
   size_t
-  Arrayref::size () const
+  Arrayref::push (Scalar&& t)
   {
     dTHX;
-    return 1 + av_len ((AV*) SvRV (imp));
+    return push_sv (aTHX_ imp, t .release ());
   }
 
-  Scalar
-  Arrayref::fetch (size_t index) const
+  size_t
+  Arrayref::push (const Interpreter& i, Scalar&& t)
+  {
+    dInterpOf (i);
+    return push_sv (aTHX_ imp, t .release ());
+  }
+#endif
+
+  Arrayref&
+  Arrayref::clear ()
   {
     dTHX;
+    av_clear ((AV*) SvRV (imp));
+    return *this;
+  }
 
-    SV** loc = av_fetch ((AV*) SvRV (imp), index, 0);
+  static inline SV*
+  fetch_copy (pTHX_ SV* rv, size_t index)
+  {
+    SV** loc = av_fetch ((AV*) SvRV (rv), index, 0);
     if (loc)
       return newSVsv (*loc);
     else
       return &PL_sv_undef;
   }
 
-  const Scalar&
-  Arrayref::at (size_t index) const
+  Scalar
+  Arrayref::fetch (size_t index) const
   {
     dTHX;
-    return ref (*av_fetch ((AV*) SvRV (imp), index, 1));
+    return fetch_copy (aTHX_ imp, index);
+  }
+
+  Scalar
+  Arrayref::fetch (const Interpreter& i, size_t index) const
+  {
+    dInterpOf (i);
+    return fetch_copy (aTHX_ imp, index);
+  }
+
+  Bound<Scalar>
+  Bound<Arrayref>::fetch (size_t index) const
+  {
+    dInterpOf (interpreter ());
+    return Bound<Scalar> (interpreter (),
+			  fetch_copy (aTHX_ get_imp (), index));
   }
 
   Scalar&
-  Arrayref::at (size_t index)
+  Arrayref::store (const Interpreter& i, size_t index, const Scalar& val)
   {
-    dTHX;
-    return ref (*av_fetch ((AV*) SvRV (imp), index, 1));
+    dInterpOf (i);
+    Scalar& elt = ref (*av_fetch ((AV*) SvRV (imp), index, 1));
+    elt .assign (i, val);
+    return elt;
   }
 
   Scalar
@@ -0,0 +1,271 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+#include "pickle_int.hh"
+#include <XSUB.h>
+#include <pthread.h>
+#include <sched.h>
+#include <deque>
+#include <stdexcept>
+
+namespace Pickle
+{
+
+  // Async subs.  The XSUB copies its arguments, makes an unsettled
+  // Pickle::Promise and hands both to a worker thread.  The worker
+  // runs the C++ function without touching the interpreter, then
+  // posts the job back through the queue, and drain() settles the
+  // promise on the interpreter's thread.
+
+  static const char promise_pm[] =
+    "package Pickle::Promise;\n"
+    "sub then {\n"
+    "  my ($p, $ok, $fail) = @_;\n"
+    "  push @{ $p->{cb} }, [ $ok, $fail ];\n"
+    "  $p->_run if exists $p->{ok};\n"
+    "  $p\n"
+    "}\n"
+    "sub is_ready { exists $_[0]{ok} }\n"
+    "sub result {\n"
+    "  my $p = shift;\n"
+    "  die \"Pickle::Promise: not ready\\n\" unless exists $p->{ok};\n"
+    "  die $p->{value} unless $p->{ok};\n"
+    "  $p->{value}\n"
+    "}\n"
+    "sub _settle { @{ $_[0] }{qw(ok value)} = @_[1, 2]; $_[0]->_run }\n"
+    "sub _run {\n"
+    "  my $p = shift;\n"
+    "  for my $cb (splice @{ $p->{cb} || [] }) {\n"
+    "    my $f = $cb->[$p->{ok} ? 0 : 1] or next;\n"
+    "    eval { $f->($p->{value}); 1 } or warn $@;\n"
+    "  }\n"
+    "}\n"
+    "1;\n";
+
+  struct Async_job
+  {
+    EventQueue::async_sub fn;
+    EventQueue* queue;
+    vector<string> args;
+    SV* promise;  // owned; touched only on the interpreter's thread
+    string value;
+    bool ok;
+  };
+
+  struct Async_pool
+  {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    std::deque<Async_job*> jobs;
+    vector<pthread_t> threads;
+    bool stopping;
+  };
+
+  // What the XSUB needs, in CvXSUBANY.  The queue keeps a list of
+  // its subs' definitions and clears QUEUE and POOL when destroyed.
+  struct Async_def
+  {
+    EventQueue::async_sub fn;
+    EventQueue* queue;
+    Async_pool* pool;
+    Async_def* next;
+  };
+
+  static Scalar
+  settle (const Interpreter& i, void* payload)
+  {
+    Async_job* job = (Async_job*) payload;
+    Scalar promise (job->promise);
+    Scalar value (i .Scalar (job->value));
+    Scalar ok (i .Scalar (job->ok));
+    delete job;
+    promise .call_method ("_settle", List () << ok << value, VOID);
+    return promise;
+  }
+
+  static bool
+  stopping (Async_pool* pool)
+  {
+    pthread_mutex_lock (&pool->lock);
+    bool ret = pool->stopping;
+    pthread_mutex_unlock (&pool->lock);
+    return ret;
+  }
+
+  static void*
+  async_main (void* arg)
+  {
+    Async_pool* pool = (Async_pool*) arg;
+    for (;;)
+      {
+	pthread_mutex_lock (&pool->lock);
+	while (pool->jobs .empty () && ! pool->stopping)
+	  pthread_cond_wait (&pool->work, &pool->lock);
+	if (pool->stopping)
+	  {
+	    pthread_mutex_unlock (&pool->lock);
+	    return 0;
+	  }
+	Async_job* job = pool->jobs .front ();
+	pool->jobs .pop_front ();
+	pthread_mutex_unlock (&pool->lock);
+
+	try
+	  {
+	    job->value = job->fn (job->args);
+	    job->ok = true;
+	  }
+	catch (std::exception& e)
+	  {
+	    job->value = e .what ();
+	    job->ok = false;
+	  }
+	catch (...)
+	  {
+	    job->value = "unknown exception in async sub";
+	    job->ok = false;
+	  }
+
+	// A completion must not be lost, so wait for room, unless the
+	// queue is being destroyed and will not be drained again.
+	while (! job->queue->post (settle, job))
+	  {
+	    if (stopping (pool))
+	      {
+		delete job;
+		break;
+	      }
+	    sched_yield ();
+	  }
+      }
+  }
+
+  static Async_pool*
+  async_start (unsigned threads)
+  {
+    Async_pool* pool = new Async_pool;
+    pthread_mutex_init (&pool->lock, 0);
+    pthread_cond_init (&pool->work, 0);
+    pool->stopping = false;
+    for (unsigned k = 0; k < threads; k++)
+      {
+	pthread_t t;
+	if (pthread_create (&t, 0, async_main, pool) == 0)
+	  pool->threads .push_back (t);
+      }
+    if (pool->threads .empty ())
+      {
+	async_stop (pool);
+	throw new Exception ("EventQueue: cannot start async threads");
+      }
+    return pool;
+  }
+
+  // XXX Jobs not yet run, or finished with the queue full, are
+  // dropped, and their promises leak.
+  void
+  async_stop (Async_pool* pool)
+  {
+    if (! pool)
+      return;
+    pthread_mutex_lock (&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast (&pool->work);
+    pthread_mutex_unlock (&pool->lock);
+    for (size_t k = 0; k < pool->threads .size (); k++)
+      pthread_join (pool->threads [k], 0);
+    for (size_t k = 0; k < pool->jobs .size (); k++)
+      delete pool->jobs [k];
+    pthread_cond_destroy (&pool->work);
+    pthread_mutex_destroy (&pool->lock);
+    delete pool;
+  }
+
+  static void
+  xs_async (pTHX_ CV* cv)
+  {
+    dXSARGS;
+    Async_def* def = (Async_def*) CvXSUBANY (cv) .any_ptr;
+    if (! def->pool)
+      croak ("%s: queue destroyed", GvNAME (CvGV (cv)));
+
+    Async_job* job = new Async_job;
+    job->fn = def->fn;
+    job->queue = def->queue;
+    job->ok = false;
+    job->args .reserve (items);
+    for (int k = 0; k < items; k++)
+      {
+	STRLEN len;
+	const char* s = SvPV (ST (k), len);
+	job->args .push_back (string (s, len));
+      }
+    job->promise = sv_bless (newRV_noinc ((SV*) newHV ()),
+			     gv_stashpvn ("Pickle::Promise", 15, GV_ADD));
+    SV* ret = sv_2mortal (SvREFCNT_inc (job->promise));
+
+    Async_pool* pool = def->pool;
+    pthread_mutex_lock (&pool->lock);
+    pool->jobs .push_back (job);
+    pthread_cond_signal (&pool->work);
+    pthread_mutex_unlock (&pool->lock);
+
+    if (items < 1)
+      EXTEND (sp, 1);
+    ST (0) = ret;
+    XSRETURN (1);
+  }
+
+  void
+  async_define (pTHX_ EventQueue* queue, Async_pool*& pool,
+		Async_def*& defs, unsigned threads, const string& fullname,
+		EventQueue::async_sub fn)
+  {
+    if (! get_cv ("Pickle::Promise::_settle", 0))
+      eval_pv (promise_pm, FALSE);
+    if (! pool)
+      pool = async_start (threads ? threads : 4);
+
+    Async_def* def = new Async_def;  // lives as long as the sub
+    def->fn = fn;
+    def->queue = queue;
+    def->pool = pool;
+    def->next = defs;
+    defs = def;
+    CV* cv = newXS (const_cast<char*> (fullname .c_str ()),
+		    xs_async, const_cast<char*> (__FILE__));
+    CvXSUBANY (cv) .any_ptr = def;
+  }
+
+  // Named subs are never freed, so the definitions stay behind, but
+  // their subs croak from now on.
+  void
+  async_detach (Async_def* defs)
+  {
+    for (Async_def* def = defs; def; def = def->next)
+      {
+	def->queue = 0;
+	def->pool = 0;
+      }
+  }
+
+}
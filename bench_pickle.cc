@@ -0,0 +1,763 @@
+#include <iostream>
+#include <time.h>
+#include <string.h>
+#include <stdio.h>
+#include <sstream>
+#include <map>
+// The library's internal header, for the raw perlapi baselines.
+// bench_inline also times the fast paths in pickle_inline.hh.
+#ifdef BENCH_INLINE
+#  include "pickle_inline.hh"
+#else
+#  include "pickle_int.hh"
+#endif
+#include <XSUB.h>
+
+using namespace Pickle;
+using namespace std;
+
+// Built with -DREFCNT_COUNT=1 by `make bench', which makes the library
+// tally every SvREFCNT_inc and SvREFCNT_dec it performs.  The raw
+// perlapi baselines are tallied too, through the same macros.
+#if ! REFCNT_COUNT
+static unsigned long pickle_refcnt_incs;
+static unsigned long pickle_refcnt_decs;
+#endif
+
+static const long N = 200000;
+
+// Output is one line per benchmark, tab-separated:
+//
+//   name  ns-per-op  refcnt-incs-per-op  refcnt-decs-per-op
+//
+// or with --json, one object per line.  Lines starting with `#' are
+// comments.  Rows named perlapi/NAME time the same operation as NAME
+// written directly against the Perl API.  --tag BUILD labels the rows
+// with the build being measured.  Other arguments select the rows
+// whose names contain them.
+static bool json;
+static const char* tag;
+static int n_patterns;
+static char** patterns;
+
+static double
+now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool
+selected (const char* name)
+{
+  if (n_patterns == 0)
+    return true;
+  for (int i = 0; i < n_patterns; i++)
+    if (strstr (name, patterns [i]))
+      return true;
+  return false;
+}
+
+// Run BODY COUNT times and report time and refcount operations per call.
+#define BENCH_N(name, count, body)					\
+  do {									\
+    if (! selected (name))						\
+      break;								\
+    unsigned long incs0 = pickle_refcnt_incs;				\
+    unsigned long decs0 = pickle_refcnt_decs;				\
+    double t0 = now ();							\
+    for (long i = 0; i < (count); i++)					\
+      { body; }								\
+    double t1 = now ();							\
+    report (name, (count), t1 - t0, pickle_refcnt_incs - incs0,		\
+	    pickle_refcnt_decs - decs0);				\
+  } while (0)
+#define BENCH(name, body) BENCH_N (name, N, body)
+
+static void
+report (const char* name, long n, double secs, unsigned long incs,
+	unsigned long decs)
+{
+  double ns = secs * 1e9 / n;
+  if (json)
+    {
+      cout << "{\"name\": \"" << name << "\", ";
+      if (tag)
+	cout << "\"build\": \"" << tag << "\", ";
+      cout << "\"ns\": " << ns << ", \"iterations\": " << n;
+    }
+  else
+    cout << (tag ? tag : "") << (tag ? ":" : "") << name << "\t" << ns;
+#if REFCNT_COUNT
+  if (json)
+    cout << ", \"incs\": " << double (incs) / n
+	 << ", \"decs\": " << double (decs) / n;
+  else
+    cout << "\t" << double (incs) / n << "\t" << double (decs) / n;
+#endif
+  cout << (json ? "}" : "") << endl;
+}
+
+// Report a figure other than a timing.
+static void
+note (const char* name, unsigned long value)
+{
+  if (! selected (name))
+    return;
+  if (json)
+    cout << "{\"name\": \"" << name << "\", \"value\": " << value << "}"
+	 << endl;
+  else
+    cout << "# " << name << "\t" << value << endl;
+}
+
+static Scalar
+make_scalar (long i)
+{
+  Scalar s (i);
+  return s;
+}
+
+static Scalar
+echo (Scalar& arg)
+{
+  return arg;
+}
+
+struct Counter
+{
+  long n;
+  Counter (long start) : n (start) {}
+  long add (long k) { return n += k; }
+};
+
+// A method written the define_sub way, on a blessed hash holding the
+// object's address.
+static Scalar
+counter_add (Scalar& self, Hashref& args)
+{
+  Counter* c = (Counter*) Hashref (self) .fetch ("ptr") .as_long ();
+  return c->add (args .fetch ("k") .as_long ());
+}
+
+// Count the leaves of a tree by checking each node's type in turn.
+static long
+count_checked (const Scalar& s)
+{
+  long n = 0;
+  if (s .is_arrayref ())
+    {
+      const Arrayref& a = s .arrayref (false);
+      for (size_t i = 0; i < a .size (); i++)
+	n += count_checked (a [i]);
+    }
+  else if (s .is_hashref ())
+    ;
+  else if (s .is_scalarref ())
+    n += count_checked (s .scalarref (false) .fetch ());
+  else
+    n++;
+  return n;
+}
+
+// The same, classifying each node once.
+class Leaf_counter : public Visitor
+{
+public:
+  long n;
+  Leaf_counter () : n (0) {}
+  void undef (const Scalar&) { n++; }
+  void plain (const Scalar&) { n++; }
+};
+
+// Baselines: what an XS programmer would write by hand.
+
+static void
+raw_echo (pTHX_ CV* cv)
+{
+  dXSARGS;
+  if (items != 1)
+    croak ("Usage: Bench::raw_echo(arg)");
+  XSRETURN (1);
+}
+
+static IV
+raw_call (pTHX_ const char* name, IV arg)
+{
+  dSP;
+  ENTER;
+  SAVETMPS;
+  PUSHMARK (SP);
+  XPUSHs (sv_2mortal (newSViv (arg)));
+  PUTBACK;
+  call_pv (name, G_SCALAR | G_EVAL);
+  SPAGAIN;
+  SV* retsv = POPs;
+  PUTBACK;
+  IV ret = SvIV (retsv);
+  FREETMPS;
+  LEAVE;
+  return ret;
+}
+
+static IV
+raw_call_method (pTHX_ SV* obj, const char* meth, IV arg)
+{
+  dSP;
+  ENTER;
+  SAVETMPS;
+  PUSHMARK (SP);
+  XPUSHs (obj);
+  XPUSHs (sv_2mortal (newSViv (arg)));
+  PUTBACK;
+  Perl_call_method (aTHX_ meth, G_SCALAR | G_EVAL);
+  SPAGAIN;
+  SV* retsv = POPs;
+  PUTBACK;
+  IV ret = SvIV (retsv);
+  FREETMPS;
+  LEAVE;
+  return ret;
+}
+
+static IV
+raw_eval (pTHX_ const char* code)
+{
+  ENTER;
+  SAVETMPS;
+  save_scalar (PL_errgv);
+  SV* retsv = eval_pv (code, 0);
+  IV ret = SvIV (retsv);
+  FREETMPS;
+  LEAVE;
+  return ret;
+}
+
+static STRLEN
+raw_dumper (pTHX_ SV* ref)
+{
+  dSP;
+  STRLEN len;
+  ENTER;
+  SAVETMPS;
+  PUSHMARK (SP);
+  XPUSHs (ref);
+  PUTBACK;
+  call_pv ("Data::Dumper::Dumper", G_SCALAR | G_EVAL);
+  SPAGAIN;
+  SV* retsv = POPs;
+  PUTBACK;
+  SvPV (retsv, len);
+  FREETMPS;
+  LEAVE;
+  return len;
+}
+
+// unpack without protection from croak, for a lower bound.
+static IV
+raw_unpack (pTHX_ const char* pat, const char* data, STRLEN len)
+{
+  dSP;
+  ENTER;
+  SAVETMPS;
+  PUTBACK;
+  IV n = unpackstring (pat, pat + strlen (pat), data, data + len, 0);
+  SPAGAIN;
+  SP -= n;
+  PUTBACK;
+  FREETMPS;
+  LEAVE;
+  return n;
+}
+
+static void
+produce_records (Feed& feed, void* arg)
+{
+  static const char record[] = "2024-01-01 12:00:00 GET /index.html 200";
+  for (long i = 0; i < (long) arg; i++)
+    feed .push (record, sizeof record - 1);
+}
+
+static void
+bump (void* sum)
+{
+  ++*(long*) sum;
+}
+
+// Keep Scalars in their own scope so they die before the interpreter.
+static void
+run (const Interpreter& interp)
+{
+  dTHX;
+  eval_string ("sub Bench::nop { $_[0] }"
+	       " sub Bench::new { bless {}, $_[0] }"
+	       " sub Bench::meth { $_[1] }");
+  define_sub ("Bench", "echo", echo);
+  newXS (const_cast<char*> ("Bench::raw_echo"), raw_echo,
+	 const_cast<char*> (__FILE__));
+
+  long sum = 0;
+  STRLEN len;
+
+  // Scalar construction and conversion.
+  Scalar s ("value");
+  Scalar t;
+  Scalar n (42);
+  SV* raw_n = n .get_imp ();
+  SV* raw_s = s .get_imp ();
+  BENCH ("scalar-new-int", Scalar c (i));
+  BENCH ("perlapi/scalar-new-int", SvREFCNT_dec (newSViv (i)));
+  BENCH ("scalar-new-string", Scalar c ("value"));
+  BENCH ("perlapi/scalar-new-string",
+	 SvREFCNT_dec (newSVpvn ("value", 5)));
+  BENCH ("copy", Scalar c (s));
+  BENCH ("perlapi/copy", SvREFCNT_inc (raw_s); SvREFCNT_dec (raw_s));
+  BENCH ("return-by-value", t = make_scalar (i));
+  BENCH ("list-build", List l = List () << i << "two" << s);
+  BENCH ("as-int", sum += n .as_int ());
+#ifdef BENCH_INLINE
+  BENCH ("as-int-inline", sum += Inline::as_int (n));
+#endif
+  BENCH ("perlapi/as-int", sum += SvIV (raw_n));
+  BENCH ("as-double", sum += (long) n .as_double ());
+  BENCH ("perlapi/as-double", sum += (long) SvNV (raw_n));
+  BENCH ("as-string", sum += s .as_string () .size ());
+  BENCH ("perlapi/as-string", SvPV (raw_s, len); sum += len);
+
+  // Containers.
+  Hashref h;
+  Arrayref a;
+  HV* raw_h = (HV*) SvRV (h .get_imp ());
+  AV* raw_a = (AV*) SvRV (a .get_imp ());
+  BENCH ("hash-store", h .store ("key", i));
+  BENCH ("perlapi/hash-store", hv_store (raw_h, "key", 3, newSViv (i), 0));
+  BENCH ("array-push", a .push (Scalar (i)); if (i % 1000 == 0) a .clear ());
+  BENCH ("perlapi/array-push",
+	 av_push (raw_a, newSViv (i)); if (i % 1000 == 0) av_clear (raw_a));
+  for (long i = a .size (); i < 100; i++)
+    a .push (Scalar (i));
+  BENCH ("array-store", a .store (i % 100, i));
+  BENCH ("perlapi/array-store", av_store (raw_a, i % 100, newSViv (i)));
+
+  // Implicit context versus Bound handles.
+  Bound<Scalar> bn (interp, n);
+  BENCH ("as-int-bound", sum += bn .as_int ());
+
+  Bound<Arrayref> ba (interp, a);
+  BENCH ("array-fetch", sum += a .fetch (i % 100) .as_long ());
+  BENCH ("array-fetch-bound", sum += ba .fetch (i % 100) .as_long ());
+  BENCH ("perlapi/array-fetch",
+	 SV** svp = av_fetch (raw_a, i % 100, 0); sum += SvIV (*svp));
+  BENCH ("array-size", sum += a .size ());
+  BENCH ("array-size-bound", sum += ba .size ());
+#ifdef BENCH_INLINE
+  BENCH ("array-size-inline", sum += Inline::size (a));
+  BENCH ("array-at-inline", sum += Inline::as_long (Inline::at (a, i % 100)));
+#endif
+  BENCH ("perlapi/array-size", sum += av_len (raw_a) + 1);
+
+  Bound<Hashref> bh (interp, h);
+  Scalar key ("key");
+  BENCH ("hash-fetch", sum += h .fetch (key) .as_long ());
+  BENCH ("hash-fetch-bound", sum += bh .fetch (key) .as_long ());
+  BENCH ("perlapi/hash-fetch",
+	 SV** svp = hv_fetch (raw_h, "key", 3, 0); sum += SvIV (*svp));
+
+  // Temporaries freed one by one versus owned by a recycling Scope.
+  h .store ("key", 1);
+  BENCH ("temp-key-fetch", sum += h .fetch ("key") .as_long ());
+  BENCH ("temp-int", sum += Scalar (i) .as_long ());
+  {
+    Scope scope (interp);
+    BENCH ("scope-key-fetch",
+	   scope .recycle (); sum += h .fetch (scope .temp ("key")) .as_long ());
+    BENCH ("scope-int", scope .recycle (); sum += scope .temp (i) .as_long ());
+    note ("scope-allocated", scope .allocated ());
+    note ("scope-recycled", scope .recycled ());
+  }
+
+  // Package variable lookup by name versus a GlobalHandle.
+  eval_string ("$Config::x = 3");
+  GlobalHandle gx ("Config::x");
+  BENCH ("global-by-name", sum += Scalarref ("Config::x") .fetch () .as_long ());
+  BENCH ("global-handle", sum += gx .fetch () .as_long ());
+  BENCH ("global-handle-bound", sum += gx .fetch (interp) .as_long (interp));
+  BENCH ("perlapi/global-by-name",
+	 SV* sv = get_sv ("Config::x", 0); sum += SvIV (sv));
+
+  // Crossing the boundary.
+  Scalar obj = call_function ("Bench::new", List () << "Bench");
+  BENCH ("call-function", call_function ("Bench::nop", List () << i));
+  BENCH ("perlapi/call-function", sum += raw_call (aTHX_ "Bench::nop", i));
+  Coderef nop = eval_string ("\\&Bench::nop");
+  BENCH ("coderef-call", sum += nop (i) .as_long ());
+  Coderef::Invoker nop_inv (nop, 1);
+  BENCH ("invoker-call", sum += nop_inv .set (0, i) () .as_long ());
+  Coderef::Invoker nop_void (nop, 1, VOID);
+  BENCH ("invoker-call-void", nop_void .set (0, i) ());
+  Coderef::Invoker nop_noargs (nop, 0, VOID);
+  BENCH ("invoker-call-noargs", nop_noargs ());
+  BENCH ("call-method", obj .call_method ("meth", List () << i));
+  BENCH ("perlapi/call-method",
+	 sum += raw_call_method (aTHX_ obj .get_imp (), "meth", i));
+  BENCH ("xs-callback", call_function ("Bench::echo", List () << i));
+  BENCH ("perlapi/xs-callback", sum += raw_call (aTHX_ "Bench::raw_echo", i));
+  BENCH_N ("eval-string", N / 10, sum += eval_string ("1 + 1") .as_long ());
+  BENCH_N ("perlapi/eval-string", N / 10, sum += raw_eval (aTHX_ "1 + 1"));
+
+  Profiler::enable ();
+  BENCH ("call-function-profiled",
+	 call_function ("Bench::nop", List () << i));
+  BENCH ("xs-callback-profiled",
+	 call_function ("Bench::echo", List () << i));
+  Profiler::enable (false);
+
+  // The profiler's own cost per crossing, disabled and enabled, beside
+  // the two cycle counter reads that timing a crossing takes.
+  SV* nop_cv = (SV*) get_cv ("Bench::nop", 0);
+  BENCH ("profile-disabled", Prof_guard g (aTHX_ PROF_CALL, nop_cv));
+  Profiler::enable ();
+  BENCH ("profile-sub", Prof_guard g (aTHX_ PROF_CALL, nop_cv));
+  BENCH ("profile-name", Prof_guard g (PROF_METHOD, "meth", 4));
+  Profiler::enable (false);
+  Profiler::reset ();
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+  BENCH ("profile-clock",
+	 sum += __builtin_ia32_rdtsc (); sum -= __builtin_ia32_rdtsc ());
+#endif
+
+  // Classifying tree nodes with is_<type> versus kind and visit.
+  Scalar tree = eval_string ("[[1, 2, [3, \\4]], [5, [6, 7]], \\[8, 9], 10]");
+  BENCH ("is-type-chain",
+	 sum += tree .is_scalarref () + tree .is_hashref ()
+	   + tree .is_arrayref ());
+  BENCH ("kind", sum += tree .kind ());
+  BENCH ("tree-walk-checked", sum += count_checked (tree));
+  BENCH ("tree-walk-visit",
+	 Leaf_counter c; tree .visit (c); sum += c.n);
+
+  // Serializers.
+  interp .require_module ("Data::Dumper");
+  BENCH_N ("as-perl", N / 10, sum += tree .as_perl () .size ());
+  BENCH_N ("perlapi/as-perl", N / 10,
+	   sum += raw_dumper (aTHX_ tree .get_imp ()));
+  try
+    {
+      interp .require_module ("XML::Dumper");
+      BENCH_N ("as-xml", N / 100, sum += tree .as_xml () .size ());
+    }
+  catch (Exception* e)
+    {
+      if (! json && selected ("as-xml"))
+	cout << "# as-xml skipped: XML::Dumper not available" << endl;
+      delete e;
+    }
+
+  // Memory accounting, full and sampled.
+  BENCH_N ("memory-stats", 100, sum += interp .memory_stats () .svs);
+  BENCH_N ("memory-stats-sampled", 100, sum += interp .memory_stats (8) .svs);
+  BENCH_N ("deep-size", 1000, sum += tree .deep_size ());
+
+  // Event injection, per event, drained in batches of 64.
+  EventQueue q (1024);
+  BENCH ("event-post-drain",
+	 q .post (i); if (i % 64 == 63) sum += q .drain (interp) .size ());
+  BENCH ("event-post-drain-string",
+	 q .post ("event");
+	 if (i % 64 == 63) sum += q .drain (interp) .size ());
+
+  // The interpreter lock, uncontended.
+  Interpreter::Lock lock (interp);
+  BENCH ("lock-acquire-release", lock .acquire (); sum++; lock .release ());
+  BENCH ("lock-run", lock .run (bump, &sum));
+  lock .combining (true);
+  BENCH ("lock-run-combining", lock .run (bump, &sum));
+
+  // readline over C++ data, per pass over 1000 lines, against the
+  // usual workaround of opening a reference to a Perl string, with the
+  // string made once or copied from C++ each time.
+  eval_string ("sub Bench::lines { my $fh = shift; my $n = 0;"
+	       " $n++ while <$fh>; $n }"
+	       " sub Bench::scalar_lines { open my $fh, '<', \\$_[0] or die;"
+	       " my $n = 0; $n++ while <$fh>; $n }");
+  std::string text;
+  for (int l = 0; l < 1000; l++)
+    text += "a line of text, forty bytes or so long.\n";
+  Scalar text_sv (text);
+  BENCH_N ("readline-span", N / 100,
+	   sum += call_function ("Bench::lines",
+				 List () << Globref (text .data (),
+						     text .size ()))
+	     .as_long ());
+  BENCH_N ("readline-streambuf", N / 100,
+	   std::stringbuf sb (text);
+	   sum += call_function ("Bench::lines", List () << Globref (&sb))
+	     .as_long ());
+  BENCH_N ("readline-scalar-fh", N / 100,
+	   sum += call_function ("Bench::scalar_lines", List () << text_sv)
+	     .as_long ());
+  BENCH_N ("readline-scalar-fh-copy", N / 100,
+	   sum += call_function ("Bench::scalar_lines", List () << text)
+	     .as_long ());
+
+  // Records into a Perl handler, per record: a call each, against
+  // batches of 256 pushed from this thread or from a producer thread.
+  eval_string ("sub Bench::rec { $Bench::n += length $_[0] }"
+	       " sub Bench::batch { $Bench::n += length $_ for @{$_[0]} }");
+  static const char record[] = "2024-01-01 12:00:00 GET /index.html 200";
+  BENCH ("feed-call-per-record",
+	 call_function ("Bench::rec", List () << record));
+  Feed feed (interp, eval_string ("\\&Bench::batch"), 256);
+  BENCH ("feed-push", feed .push (record, sizeof record - 1));
+  feed .flush ();
+  if (selected ("feed-run"))
+    {
+      double t0 = now ();
+      feed .run (produce_records, (void*) N);
+      report ("feed-run", N, now () - t0, 0, 0);
+    }
+  sum += feed .records ();
+
+  // A compiled regex against a C++ string, lent to the engine, and
+  // against calling a sub that matches a copy.
+  static const char log_line[] =
+    "2024-01-01 12:00:00 GET /index.html 200 5120";
+  Regex re = interp .compile_regex ("(GET|POST) (\\S+) (\\d+)");
+  Regex::Match m;
+  eval_string ("sub Bench::match { $_[0] =~ /(GET|POST) (\\S+) (\\d+)/"
+	       " ? $-[3] : -1 }");
+  BENCH ("regex-match",
+	 sum += re .match (log_line, sizeof log_line - 1, m) + m .start (3));
+  BENCH ("regex-call-sub",
+	 sum += call_function ("Bench::match", List () << log_line)
+	   .as_long ());
+
+  // unpack of one binary record through a Packer, into scalars or
+  // native slots, against calling a sub that unpacks.
+  static const char bin[] = "\0\0\1\2\0\5abcde\x7f";
+  Packer unpacker (interp, "N n/a* C");
+  Packer unpack_nums (interp, "N n C");
+  std::vector<Scalar> fields;
+  long nums [3];
+  eval_string ("sub Bench::unpack { unpack 'N n/a* C', $_[0] }");
+  BENCH ("unpack-packer",
+	 sum += unpacker .unpack (bin, sizeof bin - 1, fields));
+  BENCH ("unpack-packer-native",
+	 sum += unpack_nums .unpack (bin, 7, nums, 3) + nums [2]);
+  BENCH ("perlapi/unpack",
+	 sum += raw_unpack (aTHX_ "N n/a* C", bin, sizeof bin - 1));
+  BENCH ("unpack-call-function",
+	 sum += Arrayref (call_function ("Bench::unpack",
+					 List () << Scalar (bin,
+							    sizeof bin - 1),
+					 LIST)) .size ());
+  std::string packed;
+  BENCH ("pack-packer", unpacker .pack (fields, packed);
+	 sum += packed .size ());
+
+  // Handing request state to Perl: stores before each call against
+  // variables bound once, and a Perl counter read back against a
+  // bound one.
+  eval_string ("sub Bench::req_push {"
+	       " $Req::n + $Req::load + length $Req::host }"
+	       "sub Bench::req_bound {"
+	       " $Cfg::n + $Cfg::load + length $Cfg::host }"
+	       "sub Bench::hit { $Req::hits++ }"
+	       "sub Bench::hit_bound { $Cfg::hits++ }");
+  long req_n = 0, hits = 0;
+  double req_load = 0.5;
+  std::string req_host = "example.org";
+  interp .bind_scalar ("Cfg::n", &req_n);
+  interp .bind_scalar ("Cfg::load", &req_load);
+  interp .bind_scalar ("Cfg::host", &req_host);
+  interp .bind_counter ("Cfg::hits", &hits);
+  Coderef::Invoker req_push (eval_string ("\\&Bench::req_push"), 0, VOID);
+  Coderef::Invoker req_bound (eval_string ("\\&Bench::req_bound"), 0, VOID);
+  Coderef::Invoker hit (eval_string ("\\&Bench::hit"), 0, VOID);
+  Coderef::Invoker hit_bound (eval_string ("\\&Bench::hit_bound"), 0, VOID);
+  BENCH ("request-push-store",
+	 Scalarref ("Req::n") .store (i);
+	 Scalarref ("Req::load") .store (req_load);
+	 Scalarref ("Req::host") .store (req_host);
+	 req_push ());
+  GlobalHandle rn ("Req::n"), rl ("Req::load"), rh ("Req::host");
+  BENCH ("request-push-handle",
+	 rn .store (i); rl .store (req_load); rh .store (req_host);
+	 req_push ());
+  BENCH ("request-bound", req_n = i; req_bound ());
+  BENCH ("counter-perl", hit (); 
+	 sum += Scalarref ("Req::hits") .fetch () .as_long ());
+  BENCH ("counter-bound", hit_bound (); sum += hits);
+  interp .unbind_scalar ("Cfg::n");
+  interp .unbind_scalar ("Cfg::load");
+  interp .unbind_scalar ("Cfg::host");
+  interp .unbind_scalar ("Cfg::hits");
+
+  // A C++ method called from Perl 100 times per op: a sub_hashref
+  // callback on a blessed hash, against a Class method, against a
+  // method written in Perl.
+  Counter counter (0);
+  define_sub ("Bench::HCounter", "add", counter_add);
+  Scalar hobj = eval_string ("bless {}, 'Bench::HCounter'");
+  Hashref (hobj) .store ("ptr", (long) &counter);
+  eval_string ("sub Bench::PCounter::add { $_[0]{n} += $_[1] }"
+	       "sub Bench::call_add {"
+	       " my ($o, $t) = @_; $t = $o->add ($_) for 1 .. 100; $t }"
+	       "sub Bench::call_add_hashref {"
+	       " my ($o, $t) = @_; $t = $o->add (k => $_) for 1 .. 100; $t }");
+  Coderef call_add = eval_string ("\\&Bench::call_add");
+  Coderef call_add_hashref = eval_string ("\\&Bench::call_add_hashref");
+  BENCH_N ("class-method-hashref-x100", N / 100,
+	   sum += call_add_hashref (hobj) .as_long ());
+#ifdef PICKLE_RVALUE_REFS
+  Class<Counter> counter_class ("Bench::Counter");
+  counter_class .ctor<long> () .method ("add", &Counter::add);
+  Scalar cobj = counter_class .wrap (&counter, false);
+  BENCH_N ("class-method-typed-x100", N / 100,
+	   sum += call_add (cobj) .as_long ());
+#endif
+  Scalar pobj = eval_string ("bless { n => 0 }, 'Bench::PCounter'");
+  BENCH_N ("class-method-perl-x100", N / 100,
+	   sum += call_add (pobj) .as_long ());
+#ifdef PICKLE_RVALUE_REFS
+  Coderef make_counter = eval_string ("sub { Bench::Counter->new (5) }");
+  BENCH ("class-new-free", make_counter (VOID));
+#endif
+
+  // Handing a C++ container to a sub, copied into a new array or hash
+  // against tied in place, as the container grows.  The array sub
+  // reads every element and the hash sub one key.  -generic is a
+  // vector<float>, which misses the numeric fast path.
+  if (selected ("container"))
+    {
+      eval_string ("sub Bench::sum_all { my $t = 0; $t += $_ for @{$_[0]};"
+		   " $t }"
+		   "sub Bench::lookup { $_[0]{k7} }");
+      Coderef sum_all = eval_string ("\\&Bench::sum_all");
+      Coderef lookup = eval_string ("\\&Bench::lookup");
+      for (long size = 16; size <= 65536; size *= 64)
+	{
+	  std::vector<double> v (size, 1.5);
+	  std::vector<float> vf (size, 1.5);
+	  std::map<std::string, double> m;
+	  for (long k = 0; k < size; k++)
+	    {
+	      char key [32];
+	      snprintf (key, sizeof key, "k%ld", k);
+	      m [key] = k;
+	    }
+	  long count = 20 * N / size;
+	  char name [64];
+
+	  snprintf (name, sizeof name, "container-array-copy/n=%ld", size);
+	  BENCH_N (name, count,
+		   Arrayref a;
+		   for (long k = 0; k < size; k++)
+		     a .push (Scalar (v [k]));
+		   sum += sum_all (a) .as_long ());
+	  snprintf (name, sizeof name, "container-array-bind/n=%ld", size);
+	  BENCH_N (name, count, sum += sum_all (Arrayref::bind (v)) .as_long ());
+	  snprintf (name, sizeof name, "container-array-bind-generic/n=%ld",
+		    size);
+	  BENCH_N (name, count,
+		   sum += sum_all (Arrayref::bind (vf)) .as_long ());
+
+	  snprintf (name, sizeof name, "container-hash-copy/n=%ld", size);
+	  BENCH_N (name, count,
+		   Hashref h;
+		   for (std::map<std::string, double>::iterator it
+			  = m .begin (); it != m .end (); ++it)
+		     h .store (Scalar (it->first), Scalar (it->second));
+		   sum += lookup (h) .as_long ());
+	  snprintf (name, sizeof name, "container-hash-bind/n=%ld", size);
+	  BENCH_N (name, count, sum += lookup (Hashref::bind (m)) .as_long ());
+	}
+    }
+
+  // parallel_map over 1 to 32 threads against a plain map, in ns per
+  // item.  It starts many interpreters, so it runs only when named.
+  if (n_patterns && selected ("parallel-map"))
+    {
+      static const char work[] =
+	"sub Bench::work { my $x = 0; $x += $_ for 1 .. 50; $x + $_[0]{n} }";
+      eval_string (work);
+      Arrayref in = eval_string ("$Bench::in = [ map { { n => $_,"
+				 " s => 'x' x 20 } } 1 .. 100000 ]");
+      long items = in .size ();
+      double t0 = now ();
+      sum += Arrayref (eval_string ("[ map { Bench::work ($_) }"
+				    " @$Bench::in ]")) .size ();
+      report ("parallel-map/serial", items, now () - t0, 0, 0);
+
+      for (unsigned threads = 1; threads <= 32; threads *= 2)
+	{
+	  char name [64];
+	  Pool pool (threads);
+	  pool .eval_each (work);
+	  t0 = now ();
+	  sum += parallel_map (in, "\\&Bench::work", pool) .size ();
+	  snprintf (name, sizeof name, "parallel-map/threads=%u", threads);
+	  report (name, items, now () - t0, 0, 0);
+	  snprintf (name, sizeof name, "parallel-map/chunk/threads=%u",
+		    threads);
+	  note (name, pool .chunk_size ());
+	}
+    }
+
+  // RegexScanner over 1 to 32 threads against Regex::match in a
+  // loop, in ns per line.  Like parallel-map, it runs only when named.
+  if (n_patterns && selected ("regex-scan"))
+    {
+      std::vector<std::string> lines;
+      for (long l = 0; l < 200000; l++)
+	lines .push_back (l % 4 ? log_line
+			  : "2024-01-01 12:00:01 kernel: eth0 link up");
+      long items = lines .size ();
+      double t0 = now ();
+      for (long l = 0; l < items; l++)
+	sum += re .match (lines [l], m);
+      report ("regex-scan/serial", items, now () - t0, 0, 0);
+
+      for (unsigned threads = 1; threads <= 32; threads *= 2)
+	{
+	  char name [64];
+	  Pool pool (threads);
+	  RegexScanner scanner (pool, "(GET|POST) (\\S+) (\\d+)");
+	  t0 = now ();
+	  sum += scanner .scan (lines) .size ();
+	  snprintf (name, sizeof name, "regex-scan/threads=%u", threads);
+	  report (name, items, now () - t0, 0, 0);
+	}
+    }
+
+  if (sum == 0)
+    cout << "unexpected sum" << endl;
+}
+
+int
+main (int argc, char** argv)
+{
+  int i = 1;
+  for (; i < argc; i++)
+    if (strcmp (argv [i], "--json") == 0)
+      json = true;
+    else if (strcmp (argv [i], "--tag") == 0 && i + 1 < argc)
+      tag = argv [++i];
+    else
+      break;
+  patterns = argv + i;
+  n_patterns = argc - i;
+
+  if (! json)
+    cout << "# name\tns/op"
+#if REFCNT_COUNT
+	 << "\tincs/op\tdecs/op"
+#endif
+	 << endl;
+
+  Interpreter* p = Interpreter::vivify ();
+  run (*p);
+  delete p;
+  return 0;
+}
@@ -0,0 +1,196 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+
+namespace Pickle
+{
+
+  // What a bound scalar points at.  The state lives in the string
+  // buffer of an SV held by the magic, so a copy of the magic made by
+  // `local' shares it, and it goes when the last copy does.
+  enum Bind_kind
+  {
+    BIND_LONG, BIND_ULONG, BIND_INT, BIND_DOUBLE, BIND_BOOL, BIND_STRING,
+    BIND_COUNTER, BIND_UCOUNTER
+  };
+
+  struct Bind_state
+  {
+    void* ptr;
+    Bind_kind kind;
+    bool readonly;
+    unsigned long last;  // a counter's value as last read
+  };
+
+  static int
+  bind_get (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Bind_state* st = (Bind_state*) SvPVX (mg->mg_obj);
+    switch (st->kind)
+      {
+      case BIND_LONG:
+	sv_setiv (sv, *(long*) st->ptr);
+	break;
+      case BIND_ULONG:
+	sv_setuv (sv, *(unsigned long*) st->ptr);
+	break;
+      case BIND_INT:
+	sv_setiv (sv, *(int*) st->ptr);
+	break;
+      case BIND_DOUBLE:
+	sv_setnv (sv, *(double*) st->ptr);
+	break;
+      case BIND_BOOL:
+	sv_setsv (sv, *(bool*) st->ptr ? &PL_sv_yes : &PL_sv_no);
+	break;
+      case BIND_STRING:
+	{
+	  const string& s = *(string*) st->ptr;
+	  sv_setpvn (sv, s .data (), s .size ());
+	}
+	break;
+      case BIND_COUNTER:
+	st->last = __atomic_load_n ((unsigned long*) st->ptr,
+				    __ATOMIC_RELAXED);
+	sv_setiv (sv, (long) st->last);
+	break;
+      case BIND_UCOUNTER:
+	st->last = __atomic_load_n ((unsigned long*) st->ptr,
+				    __ATOMIC_RELAXED);
+	sv_setuv (sv, st->last);
+	break;
+      }
+    return 0;
+  }
+
+  static int
+  bind_set (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Bind_state* st = (Bind_state*) SvPVX (mg->mg_obj);
+    if (st->readonly)
+      croak ("%s", PL_no_modify);
+    switch (st->kind)
+      {
+      case BIND_LONG:
+	*(long*) st->ptr = SvIV_nomg (sv);
+	break;
+      case BIND_ULONG:
+	*(unsigned long*) st->ptr = SvUV_nomg (sv);
+	break;
+      case BIND_INT:
+	*(int*) st->ptr = (int) SvIV_nomg (sv);
+	break;
+      case BIND_DOUBLE:
+	*(double*) st->ptr = SvNV_nomg (sv);
+	break;
+      case BIND_BOOL:
+	*(bool*) st->ptr = SvTRUE_nomg (sv);
+	break;
+      case BIND_STRING:
+	{
+	  STRLEN len;
+	  const char* p = SvPV_nomg_const (sv, len);
+	  ((string*) st->ptr) ->assign (p, len);
+	}
+	break;
+      case BIND_COUNTER:
+      case BIND_UCOUNTER:
+	{
+	  // Wrapping arithmetic gives the signed difference too.
+	  unsigned long now = (st->kind == BIND_COUNTER
+			       ? (unsigned long) SvIV_nomg (sv)
+			       : (unsigned long) SvUV_nomg (sv));
+	  __atomic_fetch_add ((unsigned long*) st->ptr, now - st->last,
+			      __ATOMIC_RELAXED);
+	  st->last = now;
+	}
+	break;
+      }
+    return 0;
+  }
+
+  static MGVTBL bind_vtbl = { bind_get, bind_set, 0, 0, 0, 0, 0, 0 };
+
+  static SV*
+  bound_sv (pTHX_ const string& name)
+  {
+    SV* sv = GvSVn (fetch_gv (aTHX_ name .data (), name .size (), SVt_PV));
+    sv_unmagicext (sv, PERL_MAGIC_ext, &bind_vtbl);
+    return sv;
+  }
+
+  static void
+  bind (pTHX_ const string& name, const void* ptr, Bind_kind kind,
+	bool readonly)
+  {
+    SV* sv = bound_sv (aTHX_ name);
+    SV* obj = newSV (sizeof (Bind_state));
+    Bind_state* st = (Bind_state*) SvPVX (obj);
+    st->ptr = const_cast<void*> (ptr);
+    st->kind = kind;
+    st->readonly = readonly;
+    st->last = 0;
+    sv_magicext (sv, obj, PERL_MAGIC_ext, &bind_vtbl, 0, 0);
+    SvREFCNT_dec (obj);
+    // Load the value now, for code that looks without magic, and for
+    // a counter's first difference.
+    bind_get (aTHX_ sv, mg_findext (sv, PERL_MAGIC_ext, &bind_vtbl));
+  }
+
+  void Interpreter::bind_scalar (const string& name, long* ptr) const
+  { bind (aTHX_ name, ptr, BIND_LONG, false); }
+  void Interpreter::bind_scalar (const string& name, const long* ptr) const
+  { bind (aTHX_ name, ptr, BIND_LONG, true); }
+  void Interpreter::bind_scalar (const string& name, unsigned long* ptr) const
+  { bind (aTHX_ name, ptr, BIND_ULONG, false); }
+  void Interpreter::bind_scalar (const string& name,
+				 const unsigned long* ptr) const
+  { bind (aTHX_ name, ptr, BIND_ULONG, true); }
+  void Interpreter::bind_scalar (const string& name, int* ptr) const
+  { bind (aTHX_ name, ptr, BIND_INT, false); }
+  void Interpreter::bind_scalar (const string& name, const int* ptr) const
+  { bind (aTHX_ name, ptr, BIND_INT, true); }
+  void Interpreter::bind_scalar (const string& name, double* ptr) const
+  { bind (aTHX_ name, ptr, BIND_DOUBLE, false); }
+  void Interpreter::bind_scalar (const string& name, const double* ptr) const
+  { bind (aTHX_ name, ptr, BIND_DOUBLE, true); }
+  void Interpreter::bind_scalar (const string& name, bool* ptr) const
+  { bind (aTHX_ name, ptr, BIND_BOOL, false); }
+  void Interpreter::bind_scalar (const string& name, const bool* ptr) const
+  { bind (aTHX_ name, ptr, BIND_BOOL, true); }
+  void Interpreter::bind_scalar (const string& name, string* ptr) const
+  { bind (aTHX_ name, ptr, BIND_STRING, false); }
+  void Interpreter::bind_scalar (const string& name, const string* ptr) const
+  { bind (aTHX_ name, ptr, BIND_STRING, true); }
+
+  void Interpreter::bind_counter (const string& name, long* ptr) const
+  { bind (aTHX_ name, ptr, BIND_COUNTER, false); }
+  void Interpreter::bind_counter (const string& name,
+				  unsigned long* ptr) const
+  { bind (aTHX_ name, ptr, BIND_UCOUNTER, false); }
+
+  void Interpreter::unbind_scalar (const string& name) const
+  {
+    bound_sv (aTHX_ name);
+  }
+
+}
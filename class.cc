@@ -0,0 +1,231 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+#include <XSUB.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Pickle
+{
+
+  // The class's metadata lives in the string buffer of the meta SV,
+  // which the Class, each of its subs and each object hold a reference
+  // to, so it lasts as long as any of them.
+  struct Class_meta
+  {
+    Class_base::dtor_thunk dtor;
+  };
+
+  // What a method or constructor XSUB calls.  The CV's magic owns it.
+  struct Class_sub
+  {
+    Class_base::method_thunk method;
+    Class_base::ctor_thunk ctor;
+    void* pm;
+    unsigned nargs;
+    SV* meta;
+  };
+
+  // The object's magic has only a free hook, so leaves it unmagical
+  // to the rest of Perl.
+  static int
+  object_free (pTHX_ SV*, MAGIC* mg)
+  {
+    if (mg->mg_private && mg->mg_ptr)
+      ((Class_meta*) SvPVX (mg->mg_obj)) ->dtor (mg->mg_ptr);
+    return 0;
+  }
+
+  static MGVTBL object_vtbl = { 0, 0, 0, 0, object_free, 0, 0, 0 };
+
+  static int
+  sub_free (pTHX_ SV*, MAGIC* mg)
+  {
+    Class_sub* s = (Class_sub*) mg->mg_ptr;
+    free (s->pm);
+    delete s;
+    return 0;
+  }
+
+  static MGVTBL sub_vtbl = { 0, 0, 0, 0, sub_free, 0, 0, 0 };
+
+  // XXX A thread cloned with its interpreter would share the objects
+  // and delete them twice.
+  static SV*
+  new_object (pTHX_ void* obj, SV* meta, bool owned, HV* stash)
+  {
+    SV* inner = newSV_type (SVt_PVMG);
+    MAGIC* mg = sv_magicext (inner, meta, PERL_MAGIC_ext, &object_vtbl,
+			     (const char*) obj, 0);
+    mg->mg_private = owned;
+    return sv_bless (newRV_noinc (inner), stash);
+  }
+
+  static void*
+  object_of (pTHX_ SV* sv, SV* meta)
+  {
+    if (! SvROK (sv))
+      return 0;
+    SV* inner = SvRV (sv);
+    if (SvTYPE (inner) < SVt_PVMG)
+      return 0;
+    for (MAGIC* mg = SvMAGIC (inner); mg; mg = mg->mg_moremagic)
+      if (mg->mg_virtual == &object_vtbl && mg->mg_obj == meta)
+	return mg->mg_ptr;
+    return 0;
+  }
+
+  static void
+  check_items (pTHX_ CV* cv, Class_sub* s, I32 items)
+  {
+    if (items != (I32) s->nargs + 1)
+      croak ("Usage: %s: expected %u argument%s, got %d", GvNAME (CvGV (cv)),
+	     s->nargs, s->nargs == 1 ? "" : "s", (int) items - 1);
+  }
+
+  static void
+  xs_method (pTHX_ CV* cv)
+  {
+    dXSARGS;
+    Class_sub* s = (Class_sub*) CvXSUBANY (cv) .any_ptr;
+    check_items (aTHX_ cv, s, items);
+    void* obj = object_of (aTHX_ ST (0), s->meta);
+    if (! obj)
+      croak ("%s: not called on an object of its class", GvNAME (CvGV (cv)));
+
+    // The arguments are lent to the thunk as Scalars.  A conversion
+    // that runs Perl code may move the stack, so they are copied out.
+    SV* args [Class_base::MAX_ARGS];
+    for (I32 i = 1; i < items; i++)
+      args [i - 1] = ST (i);
+
+    Prof_guard prof (aTHX_ PROF_XSUB, (SV*) cv);
+    try
+      {
+	Scalar ret (s->method (obj, s->pm, (const Scalar*) args));
+	if (! ret .get_imp ())
+	  XSRETURN_EMPTY;
+	ST (0) = sv_2mortal (ret .release ());
+      }
+    catch (Exception* e)
+      {
+	prof .leave ();
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_ctor (pTHX_ CV* cv)
+  {
+    dXSARGS;
+    Class_sub* s = (Class_sub*) CvXSUBANY (cv) .any_ptr;
+    check_items (aTHX_ cv, s, items);
+    // Bless into the class it was called on, to allow subclasses.
+    HV* stash = (SvROK (ST (0)) && SvOBJECT (SvRV (ST (0)))
+		 ? SvSTASH (SvRV (ST (0))) : gv_stashsv (ST (0), GV_ADD));
+
+    SV* args [Class_base::MAX_ARGS];
+    for (I32 i = 1; i < items; i++)
+      args [i - 1] = ST (i);
+
+    Prof_guard prof (aTHX_ PROF_XSUB, (SV*) cv);
+    void* obj = 0;
+    try
+      {
+	obj = s->ctor ((const Scalar*) args);
+      }
+    catch (Exception* e)
+      {
+	prof .leave ();
+	propagate_to_perl (aTHX_ e);
+      }
+    ST (0) = sv_2mortal (new_object (aTHX_ obj, s->meta, true, stash));
+    XSRETURN (1);
+  }
+
+  static SV*
+  new_meta (Class_base::dtor_thunk dtor)
+  {
+    dTHX;
+    SV* meta = newSV (sizeof (Class_meta));
+    ((Class_meta*) SvPVX (meta)) ->dtor = dtor;
+    return meta;
+  }
+
+  Class_base::Class_base (const string& pkg, dtor_thunk dtor)
+    : package (pkg), meta (new_meta (dtor)) {}
+
+  static void
+  define (pTHX_ const string& fullname, XSUBADDR_t xs, Class_sub* s)
+  {
+    CV* cv = newXS (const_cast<char*> (fullname .c_str ()), xs,
+		    const_cast<char*> (__FILE__));
+    CvXSUBANY (cv) .any_ptr = s;
+    sv_magicext ((SV*) cv, s->meta, PERL_MAGIC_ext, &sub_vtbl,
+		 (const char*) s, 0);
+  }
+
+  void
+  Class_base::add_method (const string& name, method_thunk fn,
+			  const void* pm, size_t pm_size, unsigned nargs)
+  {
+    dTHX;
+    Class_sub* s = new Class_sub;
+    s->method = fn;
+    s->ctor = 0;
+    s->pm = malloc (pm_size);
+    memcpy (s->pm, pm, pm_size);
+    s->nargs = nargs;
+    s->meta = meta .get_imp ();
+    define (aTHX_ package + "::" + name, xs_method, s);
+  }
+
+  void
+  Class_base::add_ctor (const string& name, ctor_thunk fn, unsigned nargs)
+  {
+    dTHX;
+    Class_sub* s = new Class_sub;
+    s->method = 0;
+    s->ctor = fn;
+    s->pm = 0;
+    s->nargs = nargs;
+    s->meta = meta .get_imp ();
+    define (aTHX_ package + "::" + name, xs_ctor, s);
+  }
+
+  Scalar
+  Class_base::wrap (void* obj, bool owned) const
+  {
+    dTHX;
+    HV* stash = gv_stashpvn (package .data (), package .size (), GV_ADD);
+    return Scalar (new_object (aTHX_ obj, meta .get_imp (), owned, stash));
+  }
+
+  void*
+  Class_base::unwrap (const Scalar& obj) const
+  {
+    dTHX;
+    return object_of (aTHX_ obj .get_imp (), meta .get_imp ());
+  }
+
+}
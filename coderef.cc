@@ -24,4 +24,269 @@
 namespace Pickle
 {
 
+  // Calls through a Coderef go to the CV itself, skipping the
+  // reference, with the arguments pushed straight from the caller's
+  // Scalars rather than gathered into a List first.
+
+  static inline I32
+  call_flags (Context cx)
+  {
+    switch (cx)
+      {
+      default:
+      case SCALAR: return G_SCALAR;
+      case LIST  : return G_ARRAY;
+      case VOID  : return G_VOID;
+      }
+  }
+
+  // Take the results of a call that returned N values in FLAGS
+  // context off the stack, as call_function does.
+  static inline SV*
+  take_results (pTHX_ I32 flags, I32 n)
+  {
+    dSP;
+    SV* ret;
+    if ((flags & G_WANT) == G_ARRAY)
+      {
+	SP -= n;
+	ret = newRV_noinc ((SV*) av_make (n, SP + 1));
+      }
+    else if ((flags & G_WANT) == G_VOID)
+      {
+	SP -= n;
+	ret = SvREFCNT_inc (&PL_sv_undef);
+      }
+    else
+      ret = SvREFCNT_inc (POPs);
+    PUTBACK;
+    return ret;
+  }
+
+  static SV*
+  call_cv (pTHX_ SV* code, int argc, SV* const* argv, Context cx)
+  {
+    dSP;
+    CV* cv = (CV*) SvRV (code);
+    I32 flags = call_flags (cx);
+    SV* err = 0;
+    Prof_guard prof (aTHX_ PROF_CALL, code);
+    char buf [128];
+    bool probing = PICKLE_PROBE_ENABLED (call_entry)
+      || PICKLE_PROBE_ENABLED (call_return);
+    const char* name = probing ? sub_name (aTHX_ code, buf, sizeof buf) : 0;
+    PICKLE_PROBE2 (call_entry, name, argc);
+
+    ENTER;
+    SAVETMPS;
+    save_scalar (PL_errgv);
+    PUSHMARK (SP);
+    EXTEND (SP, argc);
+    for (int i = 0; i < argc; i++)
+      PUSHs (argv [i]);
+    PUTBACK;
+    I32 n = call_sv ((SV*) cv, flags | G_EVAL);
+    SV* ret = take_results (aTHX_ flags, n);
+    if (SvTRUE (ERRSV))
+      err = newSVsv (ERRSV);
+    PICKLE_PROBE2 (call_return, name, err != 0);
+    FREETMPS;
+    LEAVE;
+
+    if (err)
+      {
+	SvREFCNT_dec (ret);
+	throw new Exception (Scalar (err));
+      }
+    return ret;
+  }
+
+  Scalar
+  Coderef::operator() (Context cx) const
+  {
+    dInterp;
+    return call_cv (aTHX_ imp, 0, 0, cx);
+  }
+
+  Scalar
+  Coderef::operator() (const Scalar& a, Context cx) const
+  {
+    dInterp;
+    SV* argv [1] = { a .get_imp () };
+    return call_cv (aTHX_ imp, 1, argv, cx);
+  }
+
+  Scalar
+  Coderef::operator() (const Scalar& a, const Scalar& b, Context cx) const
+  {
+    dInterp;
+    SV* argv [2] = { a .get_imp (), b .get_imp () };
+    return call_cv (aTHX_ imp, 2, argv, cx);
+  }
+
+  Scalar
+  Coderef::operator() (const Scalar& a, const Scalar& b, const Scalar& c,
+		       Context cx) const
+  {
+    dInterp;
+    SV* argv [3] = { a .get_imp (), b .get_imp (), c .get_imp () };
+    return call_cv (aTHX_ imp, 3, argv, cx);
+  }
+
+  Scalar
+  Coderef::operator() (const List& args, Context cx) const
+  {
+    dInterp;
+    AV* av = (AV*) SvRV (((const Arrayref&) args) .get_imp ());
+    return call_cv (aTHX_ imp, 1 + AvFILL (av), AvARRAY (av), cx);
+  }
+
+  // Invoker.
+
+  struct Invoker_imp
+  {
+#ifdef PERL_IMPLICIT_CONTEXT
+    PerlInterpreter* perl;
+#endif
+    CV* cv;
+    I32 flags;
+    vector<SV*> args;
+  };
+
+#ifdef PERL_IMPLICIT_CONTEXT
+#  define dInvoker PerlInterpreter* my_perl = imp->perl
+#else
+#  define dInvoker dNOOP
+#endif
+
+  Coderef::Invoker::Invoker (const Coderef& code, unsigned nargs,
+			     Context cx)
+    : imp (new Invoker_imp)
+  {
+    dInterp;
+#ifdef PERL_IMPLICIT_CONTEXT
+    imp->perl = my_perl;
+#endif
+    imp->cv = (CV*) SvREFCNT_inc (SvRV (code .get_imp ()));
+    imp->flags = call_flags (cx) | G_EVAL;
+    if (nargs == 0)
+      imp->flags |= G_NOARGS;
+    if (cx == VOID)
+      imp->flags |= G_DISCARD;
+    for (unsigned i = 0; i < nargs; i++)
+      imp->args .push_back (newSV (0));
+  }
+
+  Coderef::Invoker::~Invoker ()
+  {
+    dInvoker;
+    for (size_t i = 0; i < imp->args .size (); i++)
+      SvREFCNT_dec (imp->args [i]);
+    SvREFCNT_dec (imp->cv);
+    delete imp;
+  }
+
+  // The argument scalar I, ready to be set: a new one if the last
+  // call's sub kept a reference to it or made it read-only.
+  static inline SV*
+  arg_sv (pTHX_ Invoker_imp* imp, unsigned i)
+  {
+    if (i >= imp->args .size ())
+      throw new Exception ("Invoker: argument index out of range");
+    SV*& sv = imp->args [i];
+    if (SvREFCNT (sv) > 1 || SvREADONLY (sv) || SvMAGICAL (sv)
+	|| SvTYPE (sv) > SVt_PVMG)
+      {
+	SvREFCNT_dec (sv);
+	sv = newSV (0);
+      }
+    return sv;
+  }
+
+  Coderef::Invoker&
+  Coderef::Invoker::set (unsigned i, long n)
+  {
+    dInvoker;
+    sv_setiv (arg_sv (aTHX_ imp, i), n);
+    return *this;
+  }
+
+  Coderef::Invoker&
+  Coderef::Invoker::set (unsigned i, double d)
+  {
+    dInvoker;
+    sv_setnv (arg_sv (aTHX_ imp, i), d);
+    return *this;
+  }
+
+  Coderef::Invoker&
+  Coderef::Invoker::set (unsigned i, const char* s)
+  {
+    dInvoker;
+    sv_setpv (arg_sv (aTHX_ imp, i), s);
+    return *this;
+  }
+
+  Coderef::Invoker&
+  Coderef::Invoker::set (unsigned i, const char* s, size_t len)
+  {
+    dInvoker;
+    sv_setpvn (arg_sv (aTHX_ imp, i), s, len);
+    return *this;
+  }
+
+  Coderef::Invoker&
+  Coderef::Invoker::set (unsigned i, const Scalar& v)
+  {
+    dInvoker;
+    sv_setsv (arg_sv (aTHX_ imp, i), v .get_imp ());
+    return *this;
+  }
+
+  // G_DISCARD has call_sv free the temporaries itself, so a void call
+  // needs no scope of its own.
+  Scalar
+  Coderef::Invoker::operator() ()
+  {
+    dInvoker;
+    dSP;
+    I32 flags = imp->flags;
+    Prof_guard prof (aTHX_ PROF_CALL, (SV*) imp->cv);
+
+    // The sub's entry pops a mark even under G_NOARGS.
+    PUSHMARK (SP);
+    if (! (flags & G_NOARGS))
+      {
+	size_t argc = imp->args .size ();
+	EXTEND (SP, (SSize_t) argc);
+	for (size_t i = 0; i < argc; i++)
+	  PUSHs (imp->args [i]);
+	PUTBACK;
+      }
+
+    if (flags & G_DISCARD)
+      {
+	call_sv ((SV*) imp->cv, flags);
+	if (SvTRUE (ERRSV))
+	  throw new Exception (Scalar (newSVsv (ERRSV)));
+	return Scalar (SvREFCNT_inc (&PL_sv_undef));
+      }
+
+    SV* err = 0;
+    ENTER;
+    SAVETMPS;
+    I32 n = call_sv ((SV*) imp->cv, flags);
+    SV* ret = take_results (aTHX_ flags, n);
+    if (SvTRUE (ERRSV))
+      err = newSVsv (ERRSV);
+    FREETMPS;
+    LEAVE;
+    if (err)
+      {
+	SvREFCNT_dec (ret);
+	throw new Exception (Scalar (err));
+      }
+    return Scalar (ret);
+  }
+
 }
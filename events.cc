@@ -0,0 +1,462 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+// Without this, XSUB.h makes aTHX the thread's current interpreter
+// rather than the one passed in.
+#define PERL_NO_GET_CONTEXT
+#include "pickle_int.hh"
+#include <XSUB.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <sys/eventfd.h>
+#endif
+
+namespace Pickle
+{
+
+  // A bounded multi-producer, single-consumer ring after Dmitry
+  // Vyukov's.  Each cell carries a sequence number: a producer may
+  // fill cell C at position P when its sequence is P, and publishes it
+  // by setting it to P + 1; the consumer empties it and sets it to
+  // P + size, the next lap's position.  Producers claim positions with
+  // a compare and swap, so none waits on another except while one is
+  // between claiming a cell and publishing it.
+  //
+  // A cell is one cache line.  Strings short enough live in the cell;
+  // longer ones are copied to the heap by the producer.
+
+  enum Event_kind
+  { EV_LONG, EV_DOUBLE, EV_STRING, EV_HEAP_STRING, EV_NATIVE };
+  enum { INLINE_LEN = 32 };
+
+  struct Event_cell
+  {
+    unsigned long seq;
+    unsigned kind;
+    unsigned len;
+    union
+    {
+      long n;
+      double d;
+      char* s;
+      void* payload;
+    } u;
+    EventQueue::convert_fn fn;
+    char text [INLINE_LEN];
+  };
+
+  // What a drain sub needs, in CvXSUBANY.  Perl never frees a named
+  // sub, so this outlives the queue, which clears QUEUE when
+  // destroyed.
+  struct Drain_def
+  {
+    EventQueue* queue;
+    const Interpreter* interp;
+    Drain_def* next;
+  };
+
+  struct Event_ring
+  {
+    Event_cell* cells;
+    unsigned long mask;
+    int read_fd;
+    int write_fd;
+    Async_pool* async;       // started by the first async sub
+    Async_def* async_defs;   // the async subs, to detach when destroyed
+    unsigned async_threads;
+    Drain_def* drain_defs;   // the drain subs, likewise
+    // Keep the producers' and the consumer's counters on separate
+    // cache lines.
+    char pad0 [64];
+    unsigned long head;      // next position to claim
+    unsigned long n_dropped;
+    int signalled;           // a wakeup is outstanding
+    char pad1 [64];
+    unsigned long tail;      // next position to drain
+  };
+
+  EventQueue::EventQueue (size_t capacity)
+  {
+    size_t size = 2;
+    while (size < capacity)
+      size <<= 1;
+
+    ring = new Event_ring;
+    memset (ring, 0, sizeof *ring);
+    ring->mask = size - 1;
+    ring->cells = (Event_cell*) calloc (size, sizeof (Event_cell));
+    if (! ring->cells)
+      {
+	delete ring;
+	throw new Exception ("EventQueue: out of memory");
+      }
+    for (size_t i = 0; i < size; i++)
+      ring->cells [i] .seq = i;
+
+#ifdef __linux__
+    ring->read_fd = ring->write_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->read_fd < 0)
+#else
+    int fds [2];
+    if (pipe (fds) == 0)
+      {
+	ring->read_fd = fds [0];
+	ring->write_fd = fds [1];
+	for (int i = 0; i < 2; i++)
+	  {
+	    fcntl (fds [i], F_SETFL, fcntl (fds [i], F_GETFL) | O_NONBLOCK);
+	    fcntl (fds [i], F_SETFD, FD_CLOEXEC);
+	  }
+      }
+    else
+#endif
+      {
+	free (ring->cells);
+	delete ring;
+	throw new Exception (string ("EventQueue: ") + strerror (errno));
+      }
+  }
+
+  // Events still queued are freed unconverted.  A native payload is
+  // passed to its converter only on the interpreter's thread, so one
+  // left behind leaks.  Async work still running is waited for, and
+  // the subs croak from now on.
+  EventQueue::~EventQueue ()
+  {
+    async_detach (ring->async_defs);
+    for (Drain_def* def = ring->drain_defs; def; def = def->next)
+      def->queue = 0;
+    async_stop (ring->async);
+    for (unsigned long i = ring->tail; i != ring->head; i++)
+      {
+	Event_cell& c = ring->cells [i & ring->mask];
+	if (c.kind == EV_HEAP_STRING)
+	  free (c.u.s);
+      }
+    if (ring->write_fd != ring->read_fd)
+      close (ring->write_fd);
+    close (ring->read_fd);
+    free (ring->cells);
+    delete ring;
+  }
+
+  static void
+  wake (Event_ring* r)
+  {
+#ifdef __linux__
+    uint64_t one = 1;
+    ssize_t n = write (r->write_fd, &one, sizeof one);
+#else
+    char one = 1;
+    ssize_t n = write (r->write_fd, &one, 1);
+#endif
+    (void) n;  // EAGAIN means it is readable anyway.
+  }
+
+  static void
+  clear_wakeup (Event_ring* r)
+  {
+    char junk [64];
+    while (read (r->read_fd, junk, sizeof junk) > 0)
+      ;
+  }
+
+  // Wake the consumer again if it left events behind.
+  static void
+  rewake (Event_ring* r)
+  {
+    if (r->tail != __atomic_load_n (&r->head, __ATOMIC_ACQUIRE)
+	&& ! __atomic_exchange_n (&r->signalled, 1, __ATOMIC_SEQ_CST))
+      wake (r);
+  }
+
+  // Claim a cell, or return null if the ring is full.
+  static Event_cell*
+  claim (Event_ring* r, unsigned long& pos)
+  {
+    pos = __atomic_load_n (&r->head, __ATOMIC_RELAXED);
+    for (;;)
+      {
+	Event_cell* c = &r->cells [pos & r->mask];
+	long diff = (long) (__atomic_load_n (&c->seq, __ATOMIC_ACQUIRE) - pos);
+	if (diff == 0)
+	  {
+	    if (__atomic_compare_exchange_n (&r->head, &pos, pos + 1, true,
+					     __ATOMIC_RELAXED,
+					     __ATOMIC_RELAXED))
+	      return c;
+	  }
+	else if (diff < 0)
+	  {
+	    __atomic_fetch_add (&r->n_dropped, 1, __ATOMIC_RELAXED);
+	    return 0;
+	  }
+	else
+	  pos = __atomic_load_n (&r->head, __ATOMIC_RELAXED);
+      }
+  }
+
+  // Make the cell at POS visible to the consumer, and wake it unless a
+  // wakeup is already outstanding, so a burst of events costs one
+  // system call.
+  static bool
+  publish (Event_ring* r, Event_cell* c, unsigned long pos)
+  {
+    __atomic_store_n (&c->seq, pos + 1, __ATOMIC_RELEASE);
+    if (! __atomic_exchange_n (&r->signalled, 1, __ATOMIC_SEQ_CST))
+      wake (r);
+    return true;
+  }
+
+  bool
+  EventQueue::post (long n)
+  {
+    unsigned long pos;
+    Event_cell* c = claim (ring, pos);
+    if (! c)
+      return false;
+    c->kind = EV_LONG;
+    c->u.n = n;
+    return publish (ring, c, pos);
+  }
+
+  bool
+  EventQueue::post (double d)
+  {
+    unsigned long pos;
+    Event_cell* c = claim (ring, pos);
+    if (! c)
+      return false;
+    c->kind = EV_DOUBLE;
+    c->u.d = d;
+    return publish (ring, c, pos);
+  }
+
+  bool
+  EventQueue::post (const char* s, size_t len)
+  {
+    char* heap = 0;
+    if (len > INLINE_LEN)
+      {
+	// Copy before claiming, so a full ring costs no more than this.
+	heap = (char*) malloc (len);
+	if (! heap)
+	  return false;
+	memcpy (heap, s, len);
+      }
+
+    unsigned long pos;
+    Event_cell* c = claim (ring, pos);
+    if (! c)
+      {
+	free (heap);
+	return false;
+      }
+    c->len = len;
+    if (heap)
+      {
+	c->kind = EV_HEAP_STRING;
+	c->u.s = heap;
+      }
+    else
+      {
+	c->kind = EV_STRING;
+	memcpy (c->text, s, len);
+      }
+    return publish (ring, c, pos);
+  }
+
+  bool
+  EventQueue::post (const string& s)
+  {
+    return post (s .data (), s .size ());
+  }
+
+  bool
+  EventQueue::post (convert_fn fn, void* payload)
+  {
+    unsigned long pos;
+    Event_cell* c = claim (ring, pos);
+    if (! c)
+      return false;
+    c->kind = EV_NATIVE;
+    c->fn = fn;
+    c->u.payload = payload;
+    return publish (ring, c, pos);
+  }
+
+  int
+  EventQueue::fd () const
+  {
+    return ring->read_fd;
+  }
+
+  size_t
+  EventQueue::pending () const
+  {
+    return __atomic_load_n (&ring->head, __ATOMIC_RELAXED)
+      - __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+  }
+
+  unsigned long
+  EventQueue::dropped () const
+  {
+    return __atomic_load_n (&ring->n_dropped, __ATOMIC_RELAXED);
+  }
+
+  Arrayref
+  EventQueue::drain (const Interpreter& i, size_t max)
+  {
+    dInterpOf (i);
+    Event_ring* r = ring;
+
+    // Rearm before looking, so an event published after the last one
+    // we see wakes us again.
+    clear_wakeup (r);
+    __atomic_store_n (&r->signalled, 0, __ATOMIC_SEQ_CST);
+
+    unsigned long tail = r->tail;
+    unsigned long head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+    size_t n = head - tail;
+    if (max && n > max)
+      n = max;
+
+    AV* av = newAV ();
+    Arrayref ret (newRV_noinc ((SV*) av), false);
+    if (n)
+      av_extend (av, n - 1);
+
+    for (size_t k = 0; k < n; k++, tail++)
+      {
+	Event_cell& c = r->cells [tail & r->mask];
+	// A producer that has claimed the cell may not have filled it.
+	if (__atomic_load_n (&c.seq, __ATOMIC_ACQUIRE) != tail + 1)
+	  break;
+
+	SV* sv;
+	switch (c.kind)
+	  {
+	  case EV_LONG:
+	    sv = newSViv (c.u.n);
+	    break;
+	  case EV_DOUBLE:
+	    sv = newSVnv (c.u.d);
+	    break;
+	  case EV_STRING:
+	    sv = newSVpvn (c.text, c.len);
+	    break;
+	  case EV_HEAP_STRING:
+	    sv = newSVpvn (c.u.s, c.len);
+	    free (c.u.s);
+	    break;
+	  default:
+	    {
+	      convert_fn fn = c.fn;
+	      void* payload = c.u.payload;
+	      // Free the cell first, in case FN throws.
+	      __atomic_store_n (&c.seq, tail + r->mask + 1, __ATOMIC_RELEASE);
+	      r->tail = tail + 1;
+	      try
+		{
+		  av_push (av, fn (i, payload) .release ());
+		}
+	      catch (...)
+		{
+		  rewake (r);
+		  throw;
+		}
+	      continue;
+	    }
+	  }
+	__atomic_store_n (&c.seq, tail + r->mask + 1, __ATOMIC_RELEASE);
+	r->tail = tail + 1;
+	av_push (av, sv);
+      }
+
+    // Leftovers, whether over MAX or not yet published, need another
+    // wakeup.
+    rewake (r);
+    return ret;
+  }
+
+  // PACKAGE::NAME ([MAX]) drains the queue into an array reference.
+  static void
+  xs_drain (pTHX_ CV* cv)
+  {
+    dXSARGS;
+    if (items > 1)
+      croak ("Usage: %s([max])", GvNAME (CvGV (cv)));
+
+    Drain_def* def = (Drain_def*) CvXSUBANY (cv) .any_ptr;
+    if (! def->queue)
+      croak ("%s: queue destroyed", GvNAME (CvGV (cv)));
+    size_t max = items ? (size_t) SvUV (ST (0)) : 0;
+    SV* ret = 0;
+    try
+      {
+	ret = def->queue->drain (*def->interp, max) .release ();
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    ST (0) = sv_2mortal (ret);
+    XSRETURN (1);
+  }
+
+  void
+  EventQueue::define_sub (const Interpreter& i, const string& package,
+			  const string& name)
+  {
+    dInterpOf (i);
+    string fullname (package);
+    fullname .append ("::") .append (name);
+    CV* cv = newXS (const_cast<char*> (fullname .c_str ()),
+		    xs_drain, const_cast<char*> (__FILE__));
+    Drain_def* def = new Drain_def;  // lives as long as the sub
+    def->queue = this;
+    def->interp = &i;
+    def->next = ring->drain_defs;
+    ring->drain_defs = def;
+    CvXSUBANY (cv) .any_ptr = def;
+  }
+
+  void
+  EventQueue::define_async_sub (const Interpreter& i, const string& package,
+				const string& name, async_sub fn)
+  {
+    dInterpOf (i);
+    async_define (aTHX_ this, ring->async, ring->async_defs,
+		  ring->async_threads, package + "::" + name, fn);
+  }
+
+  void
+  EventQueue::async_threads (unsigned n)
+  {
+    ring->async_threads = n;
+  }
+
+}
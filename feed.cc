@@ -0,0 +1,334 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+#include "pickle_int.hh"
+#include <pthread.h>
+#include <string.h>
+#include <exception>
+
+namespace Pickle
+{
+
+  // Records reach the handler as the elements of one array, whose
+  // scalars Feed keeps between batches and overwrites with sv_setpvn,
+  // so a string no longer than the last one in its place costs no
+  // allocation.  A scalar or the array that the handler kept a
+  // reference to is left to the handler and replaced.
+  //
+  // Under run(), the producer appends records to one of two byte
+  // buffers while the interpreter's thread copies the other into the
+  // array and calls the handler.
+
+  struct Feed_buffer
+  {
+    std::string bytes;
+    std::vector<size_t> ends;
+  };
+
+  struct Feed_imp
+  {
+    PerlInterpreter* perl;
+    SV* handler;
+    AV* av;
+    std::vector<SV*> svs;  // one reference to each, held here
+    size_t batch;
+    size_t fill;           // records in the array, outside run()
+    unsigned long records;
+    unsigned long batches;
+
+    // For run().
+    bool threaded;
+    Feed_buffer buf [2];
+    bool full [2];
+    int filling;           // the producer's buffer
+    bool done;             // the producer has returned
+    bool stopped;          // the handler died
+    std::string error;     // what the producer threw
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Feed* feed;
+    Feed::producer_fn producer;
+    void* arg;
+  };
+
+#ifdef PERL_IMPLICIT_CONTEXT
+#  define dFeed(f) PerlInterpreter* my_perl = (f)->perl
+#else
+#  define dFeed(f) dNOOP
+#endif
+
+  static void
+  new_array (pTHX_ Feed_imp* f)
+  {
+    if (f->av)
+      SvREFCNT_dec (f->av);
+    f->av = newAV ();
+    av_extend (f->av, f->batch - 1);
+  }
+
+  // Make room for a batch, in case the handler emptied the array
+  // with undef.
+  static void
+  begin_batch (pTHX_ Feed_imp* f)
+  {
+    if (AvMAX (f->av) < (SSize_t) f->batch - 1)
+      av_extend (f->av, f->batch - 1);
+  }
+
+  static inline void
+  put (pTHX_ Feed_imp* f, size_t i, const char* data, size_t len)
+  {
+    SV* sv = f->svs [i];
+    if (SvREFCNT (sv) > 1 || SvTYPE (sv) > SVt_PVMG || SvMAGICAL (sv)
+	|| SvREADONLY (sv) || SvROK (sv))
+      {
+	SvREFCNT_dec (sv);
+	f->svs [i] = sv = newSV (len);
+      }
+    sv_setpvn (sv, data, len);
+    SvUTF8_off (sv);
+    AvARRAY (f->av) [i] = SvREFCNT_inc (sv);
+  }
+
+  // Hand the N records in the array to the handler, then empty it.
+  static void
+  end_batch (pTHX_ Feed_imp* f, size_t n)
+  {
+    AvFILLp (f->av) = n - 1;
+    f->records += n;
+    f->batches++;
+
+    dSP;
+    ENTER;
+    SAVETMPS;
+    PUSHMARK (SP);
+    XPUSHs (sv_2mortal (newRV ((SV*) f->av)));
+    PUTBACK;
+    call_sv (f->handler, G_VOID | G_DISCARD | G_EVAL);
+    SV* err = SvTRUE (ERRSV) ? newSVsv (ERRSV) : 0;
+    FREETMPS;
+    LEAVE;
+
+    if (SvREFCNT (f->av) > 1 || SvRMAGICAL (f->av))
+      new_array (aTHX_ f);
+    else
+      av_clear (f->av);
+    if (err)
+      throw new Exception (Scalar (err));
+  }
+
+  Feed::Feed (const Interpreter& i, const Scalar& handler, size_t batch)
+    : imp (new Feed_imp)
+  {
+    dInterpOf (i);
+    imp->perl = i.my_perl;
+    imp->handler = SvREFCNT_inc (handler .get_imp ());
+    imp->batch = batch ? batch : 1;
+    imp->av = 0;
+    new_array (aTHX_ imp);
+    imp->svs .reserve (imp->batch);
+    for (size_t n = 0; n < imp->batch; n++)
+      imp->svs .push_back (newSV (0));
+    imp->fill = 0;
+    imp->records = imp->batches = 0;
+    imp->threaded = false;
+    pthread_mutex_init (&imp->mutex, 0);
+    pthread_cond_init (&imp->cond, 0);
+  }
+
+  Feed::~Feed ()
+  {
+    dFeed (imp);
+    for (size_t n = 0; n < imp->fill; n++)
+      SvREFCNT_dec (AvARRAY (imp->av) [n]);
+    SvREFCNT_dec (imp->av);
+    for (size_t n = 0; n < imp->svs .size (); n++)
+      SvREFCNT_dec (imp->svs [n]);
+    SvREFCNT_dec (imp->handler);
+    pthread_cond_destroy (&imp->cond);
+    pthread_mutex_destroy (&imp->mutex);
+    delete imp;
+  }
+
+  bool
+  Feed::push (const char* data, size_t len)
+  {
+    Feed_imp* f = imp;
+    if (! f->threaded)
+      {
+	dFeed (f);
+	if (f->fill == 0)
+	  begin_batch (aTHX_ f);
+	put (aTHX_ f, f->fill++, data, len);
+	if (f->fill == f->batch)
+	  {
+	    f->fill = 0;
+	    end_batch (aTHX_ f, f->batch);
+	  }
+	return true;
+      }
+
+    Feed_buffer& b = f->buf [f->filling];
+    b.bytes .append (data, len);
+    b.ends .push_back (b.bytes .size ());
+    if (b.ends .size () < f->batch)
+      return true;
+
+    // Hand over the full buffer and wait for the other to be free.
+    pthread_mutex_lock (&f->mutex);
+    f->full [f->filling] = true;
+    pthread_cond_broadcast (&f->cond);
+    f->filling ^= 1;
+    while (f->full [f->filling] && ! f->stopped)
+      pthread_cond_wait (&f->cond, &f->mutex);
+    bool ok = ! f->stopped;
+    pthread_mutex_unlock (&f->mutex);
+    return ok;
+  }
+
+  void
+  Feed::flush ()
+  {
+    if (imp->threaded || imp->fill == 0)
+      return;
+    dFeed (imp);
+    size_t n = imp->fill;
+    imp->fill = 0;
+    end_batch (aTHX_ imp, n);
+  }
+
+  static void*
+  producer_main (void* arg)
+  {
+    Feed_imp* f = (Feed_imp*) arg;
+    std::string error;
+    try
+      {
+	f->producer (*f->feed, f->arg);
+      }
+    catch (std::exception& e)
+      {
+	error = e .what ();
+      }
+    catch (...)
+      {
+	error = "unknown exception in Feed producer";
+      }
+
+    pthread_mutex_lock (&f->mutex);
+    if (! f->buf [f->filling] .ends .empty ())
+      f->full [f->filling] = true;
+    f->error = error;
+    f->done = true;
+    pthread_cond_broadcast (&f->cond);
+    pthread_mutex_unlock (&f->mutex);
+    return 0;
+  }
+
+  void
+  Feed::run (producer_fn producer, void* arg)
+  {
+    Feed_imp* f = imp;
+    dFeed (f);
+    flush ();
+
+    f->threaded = true;
+    f->filling = 0;
+    f->full [0] = f->full [1] = false;
+    f->done = f->stopped = false;
+    f->error .clear ();
+    f->feed = this;
+    f->producer = producer;
+    f->arg = arg;
+    pthread_t thread;
+    if (pthread_create (&thread, 0, producer_main, f) != 0)
+      {
+	f->threaded = false;
+	throw new Exception ("Feed: cannot start the producer thread");
+      }
+
+    // Batches come full in the order the producer filled them, so
+    // when the next is not full, none is.
+    Exception* died = 0;
+    for (int next = 0; ; next ^= 1)
+      {
+	pthread_mutex_lock (&f->mutex);
+	while (! f->full [next] && ! f->done)
+	  pthread_cond_wait (&f->cond, &f->mutex);
+	bool ready = f->full [next];
+	pthread_mutex_unlock (&f->mutex);
+	if (! ready)
+	  break;
+
+	Feed_buffer& b = f->buf [next];
+	const char* bytes = b.bytes .data ();
+	size_t n = b.ends .size ();
+	begin_batch (aTHX_ f);
+	for (size_t k = 0, start = 0; k < n; start = b.ends [k++])
+	  put (aTHX_ f, k, bytes + start, b.ends [k] - start);
+	try
+	  {
+	    end_batch (aTHX_ f, n);
+	  }
+	catch (Exception* e)
+	  {
+	    died = e;
+	  }
+
+	pthread_mutex_lock (&f->mutex);
+	b.bytes .clear ();
+	b.ends .clear ();
+	f->full [next] = false;
+	if (died)
+	  f->stopped = true;
+	pthread_cond_broadcast (&f->cond);
+	pthread_mutex_unlock (&f->mutex);
+	if (died)
+	  break;
+      }
+
+    pthread_join (thread, 0);
+    f->threaded = false;
+    for (int k = 0; k < 2; k++)
+      {
+	f->buf [k] .bytes .clear ();
+	f->buf [k] .ends .clear ();
+      }
+    if (died)
+      throw died;
+    if (! f->error .empty ())
+      throw new Exception (f->error);
+  }
+
+  unsigned long
+  Feed::records () const
+  {
+    return imp->records;
+  }
+
+  unsigned long
+  Feed::batches () const
+  {
+    return imp->batches;
+  }
+
+}
@@ -24,4 +24,97 @@
 namespace Pickle
 {
 
+  GV*
+  fetch_gv (pTHX_ const char* name, STRLEN len, svtype type)
+  {
+#ifdef gv_fetchpvn_flags
+    return gv_fetchpvn_flags (name, len, GV_ADD, type);
+#else  // Perl < 5.10 stops at the first NUL.
+    return gv_fetchpv (const_cast<char*> (name), TRUE, type);
+#endif
+  }
+
+  static inline SV*
+  lookup_glob (const char* name, STRLEN len)
+  {
+    dTHX;
+    return newRV ((SV*) fetch_gv (aTHX_ name, len, SVt_PVGV));
+  }
+
+  GlobalHandle::GlobalHandle (const string& name)
+    : Globref (lookup_glob (name .data (), name .size ()), false) {}
+  GlobalHandle::GlobalHandle (const char* name)
+    : Globref (lookup_glob (name, strlen (name)), false) {}
+
+  Scalarref
+  GlobalHandle::scalar () const
+  {
+    dInterp;
+    return Scalarref (newRV (GvSVn ((GV*) SvRV (imp))), false);
+  }
+
+  Arrayref
+  GlobalHandle::array () const
+  {
+    dInterp;
+    return Arrayref (newRV ((SV*) GvAVn ((GV*) SvRV (imp))), false);
+  }
+
+  Hashref
+  GlobalHandle::hash () const
+  {
+    dInterp;
+    return Hashref (newRV ((SV*) GvHVn ((GV*) SvRV (imp))), false);
+  }
+
+  Coderef
+  GlobalHandle::code () const
+  {
+    dInterp;
+    CV* cv = GvCV ((GV*) SvRV (imp));
+    if (! cv || ! (CvROOT (cv) || CvXSUB (cv)))
+      throw new Exception ("Undefined subroutine");
+    return Coderef (newRV ((SV*) cv), false);
+  }
+
+  Scalar
+  GlobalHandle::fetch () const
+  {
+    dInterp;
+    return newSVsv (GvSVn ((GV*) SvRV (imp)));
+  }
+
+  Scalar
+  GlobalHandle::fetch (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return newSVsv (GvSVn ((GV*) SvRV (imp)));
+  }
+
+  void
+  GlobalHandle::store (const Scalar& v)
+  {
+    dInterp;
+    sv_setsv (GvSVn ((GV*) SvRV (imp)), v.imp);
+  }
+
+  void
+  GlobalHandle::store (const Interpreter& i, const Scalar& v)
+  {
+    dInterpOf (i);
+    sv_setsv (GvSVn ((GV*) SvRV (imp)), v.imp);
+  }
+
+  void
+  GlobalHandle::refresh ()
+  {
+    dInterp;
+    GV* gv = (GV*) SvRV (imp);
+    HV* stash = GvSTASH (gv);
+    string name (stash && HvNAME (stash) ? HvNAME (stash) : "main");
+    name .append ("::") .append (GvNAME (gv), GvNAMELEN (gv));
+    adopt (newRV ((SV*) fetch_gv (aTHX_ name .data (), name .size (),
+				  SVt_PVGV)));
+  }
+
 }
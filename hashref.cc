@@ -34,33 +34,77 @@ namespace Pickle
   Hashref::Hashref () : Scalar (new_hash ()) {}
 
   static inline SV*
-  lookup_hash (const string& name)
+  lookup_hash (const char* name, STRLEN len)
   {
     dTHX;
-    return newRV ((SV*) get_hv (const_cast<char*> (name .c_str ()), 1));
+    return newRV ((SV*) GvHVn (fetch_gv (aTHX_ name, len, SVt_PVHV)));
   }
 
-  Hashref::Hashref (const string& name) : Scalar (lookup_hash (name)) {}
-  Hashref::Hashref (const char* name) : Scalar (lookup_hash (name)) {}
+  Hashref::Hashref (const string& name)
+    : Scalar (lookup_hash (name .data (), name .size ())) {}
+  Hashref::Hashref (const char* name)
+    : Scalar (lookup_hash (name, strlen (name))) {}
 
-  Scalar
-  Hashref::fetch (const Scalar& key) const
+  static inline SV*
+  fetch_copy (pTHX_ SV* rv, SV* key)
   {
-    dInterp;
-
-    HE* loc = hv_fetch_ent ((HV*) SvRV (imp), key.imp, 0, 0);
+    HE* loc = hv_fetch_ent ((HV*) SvRV (rv), key, 0, 0);
     if (loc)
       return newSVsv (HeVAL (loc));
     else
       return &PL_sv_undef;
   }
 
+  // Store VAL, whose reference is given away, and return the slot.
+  static inline SV*&
+  store_sv (pTHX_ SV* rv, SV* key, SV* val)
+  {
+    return HeVAL (hv_store_ent ((HV*) SvRV (rv), key, val, 0));
+  }
+
+  Scalar
+  Hashref::fetch (const Scalar& key) const
+  {
+    dInterp;
+    return fetch_copy (aTHX_ imp, key.imp);
+  }
+
+  Scalar
+  Hashref::fetch (const Interpreter& i, const Scalar& key) const
+  {
+    dInterpOf (i);
+    return fetch_copy (aTHX_ imp, key.imp);
+  }
+
+  Bound<Scalar>
+  Bound<Hashref>::fetch (const Scalar& key) const
+  {
+    dInterpOf (interpreter ());
+    return Bound<Scalar> (interpreter (),
+			  fetch_copy (aTHX_ get_imp (), key .get_imp ()));
+  }
+
   Scalar&
   Hashref::store (const Scalar& key, const Scalar& val)
   {
     dInterp;
-    return ref (HeVAL (hv_store_ent ((HV*) SvRV (imp), key.imp,
-				     SvREFCNT_inc (val.imp), 0)));
+    return ref (store_sv (aTHX_ imp, key.imp, SvREFCNT_inc (val.imp)));
+  }
+
+  Scalar&
+  Hashref::store (const Interpreter& i, const Scalar& key, const Scalar& val)
+  {
+    dInterpOf (i);
+    return ref (store_sv (aTHX_ imp, key.imp, SvREFCNT_inc (val.imp)));
+  }
+
+#ifdef PICKLE_RVALUE_REFS
+  Scalar&
+  Hashref::store (const Scalar& key, Scalar&& val)
+  {
+    dInterp;
+    return ref (store_sv (aTHX_ imp, key.imp, val .release ()));
   }
+#endif
 
 }
@@ -0,0 +1,147 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+// The members whose fast paths pickle_inline.hh offers to client code.
+
+#include "pickle_inline.hh"
+
+namespace Pickle
+{
+
+  Scalar::~Scalar ()
+  {
+    PICKLE_TRACK_DELETE (this);
+    // Moved-from and released Scalars hold nothing.
+    if (imp)
+      Inline::drop (imp);
+  }
+
+  // SvREFCNT_inc needs no interpreter context.
+  Scalar::Scalar (const Scalar& o) : imp (o.imp)
+  {
+    PICKLE_TRACK_NEW (this, imp);
+    SvREFCNT_inc (imp);
+  }
+
+  Scalar&
+  Scalar::operator= (const Scalar& o)
+  {
+    SV* t = imp;
+    imp = SvREFCNT_inc (o.imp);
+    PICKLE_TRACK_SET (this, imp);
+    if (t)
+      Inline::drop (t);
+    return *this;
+  }
+
+  bool
+  Scalar::defined () const
+  {
+    return Inline::defined (*this);
+  }
+
+  unsigned long
+  Scalar::as_ulong () const
+  {
+    return Inline::as_ulong (*this);
+  }
+
+  long
+  Scalar::as_long () const
+  {
+    return Inline::as_long (*this);
+  }
+
+  int
+  Scalar::as_int () const
+  {
+    return Inline::as_int (*this);
+  }
+
+  double
+  Scalar::as_double () const
+  {
+    return Inline::as_double (*this);
+  }
+
+  bool
+  Scalar::defined (const Interpreter&) const
+  {
+    return SvOK (imp);
+  }
+
+  unsigned long
+  Scalar::as_ulong (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return SvUV (imp);
+  }
+
+  long
+  Scalar::as_long (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return SvIV (imp);
+  }
+
+  int
+  Scalar::as_int (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return SvIV (imp);
+  }
+
+  double
+  Scalar::as_double (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return SvNV (imp);
+  }
+
+  size_t
+  Arrayref::size () const
+  {
+    return Inline::size (*this);
+  }
+
+  size_t
+  Arrayref::size (const Interpreter& i) const
+  {
+    AV* av = (AV*) SvRV (imp);
+    if (! SvRMAGICAL (av))
+      return AvFILLp (av) + 1;
+    dInterpOf (i);
+    return 1 + av_len (av);
+  }
+
+  const Scalar&
+  Arrayref::at (size_t index) const
+  {
+    return ref (*Inline::slot (*this, index));
+  }
+
+  Scalar&
+  Arrayref::at (size_t index)
+  {
+    return ref (*Inline::slot (*this, index));
+  }
+
+}
@@ -37,9 +37,16 @@
 #include <sstream>
 #include <iostream>
 
-#if REFCNT_DEBUG
-SV* my_sv_refcnt_inc (SV* sv) { return my_inline_sv_refcnt_inc (sv); }
-void my_sv_refcnt_dec (SV* sv) { my_inline_sv_refcnt_dec (sv); }
+#if REFCNT_COUNT
+unsigned long pickle_refcnt_incs;
+unsigned long pickle_refcnt_decs;
+#endif
+
+#if PICKLE_USDT
+#  define PICKLE_PROBE_DEFINE(name)					\
+  unsigned short pickle_##name##_semaphore				\
+    __attribute__ ((section (".probes")));
+extern "C" { PICKLE_PROBES (PICKLE_PROBE_DEFINE) }
 #endif
 
 
@@ -102,6 +109,8 @@ namespace Pickle
     status = perl_run (my_perl);
     if (status)
       barf (my_perl, "perl_run", status);
+
+    PICKLE_PROBE1 (interp_new, my_perl);
   }
 
   Interpreter::Interpreter (int argc, const char* const * argv,
@@ -146,6 +155,11 @@ namespace Pickle
 
   Interpreter::~Interpreter ()
   {
+#ifdef PICKLE_TRACK
+    PERL_SET_CONTEXT (my_perl);
+    track_report (cerr, *this);
+#endif
+    PICKLE_PROBE1 (interp_free, my_perl);
     perl_destruct (my_perl);
     perl_free (my_perl);
     PERL_SET_CONTEXT (0);
@@ -226,36 +240,72 @@ namespace Pickle
   Pickle::List Interpreter::List () const
   { return Arrayref (); }
 
-  // Symbol table lookups.
+  // Symbol table lookups.  Names may contain NUL characters.
+
+  static inline CV*
+  fetch_cv (pTHX_ const char* name, STRLEN len)
+  {
+#ifdef get_cvn_flags
+    return get_cvn_flags (name, len, GV_ADD);
+#else  // Perl < 5.10 stops at the first NUL.
+    return get_cv (const_cast<char*> (name), 1);
+#endif
+  }
 
   Pickle::Scalarref Interpreter::Scalarref (const string& name)
-  { return Scalarref (name .c_str ()); }  // XXX embedded \0
+  {
+    GV* gv = fetch_gv (aTHX_ name .data (), name .size (), SVt_PV);
+    return Pickle::Scalarref (newRV (GvSVn (gv)), false);
+  }
   Pickle::Scalarref Interpreter::Scalarref (const char* name)
   {
-    return Pickle::Scalarref
-      (newRV (get_sv (const_cast<char*> (name), 1)), false);
+    GV* gv = fetch_gv (aTHX_ name, strlen (name), SVt_PV);
+    return Pickle::Scalarref (newRV (GvSVn (gv)), false);
   }
   Pickle::Arrayref Interpreter::Arrayref (const string& name)
-  { return Arrayref (name .c_str ()); }  // XXX embedded \0
+  {
+    GV* gv = fetch_gv (aTHX_ name .data (), name .size (), SVt_PVAV);
+    return Pickle::Arrayref (newRV ((SV*) GvAVn (gv)), false);
+  }
   Pickle::Arrayref Interpreter::Arrayref (const char* name)
   {
-    return Pickle::Arrayref
-      (newRV ((SV*) get_av (const_cast<char*> (name), 1)), false);
+    GV* gv = fetch_gv (aTHX_ name, strlen (name), SVt_PVAV);
+    return Pickle::Arrayref (newRV ((SV*) GvAVn (gv)), false);
   }
   Pickle::Hashref Interpreter::Hashref (const string& name)
-  { return Hashref (name .c_str ()); }  // XXX embedded \0
+  {
+    GV* gv = fetch_gv (aTHX_ name .data (), name .size (), SVt_PVHV);
+    return Pickle::Hashref (newRV ((SV*) GvHVn (gv)), false);
+  }
   Pickle::Hashref Interpreter::Hashref (const char* name)
   {
-    return Pickle::Hashref
-      (newRV ((SV*) get_hv (const_cast<char*> (name), 1)), false);
+    GV* gv = fetch_gv (aTHX_ name, strlen (name), SVt_PVHV);
+    return Pickle::Hashref (newRV ((SV*) GvHVn (gv)), false);
   }
   Pickle::Coderef Interpreter::Coderef (const string& name)
-  { return Coderef (name .c_str ()); }  // XXX embedded \0
+  {
+    CV* cv = fetch_cv (aTHX_ name .data (), name .size ());
+    return Pickle::Coderef (newRV ((SV*) cv), false);
+  }
   Pickle::Coderef Interpreter::Coderef (const char* name)
   {
-    return Pickle::Coderef
-      (newRV ((SV*) get_cv (const_cast<char*> (name), 1)), false);
+    CV* cv = fetch_cv (aTHX_ name, strlen (name));
+    return Pickle::Coderef (newRV ((SV*) cv), false);
+  }
+  Pickle::Globref Interpreter::Globref (const string& name)
+  {
+    GV* gv = fetch_gv (aTHX_ name .data (), name .size (), SVt_PVGV);
+    return Pickle::Globref (newRV ((SV*) gv), false);
   }
+  Pickle::Globref Interpreter::Globref (const char* name)
+  {
+    GV* gv = fetch_gv (aTHX_ name, strlen (name), SVt_PVGV);
+    return Pickle::Globref (newRV ((SV*) gv), false);
+  }
+  Pickle::GlobalHandle Interpreter::GlobalHandle (const string& name)
+  { return Pickle::GlobalHandle (Globref (name), false); }
+  Pickle::GlobalHandle Interpreter::GlobalHandle (const char* name)
+  { return Pickle::GlobalHandle (Globref (name), false); }
 
   // Compilation.
 
@@ -268,35 +318,45 @@ namespace Pickle
   Pickle::Scalar
   Interpreter::eval_string (const string& proggie) const
   {
-    djSP;
     SV* retsv;
-    Pickle::Scalar err;
+    SV* err = 0;
+    Prof_guard prof (PROF_EVAL, proggie .data (), proggie .size ());
+    PICKLE_PROBE2 (eval_entry, proggie .c_str (), proggie .size ());
 
     ENTER;
     SAVETMPS;
     // This is equivalent to `local($@)'.  XXX missing from perlapi.pod
     save_scalar (PL_errgv);
 
-    retsv = eval_pv (const_cast<char*> (proggie.c_str()), G_SCALAR);
-
-    // I wasted half a day figuring out that this is needed.
-    POPMARK;
+    // Errors are left in $@ rather than croaked.  eval_pv pops the
+    // mark it pushes, so the stack needs no cleanup here.
+    retsv = eval_pv (const_cast<char*> (proggie.c_str()), 0);
 
     SvREFCNT_inc (retsv);
     if (SvTRUE (ERRSV))
       err = newSVsv (ERRSV);
+    PICKLE_PROBE2 (eval_return, proggie .c_str (), err != 0);
 
     FREETMPS;
     LEAVE;
 
     if (err)
-      throw new Exception (err);
+      throw new Exception (Pickle::Scalar (err));
 
     return retsv;
   }
 
   // Transfering control from C++ to Perl.
 
+  enum { PROBE_NAME_LEN = 128 };
+
+  // Name SUB for probe arguments, but only while a tracer is attached.
+  static inline const char*
+  probe_name (pTHX_ SV* sub, char* buf, bool enabled)
+  {
+    return enabled ? sub_name (aTHX_ sub, buf, PROBE_NAME_LEN) : 0;
+  }
+
   Pickle::Scalar
   Interpreter::call_function (const Pickle::Scalar& func,
 			      const Pickle::List& args,
@@ -312,9 +372,15 @@ namespace Pickle
   {
     djSP;
     SV* retsv;
-    Pickle::Scalar err;
+    SV* err = 0;
     I32 numret;
     I32 ctx;
+    Prof_guard prof (aTHX_ PROF_CALL, func);
+    char buf [PROBE_NAME_LEN];
+    const char* name = probe_name (aTHX_ func, buf,
+				   PICKLE_PROBE_ENABLED (call_entry)
+				   || PICKLE_PROBE_ENABLED (call_return));
+    PICKLE_PROBE2 (call_entry, name, argc);
 
     switch (cx)
       {
@@ -358,25 +424,32 @@ namespace Pickle
 
     if (SvTRUE (ERRSV))
       err = newSVsv (ERRSV);
+    PICKLE_PROBE2 (call_return, name, err != 0);
 
     FREETMPS;
     LEAVE;
 
     if (err)
-      throw new Exception (err);
+      throw new Exception (Pickle::Scalar (err));
 
     return retsv;
   }
 
   // Tranfering control from Perl to C++.
 
-  static void
+  void
   propagate_to_perl (pTHX_ Exception* e)
   {
     // XXX This is not especially clever.
     sv_setsv (ERRSV, e->get_scalar () .get_imp ());
     delete e;
+    if (PICKLE_PROBE_ENABLED (exception))
+      PICKLE_PROBE1 (exception, SvPV_nolen (ERRSV));
+#ifdef croak_sv
+    croak_sv (ERRSV);
+#else  // Perl < 5.14, where %_ formats an SV.
     croak ("%_", ERRSV);
+#endif
   }
 
   void
@@ -386,24 +459,32 @@ namespace Pickle
     if (items != 1)
       croak ("Usage: %s(arg)", GvNAME (CvGV (cv)));
 
+    Prof_guard prof (aTHX_ PROF_XSUB, (SV*) cv);
+    char buf [PROBE_NAME_LEN];
+    const char* name = probe_name (aTHX_ (SV*) cv, buf,
+				   PICKLE_PROBE_ENABLED (xsub_entry)
+				   || PICKLE_PROBE_ENABLED (xsub_return));
+    PICKLE_PROBE2 (xsub_entry, name, items);
     try
       {
 	Pickle::Scalar arg (SvREFCNT_inc (ST (0)));
 	Pickle::Scalar ret (((sub_one_arg) CvXSUBANY (cv) .any_ptr) (arg));
-	/* The callback return value is basically a time bomb, an SV with
-	   0 refcount: actually, its refcnt is about to drop to 0 when the
-	   container (Scalar) dies.  Therefore, we must inc its refcount.
+	/* The callback return value is basically a time bomb, an SV whose
+	   refcnt is about to drop to 0 when the container (Scalar) dies.
 	   But we are putting it on the Perl arg stack, so it must be
-	   "mortalized".  In other words, this replaces one terminal illness
-	   with another.  A clever compiler might optimize away SvREFCNT_inc.
-	   (nah...)
+	   "mortalized".  Rather than replace one terminal illness with
+	   another by way of SvREFCNT_inc, take the reference away from
+	   the container and give it to the mortal stack.
 	*/
-	ST (0) = SvREFCNT_inc (sv_2mortal (ret .get_imp ()));
+	ST (0) = sv_2mortal (ret .release ());
       }
     catch (Exception* e)
       {
+	prof .leave ();
+	PICKLE_PROBE2 (xsub_return, name, 1);
 	propagate_to_perl (aTHX_ e);
       }
+    PICKLE_PROBE2 (xsub_return, name, 0);
     XSRETURN (1);
   }
 
@@ -418,18 +499,27 @@ namespace Pickle
     for (int i = 1; i < items - 1; i += 2)
       hv_store_ent (args, ST (i), SvREFCNT_inc (ST (i + 1)), 0);
 
+    Prof_guard prof (aTHX_ PROF_XSUB, (SV*) cv);
+    char buf [PROBE_NAME_LEN];
+    const char* name = probe_name (aTHX_ (SV*) cv, buf,
+				   PICKLE_PROBE_ENABLED (xsub_entry)
+				   || PICKLE_PROBE_ENABLED (xsub_return));
+    PICKLE_PROBE2 (xsub_entry, name, items);
     try
       {
 	Pickle::Scalar obj (SvREFCNT_inc (ST (0)));
 	Pickle::Hashref arg (newRV_noinc ((SV*) args), false);
 	Pickle::Scalar ret (((sub_hashref) CvXSUBANY (cv) .any_ptr)
 			    (obj, arg));
-	ST (0) = SvREFCNT_inc (sv_2mortal (ret .get_imp ()));
+	ST (0) = sv_2mortal (ret .release ());
       }
     catch (Exception* e)
       {
+	prof .leave ();
+	PICKLE_PROBE2 (xsub_return, name, 1);
 	propagate_to_perl (aTHX_ e);
       }
+    PICKLE_PROBE2 (xsub_return, name, 0);
     XSRETURN (1);
   }
 
@@ -449,17 +539,25 @@ namespace Pickle
       default      : cx = VOID;   break;
       }
 
+    Prof_guard prof (aTHX_ PROF_XSUB, (SV*) cv);
+    char buf [PROBE_NAME_LEN];
+    const char* name = probe_name (aTHX_ (SV*) cv, buf,
+				   PICKLE_PROBE_ENABLED (xsub_entry)
+				   || PICKLE_PROBE_ENABLED (xsub_return));
+    PICKLE_PROBE2 (xsub_entry, name, items);
     try
       {
 	Pickle::List arglist (args);
 	Pickle::List retlist (((sub) CvXSUBANY (cv) .any_ptr) (arglist, cx));
-	retsv = SvREFCNT_inc (sv_2mortal (((Pickle::Arrayref&) retlist)
-					  .get_imp ()));
+	retsv = sv_2mortal (((Pickle::Arrayref&) retlist) .release ());
       }
     catch (Exception* e)
       {
+	prof .leave ();
+	PICKLE_PROBE2 (xsub_return, name, 1);
 	propagate_to_perl (aTHX_ e);
       }
+    PICKLE_PROBE2 (xsub_return, name, 0);
 
     retav = (AV*) SvRV (retsv);
 
@@ -0,0 +1,304 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+#include "pickle_int.hh"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+namespace Pickle
+{
+
+  // A ticket lock: each acquirer takes the next ticket and waits
+  // until the lock is serving it.  Waiters spin briefly, then sleep on
+  // a condition variable, which release() signals only if someone
+  // sleeps.
+  //
+  // XXX Each release wakes every sleeper, though only one can go.
+  //
+  // In combining mode, run() pushes a request on a lock-free stack
+  // and waits for it to be done.  The holder, before releasing, takes
+  // the whole stack and runs it oldest first.  A requester that finds
+  // the lock free with no one queued takes it itself and so serves
+  // its own request.
+
+  enum { SPINS = 200, COMBINE_PASSES = 4 };
+
+  struct Lock_request
+  {
+    void (*fn) (void*);
+    void* arg;
+    unsigned long long asked_at;
+    Exception* error;
+    int done;
+    Lock_request* next;
+  };
+
+  struct Lock_imp
+  {
+    PerlInterpreter* perl;
+    unsigned long next_ticket;
+    unsigned long serving;
+    int sleepers;
+    bool combining;
+    Lock_request* requests;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // Only the holder touches these.
+    void* saved_context;
+    unsigned long long acquired_at;
+    Interpreter::Lock::Stats stats;
+  };
+
+  static inline unsigned long long
+  now_ns ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  static inline void
+  relax ()
+  {
+#if defined (__i386__) || defined (__x86_64__)
+    __builtin_ia32_pause ();
+#endif
+  }
+
+  static void
+  wake (Lock_imp* l)
+  {
+    if (__atomic_load_n (&l->sleepers, __ATOMIC_SEQ_CST))
+      {
+	pthread_mutex_lock (&l->mutex);
+	pthread_cond_broadcast (&l->cond);
+	pthread_mutex_unlock (&l->mutex);
+      }
+  }
+
+  static void
+  note_wait (Interpreter::Lock::Stats& s, unsigned long long ns)
+  {
+    s.wait_ns += ns;
+    if (ns > s.max_wait_ns)
+      s.max_wait_ns = ns;
+  }
+
+  // ASKED_AT is 0 if the lock was free.
+  static void
+  acquired (Lock_imp* l, unsigned long long asked_at)
+  {
+    l->acquired_at = now_ns ();
+    l->stats.acquisitions++;
+    if (asked_at)
+      note_wait (l->stats, l->acquired_at - asked_at);
+#ifdef PERL_IMPLICIT_CONTEXT
+    l->saved_context = PERL_GET_CONTEXT;
+    if (l->saved_context != l->perl)
+      PERL_SET_CONTEXT (l->perl);
+#endif
+  }
+
+  Interpreter::Lock::Lock (const Interpreter& i) : imp (new Lock_imp)
+  {
+    memset (imp, 0, sizeof *imp);
+    imp->perl = i.my_perl;
+    pthread_mutex_init (&imp->mutex, 0);
+    pthread_cond_init (&imp->cond, 0);
+  }
+
+  Interpreter::Lock::~Lock ()
+  {
+    pthread_cond_destroy (&imp->cond);
+    pthread_mutex_destroy (&imp->mutex);
+    delete imp;
+  }
+
+  void
+  Interpreter::Lock::acquire ()
+  {
+    unsigned long ticket = __atomic_fetch_add (&imp->next_ticket, 1,
+					       __ATOMIC_RELAXED);
+    unsigned long long t0 = 0;
+    if (__atomic_load_n (&imp->serving, __ATOMIC_ACQUIRE) == ticket)
+      {
+	acquired (imp, 0);
+	return;
+      }
+
+    // Start the clock only once there is a wait.
+    t0 = now_ns ();
+    for (int i = 0; i < SPINS; i++)
+      {
+	if (__atomic_load_n (&imp->serving, __ATOMIC_ACQUIRE) == ticket)
+	  {
+	    acquired (imp, t0);
+	    return;
+	  }
+	relax ();
+      }
+
+    pthread_mutex_lock (&imp->mutex);
+    __atomic_fetch_add (&imp->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n (&imp->serving, __ATOMIC_SEQ_CST) != ticket)
+      pthread_cond_wait (&imp->cond, &imp->mutex);
+    __atomic_fetch_sub (&imp->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock (&imp->mutex);
+    acquired (imp, t0);
+  }
+
+  // Run the queued requests, oldest first.
+  static void
+  combine (Lock_imp* l)
+  {
+    for (int pass = 0; pass < COMBINE_PASSES; pass++)
+      {
+	Lock_request* r = __atomic_exchange_n (&l->requests, (Lock_request*) 0,
+					       __ATOMIC_ACQUIRE);
+	if (! r)
+	  return;
+
+	Lock_request* fifo = 0;
+	while (r)
+	  {
+	    Lock_request* next = r->next;
+	    r->next = fifo;
+	    fifo = r;
+	    r = next;
+	  }
+
+	while (fifo)
+	  {
+	    // The requester may return as soon as it sees DONE.
+	    Lock_request* next = fifo->next;
+	    note_wait (l->stats, now_ns () - fifo->asked_at);
+	    l->stats.combined++;
+	    try
+	      {
+		fifo->fn (fifo->arg);
+	      }
+	    catch (Exception* e)
+	      {
+		fifo->error = e;
+	      }
+	    __atomic_store_n (&fifo->done, 1, __ATOMIC_SEQ_CST);
+	    fifo = next;
+	  }
+	wake (l);
+      }
+  }
+
+  void
+  Interpreter::Lock::release ()
+  {
+    if (__atomic_load_n (&imp->requests, __ATOMIC_RELAXED))
+      combine (imp);
+
+    unsigned long long held = now_ns () - imp->acquired_at;
+    imp->stats.hold_ns += held;
+    if (held > imp->stats.max_hold_ns)
+      imp->stats.max_hold_ns = held;
+#ifdef PERL_IMPLICIT_CONTEXT
+    if (imp->saved_context != imp->perl)
+      PERL_SET_CONTEXT (imp->saved_context);
+#endif
+
+    __atomic_store_n (&imp->serving, imp->serving + 1, __ATOMIC_SEQ_CST);
+    wake (imp);
+  }
+
+  void
+  Interpreter::Lock::run (void (*fn) (void*), void* arg)
+  {
+    if (! __atomic_load_n (&imp->combining, __ATOMIC_RELAXED))
+      {
+	Guard g (*this);
+	fn (arg);
+	return;
+      }
+
+    Lock_request r;
+    r.fn = fn;
+    r.arg = arg;
+    r.asked_at = now_ns ();
+    r.error = 0;
+    r.done = 0;
+    r.next = __atomic_load_n (&imp->requests, __ATOMIC_RELAXED);
+    while (! __atomic_compare_exchange_n (&imp->requests, &r.next, &r, true,
+					  __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+
+    for (int spins = 0; ! __atomic_load_n (&r.done, __ATOMIC_SEQ_CST);
+	 spins++)
+      {
+	// Take the lock if it is free and no one is queued for it.
+	unsigned long s = __atomic_load_n (&imp->serving, __ATOMIC_SEQ_CST);
+	unsigned long t = s;
+	if (__atomic_compare_exchange_n (&imp->next_ticket, &t, s + 1, false,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	  {
+	    acquired (imp, 0);
+	    release ();
+	    continue;
+	  }
+
+	if (spins < SPINS)
+	  {
+	    relax ();
+	    continue;
+	  }
+	pthread_mutex_lock (&imp->mutex);
+	__atomic_fetch_add (&imp->sleepers, 1, __ATOMIC_SEQ_CST);
+	while (! __atomic_load_n (&r.done, __ATOMIC_SEQ_CST)
+	       && __atomic_load_n (&imp->next_ticket, __ATOMIC_SEQ_CST)
+	       != __atomic_load_n (&imp->serving, __ATOMIC_SEQ_CST))
+	  pthread_cond_wait (&imp->cond, &imp->mutex);
+	__atomic_fetch_sub (&imp->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock (&imp->mutex);
+      }
+
+    if (r.error)
+      throw r.error;
+  }
+
+  void
+  Interpreter::Lock::combining (bool on)
+  {
+    __atomic_store_n (&imp->combining, on, __ATOMIC_RELAXED);
+  }
+
+  Interpreter::Lock::Stats
+  Interpreter::Lock::stats () const
+  {
+    return imp->stats;
+  }
+
+  // XXX Races with a holder updating the counts.
+  void
+  Interpreter::Lock::reset_stats ()
+  {
+    memset (&imp->stats, 0, sizeof imp->stats);
+  }
+
+}
@@ -0,0 +1,271 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+#include <string.h>
+#include <map>
+#include <set>
+
+namespace Pickle
+{
+
+  static Memory_stats::Kind
+  kind_of (SV* sv)
+  {
+    switch (SvTYPE (sv))
+      {
+      case SVt_PVAV: return Memory_stats::ARRAY;
+      case SVt_PVHV: return Memory_stats::HASH;
+      case SVt_PVCV: return Memory_stats::CODE;
+      case SVt_PVGV: return Memory_stats::GLOB;
+      case SVt_PVIO: return Memory_stats::IO;
+      case SVt_PVFM: return Memory_stats::OTHER;
+      default:       return Memory_stats::SCALAR;
+      }
+  }
+
+  // Bodyless types and those whose body layout varies by Perl version
+  // count as 0.
+  static size_t
+  body_size (SV* sv)
+  {
+    switch (SvTYPE (sv))
+      {
+      case SVt_PV:   return sizeof (XPV);
+      case SVt_PVIV: return sizeof (XPVIV);
+      case SVt_PVNV: return sizeof (XPVNV);
+      case SVt_PVMG: return sizeof (XPVMG);
+      case SVt_PVLV: return sizeof (XPVLV);
+      case SVt_PVAV: return sizeof (XPVAV);
+      case SVt_PVHV: return sizeof (XPVHV);
+      case SVt_PVCV: return sizeof (XPVCV);
+      case SVt_PVGV: return sizeof (XPVGV);
+      case SVt_PVFM: return sizeof (XPVFM);
+      case SVt_PVIO: return sizeof (XPVIO);
+      default:       return 0;
+      }
+  }
+
+  static size_t
+  string_size (SV* sv)
+  {
+    svtype t = SvTYPE (sv);
+    if (t == SVt_PVLV || (t >= SVt_PV && t <= SVt_PVMG))
+      return SvLEN (sv);
+    return 0;
+  }
+
+  static size_t
+  array_size (AV* av)
+  {
+    return AvALLOC (av) ? (AvMAX (av) + 1) * sizeof (SV*) : 0;
+  }
+
+  // Hash entries are counted at their key length; shared keys are
+  // charged to every hash that uses them.
+  static size_t
+  hash_size (HV* hv)
+  {
+    if (! HvARRAY (hv))
+      return 0;
+    size_t n = (HvMAX (hv) + 1) * sizeof (HE*);
+    for (STRLEN i = 0; i <= HvMAX (hv); i++)
+      for (HE* he = HvARRAY (hv) [i]; he; he = HeNEXT (he))
+	n += sizeof (HE) + sizeof (HEK) + HeKLEN (he);
+    return n;
+  }
+
+  static void
+  add_sv (Memory_stats& m, SV* sv)
+  {
+    m.svs++;
+    m.by_kind [kind_of (sv)]++;
+    m.body_bytes += body_size (sv);
+    m.string_bytes += string_size (sv);
+    if (SvTYPE (sv) == SVt_PVAV)
+      m.array_bytes += array_size ((AV*) sv);
+    else if (SvTYPE (sv) == SVt_PVHV)
+      m.hash_bytes += hash_size ((HV*) sv);
+  }
+
+  // Total size of the SVs reachable from TODO and not in SEEN.  Magic
+  // is not invoked, and hashes are walked bucket by bucket so as not
+  // to disturb their iterators.
+  static unsigned long
+  deep_size (vector<SV*>& todo, set<SV*>& seen)
+  {
+    unsigned long n = 0;
+    while (! todo .empty ())
+      {
+	SV* sv = todo .back ();
+	todo .pop_back ();
+	if (! sv || ! seen .insert (sv) .second)
+	  continue;
+
+	n += sizeof (SV) + body_size (sv) + string_size (sv);
+	switch (SvTYPE (sv))
+	  {
+	  case SVt_PVAV:
+	    {
+	      AV* av = (AV*) sv;
+	      n += array_size (av);
+	      if (! SvRMAGICAL (av))
+		for (SSize_t i = 0; i <= AvFILLp (av); i++)
+		  todo .push_back (AvARRAY (av) [i]);
+	    }
+	    break;
+
+	  case SVt_PVHV:
+	    {
+	      HV* hv = (HV*) sv;
+	      n += hash_size (hv);
+	      if (HvARRAY (hv) && ! SvRMAGICAL (hv))
+		for (STRLEN i = 0; i <= HvMAX (hv); i++)
+		  for (HE* he = HvARRAY (hv) [i]; he; he = HeNEXT (he))
+		    todo .push_back (HeVAL (he));
+	    }
+	    break;
+
+	  case SVt_PVCV:
+	  case SVt_PVGV:
+	  case SVt_PVFM:
+	  case SVt_PVIO:
+	    break;
+
+	  default:
+	    if (SvROK (sv))
+	      todo .push_back (SvRV (sv));
+	    break;
+	  }
+      }
+    return n;
+  }
+
+  unsigned long
+  Scalar::deep_size () const
+  {
+    vector<SV*> todo (1, imp);
+    set<SV*> seen;
+    return Pickle::deep_size (todo, seen);
+  }
+
+#ifdef PICKLE_TRACK
+  static void
+  count_handle (const void* sv, void* arg)
+  {
+    (*(map<SV*, unsigned long>*) arg) [(SV*) sv]++;
+  }
+
+  // An SV is pinned if all its references belong to Scalars.
+  static void
+  add_pinned (pTHX_ Memory_stats& m)
+  {
+    map<SV*, unsigned long> handles;
+    track_each (aTHX_ count_handle, &handles);
+
+    vector<SV*> todo;
+    for (map<SV*, unsigned long>::iterator it = handles .begin ();
+	 it != handles .end (); ++it)
+      if (! SvIMMORTAL (it->first) && SvREFCNT (it->first) <= it->second)
+	todo .push_back (it->first);
+    m.pinned_svs = todo .size ();
+
+    set<SV*> seen;
+    m.pinned_bytes = deep_size (todo, seen);
+  }
+#endif
+
+  // The first SV of each arena holds the arena's size in its refcount
+  // and the next arena in its body pointer.  Free slots have all type
+  // bits set.
+  static Memory_stats
+  walk (pTHX_ unsigned stride, unsigned phase)
+  {
+    Memory_stats m;
+    memset (&m, 0, sizeof m);
+
+    unsigned long slots = 0, walked = 0;
+    unsigned long index = 0;
+    for (SV* sva = PL_sv_arenaroot; sva; sva = (SV*) SvANY (sva), index++)
+      {
+	SV* end = &sva [SvREFCNT (sva)];
+	slots += end - (sva + 1);
+	if (index % stride != phase)
+	  continue;
+
+	walked += end - (sva + 1);
+	for (SV* sv = sva + 1; sv < end; sv++)
+	  if (SvTYPE (sv) == (svtype) SVTYPEMASK || ! SvREFCNT (sv))
+	    m.free_svs++;
+	  else
+	    add_sv (m, sv);
+      }
+
+    m.head_bytes = (unsigned long long) slots * sizeof (SV);
+    m.sampled = slots ? (double) walked / slots : 1;
+    if (walked && walked < slots)
+      {
+	double scale = (double) slots / walked;
+	m.svs = (unsigned long) (m.svs * scale);
+	for (int k = 0; k < Memory_stats::KINDS; k++)
+	  m.by_kind [k] = (unsigned long) (m.by_kind [k] * scale);
+	m.free_svs = (unsigned long) (m.free_svs * scale);
+	m.body_bytes = (unsigned long long) (m.body_bytes * scale);
+	m.string_bytes = (unsigned long long) (m.string_bytes * scale);
+	m.array_bytes = (unsigned long long) (m.array_bytes * scale);
+	m.hash_bytes = (unsigned long long) (m.hash_bytes * scale);
+      }
+    return m;
+  }
+
+  Memory_stats
+  Interpreter::memory_stats () const
+  {
+    Memory_stats m = walk (aTHX_ 1, 0);
+#ifdef PICKLE_TRACK
+    add_pinned (aTHX_ m);
+#endif
+    return m;
+  }
+
+  // Successive calls in an interpreter start at successive arenas, so
+  // STRIDE calls together cover every arena that existed throughout.
+  // The count of calls is kept in PL_modglobal.  With fewer arenas
+  // than STRIDE, each call walks one arena.
+  Memory_stats
+  Interpreter::memory_stats (unsigned stride) const
+  {
+    unsigned long arenas = 0;
+    for (SV* sva = PL_sv_arenaroot; sva; sva = (SV*) SvANY (sva))
+      arenas++;
+    if (stride > arenas)
+      stride = arenas;
+    if (stride <= 1)
+      return memory_stats ();
+
+    static const char key [] = "Pickle::memory_stats_phase";
+    SV* calls = *hv_fetch (PL_modglobal, key, sizeof key - 1, 1);
+    UV phase = SvOK (calls) ? SvUV (calls) : 0;
+    sv_setuv (calls, phase + 1);
+    return walk (aTHX_ stride, phase % stride);
+  }
+
+}
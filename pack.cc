@@ -0,0 +1,214 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+// Without this, XSUB.h makes aTHX the thread's current interpreter
+// rather than the Packer's own.
+#define PERL_NO_GET_CONTEXT
+#include "pickle_int.hh"
+#include <XSUB.h>
+
+namespace Pickle
+{
+
+  // Perl's pack engine keeps no compiled form of a template; it reads
+  // the template afresh on each call.  What a Packer saves is the
+  // rest: the template and argument SVs, the sub call, and the result
+  // list.  unpackstring and packlist croak on bad input, so they run
+  // in XSUBs called with G_EVAL.  The XSUBs take their arguments from
+  // the Packer_imp and leave the results there.
+
+  struct Packer_imp
+  {
+    PerlInterpreter* perl;
+    string tmpl;
+    CV* unpack_cv;
+    CV* pack_cv;
+    SV* cat;                 // pack's output, reused
+
+    // The call in progress.
+    const char* data;
+    size_t len;
+    vector<Scalar>* svs;
+    long* longs;
+    double* doubles;
+    size_t max;
+    const vector<Scalar>* args;
+    size_t count;
+  };
+
+#ifdef PERL_IMPLICIT_CONTEXT
+#  define dPacker(p) PerlInterpreter* my_perl = (p)->perl
+#else
+#  define dPacker(p) dNOOP
+#endif
+
+  // Copy SRC into the scalar that OUT holds, if no one else does.
+  static inline void
+  set_out (pTHX_ Scalar& out, SV* src)
+  {
+    SV* dst = out .get_imp ();
+    if (SvREFCNT (dst) == 1 && SvTYPE (dst) <= SVt_PVMG
+	&& ! SvREADONLY (dst) && ! SvMAGICAL (dst))
+      sv_setsv (dst, src);
+    else
+      out .adopt (newSVsv (src));
+  }
+
+  static void
+  xs_unpack (pTHX_ CV* cv)
+  {
+    dXSARGS;
+    PERL_UNUSED_VAR (items);
+    Packer_imp* p = (Packer_imp*) CvXSUBANY (cv) .any_ptr;
+    PUTBACK;
+    const char* pat = p->tmpl .data ();
+    I32 n = unpackstring (pat, pat + p->tmpl .size (), p->data,
+			  p->data + p->len, 0);
+    SV** got = PL_stack_sp - n + 1;
+    p->count = n;
+    if (p->svs)
+      {
+	vector<Scalar>& out = *p->svs;
+	size_t keep = out .size () < (size_t) n ? out .size () : n;
+	for (size_t i = 0; i < keep; i++)
+	  set_out (aTHX_ out [i], got [i]);
+	out .resize (keep);
+	for (I32 i = keep; i < n; i++)
+	  out .push_back (Scalar (newSVsv (got [i])));
+      }
+    else if (p->longs)
+      for (I32 i = 0; i < n && (size_t) i < p->max; i++)
+	p->longs [i] = SvIV (got [i]);
+    else
+      for (I32 i = 0; i < n && (size_t) i < p->max; i++)
+	p->doubles [i] = SvNV (got [i]);
+    PL_stack_sp = PL_stack_base + ax - 1;
+  }
+
+  static void
+  xs_pack (pTHX_ CV* cv)
+  {
+    dXSARGS;
+    PERL_UNUSED_VAR (items);
+    Packer_imp* p = (Packer_imp*) CvXSUBANY (cv) .any_ptr;
+    const char* pat = p->tmpl .data ();
+    // A Scalar is an SV pointer, so a vector of them is a list of SVs.
+    SV** args = p->args->empty () ? 0 : (SV**) &(*p->args) [0];
+    sv_setpvs (p->cat, "");
+    packlist (p->cat, pat, pat + p->tmpl .size (), args,
+	      args + p->args->size ());
+    XSRETURN_EMPTY;
+  }
+
+  static void
+  run (Packer_imp* p, CV* cv)
+  {
+    dPacker (p);
+    dSP;
+    SV* err = 0;
+    ENTER;
+    SAVETMPS;
+    save_scalar (PL_errgv);
+    PUSHMARK (SP);
+    PUTBACK;
+    call_sv ((SV*) cv, G_VOID | G_DISCARD | G_EVAL);
+    if (SvTRUE (ERRSV))
+      err = newSVsv (ERRSV);
+    FREETMPS;
+    LEAVE;
+    p->svs = 0;
+    p->longs = 0;
+    p->doubles = 0;
+    if (err)
+      throw new Exception (Scalar (err));
+  }
+
+  Packer::Packer (const Interpreter& i, const string& tmpl)
+    : imp (new Packer_imp)
+  {
+    dInterpOf (i);
+    imp->perl = i.my_perl;
+    imp->tmpl = tmpl;
+    imp->unpack_cv = newXS (0, xs_unpack, const_cast<char*> (__FILE__));
+    CvXSUBANY (imp->unpack_cv) .any_ptr = imp;
+    imp->pack_cv = newXS (0, xs_pack, const_cast<char*> (__FILE__));
+    CvXSUBANY (imp->pack_cv) .any_ptr = imp;
+    imp->cat = newSVpvs ("");
+    imp->svs = 0;
+    imp->longs = 0;
+    imp->doubles = 0;
+  }
+
+  Packer::~Packer ()
+  {
+    dPacker (imp);
+    SvREFCNT_dec (imp->unpack_cv);
+    SvREFCNT_dec (imp->pack_cv);
+    SvREFCNT_dec (imp->cat);
+    delete imp;
+  }
+
+  size_t
+  Packer::unpack (const char* data, size_t len, vector<Scalar>& out) const
+  {
+    imp->data = data;
+    imp->len = len;
+    imp->svs = &out;
+    run (imp, imp->unpack_cv);
+    return imp->count;
+  }
+
+  size_t
+  Packer::unpack (const char* data, size_t len, long* out, size_t max) const
+  {
+    imp->data = data;
+    imp->len = len;
+    imp->longs = out;
+    imp->max = max;
+    run (imp, imp->unpack_cv);
+    return imp->count;
+  }
+
+  size_t
+  Packer::unpack (const char* data, size_t len, double* out,
+		  size_t max) const
+  {
+    imp->data = data;
+    imp->len = len;
+    imp->doubles = out;
+    imp->max = max;
+    run (imp, imp->unpack_cv);
+    return imp->count;
+  }
+
+  void
+  Packer::pack (const vector<Scalar>& args, string& out) const
+  {
+    imp->args = &args;
+    run (imp, imp->pack_cv);
+    STRLEN len;
+    dPacker (imp);
+    const char* s = SvPV (imp->cat, len);
+    out .assign (s, len);
+  }
+
+}
@@ -0,0 +1,347 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+#include "pickle_int.hh"
+#include <errno.h>
+#include <string.h>
+#include <streambuf>
+#include <perliol.h>
+
+namespace Pickle
+{
+
+  // A PerlIO layer over C++ data.  For a span of memory, the layer's
+  // buffer is the span itself, so readline and read copy straight out
+  // of it.  For a streambuf, which keeps its own buffer to itself,
+  // Fill reads a block into one of ours, as Perl's buffering layer
+  // would from a file.  Writes go straight to the streambuf.
+
+  enum { STREAMBUF_BLOCK = 8192 };
+
+  struct Pickle_io
+  {
+    struct _PerlIO base;
+    std::streambuf* sb;    // null for a span
+    STDCHAR* start;        // the span, or our buffer
+    STDCHAR* ptr;          // next byte to read
+    STDCHAR* end;          // end of the bytes in hand
+    bool own;              // START was allocated here
+  };
+
+  static IV
+  io_pushed (pTHX_ PerlIO* f, const char* mode, SV* arg, PerlIO_funcs* tab)
+  {
+    return PerlIOBase_pushed (aTHX_ f, mode, arg, tab);
+  }
+
+  static IV
+  io_popped (pTHX_ PerlIO* f)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    if (p->own)
+      delete [] p->start;
+    p->start = p->ptr = p->end = 0;
+    p->own = false;
+    return PerlIOBase_popped (aTHX_ f);
+  }
+
+  static IV
+  io_fileno (pTHX_ PerlIO*)
+  {
+    return -1;
+  }
+
+  static void
+  give_buffer (Pickle_io* p)
+  {
+    p->start = new STDCHAR [STREAMBUF_BLOCK];
+    p->ptr = p->end = p->start;
+    p->own = true;
+  }
+
+  // The streambuf positions that the handle moves.  Streambufs may
+  // refuse to move both relative to the current one, so a handle
+  // opened "r+" tells and seeks from the current position by the
+  // read position.
+  static std::ios_base::openmode
+  io_which (PerlIO* f, int whence)
+  {
+    U32 flags = PerlIOBase (f)->flags;
+    if (! (flags & PERLIO_F_CANREAD))
+      return std::ios_base::out;
+    if ((flags & PERLIO_F_CANWRITE) && whence != SEEK_CUR)
+      return std::ios_base::in | std::ios_base::out;
+    return std::ios_base::in;
+  }
+
+  static PerlIO*
+  io_dup (pTHX_ PerlIO* f, PerlIO* o, CLONE_PARAMS* param, int flags)
+  {
+    f = PerlIOBase_dup (aTHX_ f, o, param, flags);
+    if (f)
+      {
+	Pickle_io* d = PerlIOSelf (f, Pickle_io);
+	Pickle_io* s = PerlIOSelf (o, Pickle_io);
+	d->sb = s->sb;
+	if (s->own)
+	  {
+	    give_buffer (d);
+	    memcpy (d->start, s->ptr, s->end - s->ptr);
+	    d->end = d->start + (s->end - s->ptr);
+	  }
+	else
+	  {
+	    d->start = s->start;
+	    d->ptr = s->ptr;
+	    d->end = s->end;
+	  }
+      }
+    return f;
+  }
+
+  static SSize_t
+  io_write (pTHX_ PerlIO* f, const void* buf, Size_t count)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    if (! p->sb || ! (PerlIOBase (f)->flags & PERLIO_F_CANWRITE))
+      {
+	PerlIOBase (f)->flags |= PERLIO_F_ERROR;
+	SETERRNO (EBADF, SS_IVCHAN);
+	return -1;
+      }
+    std::streamsize n = p->sb->sputn ((const char*) buf, count);
+    if ((Size_t) n < count)
+      PerlIOBase (f)->flags |= PERLIO_F_ERROR;
+    return n;
+  }
+
+  static IV
+  io_seek (pTHX_ PerlIO* f, Off_t offset, int whence)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    PerlIOBase (f)->flags &= ~PERLIO_F_EOF;
+    if (! p->sb)
+      {
+	Off_t size = p->end - p->start;
+	Off_t pos = whence == SEEK_SET ? offset
+	  : whence == SEEK_CUR ? (p->ptr - p->start) + offset
+	  : size + offset;
+	if (pos < 0 || pos > size)
+	  {
+	    SETERRNO (EINVAL, SS_IVCHAN);
+	    return -1;
+	  }
+	p->ptr = p->start + pos;
+	return 0;
+      }
+
+    // Bytes read into our buffer but not by Perl count as unread.
+    if (whence == SEEK_CUR)
+      offset -= p->end - p->ptr;
+    std::ios_base::seekdir dir = whence == SEEK_SET ? std::ios_base::beg
+      : whence == SEEK_CUR ? std::ios_base::cur : std::ios_base::end;
+    p->ptr = p->end = p->start;
+    if (p->sb->pubseekoff (offset, dir, io_which (f, whence))
+	== std::streampos (-1))
+      {
+	SETERRNO (EINVAL, SS_IVCHAN);
+	return -1;
+      }
+    return 0;
+  }
+
+  static Off_t
+  io_tell (pTHX_ PerlIO* f)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    if (! p->sb)
+      return p->ptr - p->start;
+    std::streampos pos = p->sb->pubseekoff (0, std::ios_base::cur,
+						 io_which (f, SEEK_CUR));
+    if (pos == std::streampos (-1))
+      return -1;
+    return (Off_t) pos - (p->end - p->ptr);
+  }
+
+  static IV
+  io_flush (pTHX_ PerlIO* f)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    if (p->sb && (PerlIOBase (f)->flags & PERLIO_F_CANWRITE)
+	&& p->sb->pubsync () == -1)
+      return -1;
+    return 0;
+  }
+
+  static IV
+  io_fill (pTHX_ PerlIO* f)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    if (p->ptr < p->end)
+      return 0;
+    if (p->sb && (PerlIOBase (f)->flags & PERLIO_F_CANREAD))
+      {
+	std::streamsize n = p->sb->sgetn ((char*) p->start, STREAMBUF_BLOCK);
+	if (n > 0)
+	  {
+	    p->ptr = p->start;
+	    p->end = p->start + n;
+	    PerlIOBase (f)->flags |= PERLIO_F_RDBUF;
+	    return 0;
+	  }
+      }
+    PerlIOBase (f)->flags |= PERLIO_F_EOF;
+    return -1;
+  }
+
+  static STDCHAR*
+  io_get_base (pTHX_ PerlIO* f)
+  {
+    return PerlIOSelf (f, Pickle_io)->start;
+  }
+
+  static Size_t
+  io_get_bufsiz (pTHX_ PerlIO* f)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    return p->end - p->start;
+  }
+
+  static STDCHAR*
+  io_get_ptr (pTHX_ PerlIO* f)
+  {
+    return PerlIOSelf (f, Pickle_io)->ptr;
+  }
+
+  static SSize_t
+  io_get_cnt (pTHX_ PerlIO* f)
+  {
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    return p->end - p->ptr;
+  }
+
+  static void
+  io_set_ptrcnt (pTHX_ PerlIO* f, STDCHAR* ptr, SSize_t)
+  {
+    PerlIOSelf (f, Pickle_io)->ptr = ptr;
+    PerlIOBase (f)->flags |= PERLIO_F_RDBUF;
+  }
+
+  static PERLIO_FUNCS_DECL (pickle_layer) =
+  {
+    sizeof (PerlIO_funcs),
+    "pickle",
+    sizeof (Pickle_io),
+    PERLIO_K_BUFFERED | PERLIO_K_RAW,
+    io_pushed,
+    io_popped,
+    0,  // Open: made only from C++
+    PerlIOBase_binmode,
+    0,  // Getarg
+    io_fileno,
+    io_dup,
+    PerlIOBase_read,
+    PerlIOBase_unread,
+    io_write,
+    io_seek,
+    io_tell,
+    PerlIOBase_close,
+    io_flush,
+    io_fill,
+    PerlIOBase_eof,
+    PerlIOBase_error,
+    PerlIOBase_clearerr,
+    PerlIOBase_setlinebuf,
+    io_get_base,
+    io_get_bufsiz,
+    io_get_ptr,
+    io_get_cnt,
+    io_set_ptrcnt,
+  };
+
+  // Wrap F in an anonymous glob, as open() would a named one.
+  static SV*
+  new_handle (pTHX_ PerlIO* f)
+  {
+    U32 flags = PerlIOBase (f)->flags;
+    GV* gv = newGVgen (const_cast<char*> ("Pickle::IO"));
+    SV* rv = newRV ((SV*) gv);
+    (void) hv_delete (GvSTASH (gv), GvNAME (gv), GvNAMELEN (gv), G_DISCARD);
+    IO* io = GvIOn (gv);
+    IoIFP (io) = f;
+    if (flags & PERLIO_F_CANWRITE)
+      IoOFP (io) = f;
+    IoTYPE (io) = ! (flags & PERLIO_F_CANWRITE) ? IoTYPE_RDONLY
+      : (flags & PERLIO_F_CANREAD) ? IoTYPE_RDWR : IoTYPE_WRONLY;
+    return rv;
+  }
+
+  static PerlIO*
+  push_layer (pTHX_ const char* mode)
+  {
+    PerlIO* f = PerlIO_push (aTHX_ PerlIO_allocate (aTHX),
+			     PERLIO_FUNCS_CAST (&pickle_layer), mode, 0);
+    if (! f)
+      throw new Exception ("Globref: cannot push the pickle layer");
+    return f;
+  }
+
+  static SV*
+  open_span (const char* data, size_t len)
+  {
+    dInterp;
+    PerlIO* f = push_layer (aTHX_ "r");
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    p->start = p->ptr = (STDCHAR*) data;
+    p->end = p->start + len;
+    return new_handle (aTHX_ f);
+  }
+
+  static SV*
+  open_streambuf (std::streambuf* sb, const char* mode)
+  {
+    dInterp;
+    PerlIO* f = push_layer (aTHX_ mode);
+    Pickle_io* p = PerlIOSelf (f, Pickle_io);
+    p->sb = sb;
+    give_buffer (p);
+    return new_handle (aTHX_ f);
+  }
+
+  static SV*
+  open_fd (int fd, const char* mode)
+  {
+    dInterp;
+    PerlIO* f = PerlIO_fdopen (fd, mode);
+    if (! f)
+      throw new Exception (string ("Globref: ") + strerror (errno));
+    return new_handle (aTHX_ f);
+  }
+
+  Globref::Globref (const char* data, size_t len)
+    : Scalar (open_span (data, len)) {}
+  Globref::Globref (std::streambuf* sb, const char* mode)
+    : Scalar (open_streambuf (sb, mode)) {}
+  Globref::Globref (int fd, const char* mode)
+    : Scalar (open_fd (fd, mode)) {}
+
+}
@@ -23,6 +23,21 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <iosfwd>
+
+// Move construction and assignment let temporaries hand their SV to the
+// destination without a refcount round trip.  Older compilers get the
+// copying versions only, and no Class, which needs variadic templates.
+#if __cplusplus >= 201103L
+#  define PICKLE_RVALUE_REFS 1
+#  include <utility>
+#  include <type_traits>
+#endif
+#if __cplusplus >= 201703L
+#  define PICKLE_STRING_VIEW 1
+#  include <string_view>
+#endif
 
 namespace Pickle
 {
@@ -36,6 +51,18 @@ namespace Pickle
   class Hashref;
   class Coderef;
   class Globref;
+  class GlobalHandle;
+  class Scope;
+  class Visitor;
+  struct Memory_stats;
+  class Regex;
+  struct Scanner_imp;
+  struct Lock_imp;
+  struct Invoker_imp;
+  class Array_binding;
+  class Hash_binding;
+  template <class T> class Bound_base;
+  template <class T> class Bound;
 
 #ifndef Interpreter_imp
   class Interpreter_imp;
@@ -46,6 +73,27 @@ namespace Pickle
 
   enum Context { SCALAR, LIST, VOID };
 
+  // Built with -DPICKLE_TRACK, the library records every live Scalar
+  // and reports those still holding an SV when an Interpreter is
+  // destroyed.  A Scalar belongs to the interpreter that was current
+  // when it was made.  Client code must be compiled with the same
+  // setting.
+#ifdef PICKLE_TRACK
+  void track_new (const void* handle, const void* sv);
+  void track_set (const void* handle, const void* sv);
+  void track_delete (const void* handle);
+  unsigned long track_live_handles ();
+  unsigned long track_live_handles (const Interpreter& i);
+  void track_report (std::ostream& os, const Interpreter& i);
+#  define PICKLE_TRACK_NEW(h, sv) Pickle::track_new (h, sv)
+#  define PICKLE_TRACK_SET(h, sv) Pickle::track_set (h, sv)
+#  define PICKLE_TRACK_DELETE(h) Pickle::track_delete (h)
+#else
+#  define PICKLE_TRACK_NEW(h, sv) ((void) 0)
+#  define PICKLE_TRACK_SET(h, sv) ((void) 0)
+#  define PICKLE_TRACK_DELETE(h) ((void) 0)
+#endif
+
   typedef Scalar (*sub_one_arg) (Scalar&);
   typedef Scalar (*sub_hashref) (Scalar&, Hashref&);
   typedef List (*sub) (List&, Context);
@@ -67,6 +115,17 @@ namespace Pickle
     friend class Hashref;
     friend class Coderef;
     friend class Globref;
+    friend class GlobalHandle;
+    friend class Scope;
+    friend class EventQueue;
+    friend class Feed;
+    friend class Regex;
+    friend class Packer;
+    template <class T> friend class Bound;
+#ifdef PICKLE_TRACK
+    friend unsigned long track_live_handles (const Interpreter&);
+    friend void track_report (std::ostream&, const Interpreter&);
+#endif
 
   public:
     // Construct an interpreter with args "Pickle", "-e0"
@@ -129,6 +188,8 @@ namespace Pickle
     Pickle::Coderef Coderef (const char* name);
     Pickle::Globref Globref (const std::string& name);
     Pickle::Globref Globref (const char* name);
+    Pickle::GlobalHandle GlobalHandle (const std::string& name);
+    Pickle::GlobalHandle GlobalHandle (const char* name);
 
     // Perform `eval $code'.
     Pickle::Scalar eval_string (const std::string& code) const;
@@ -150,9 +211,119 @@ namespace Pickle
 		     sub_hashref fn) const;
     void define_sub (const std::string& package, const std::string& name, sub fn) const;
 
+    // Count the SVs in this interpreter's arenas and the memory they
+    // use.  The second form walks only every STRIDE'th arena, starting
+    // at a different one on each call, and scales up the counts.
+    Memory_stats memory_stats () const;
+    Memory_stats memory_stats (unsigned stride) const;
+
+    // Compile PATTERN with Perl's regex engine, once, for matching C++
+    // strings.  FLAGS are any of "imsxn", as after qr//.  Throws the
+    // compiler's error.
+    Regex compile_regex (const std::string& pattern,
+			 const std::string& flags = "") const;
+
+    /* Make the package scalar NAME read and write the C++ variable at
+       PTR, with get and set magic: Perl reads *PTR whenever it reads
+       $NAME, and an assignment to $NAME converts the value and stores
+       it in *PTR.  So C++ updates the value in place, with no call
+       into Perl, and a handler sees it when it looks.  Through a const
+       pointer, $NAME is read-only.  The variable must outlive the
+       binding, and binding NAME again replaces it.
+
+	 interp .bind_scalar ("Config::debug", &debug);  */
+    void bind_scalar (const std::string& name, long* ptr) const;
+    void bind_scalar (const std::string& name, const long* ptr) const;
+    void bind_scalar (const std::string& name, unsigned long* ptr) const;
+    void bind_scalar (const std::string& name,
+		      const unsigned long* ptr) const;
+    void bind_scalar (const std::string& name, int* ptr) const;
+    void bind_scalar (const std::string& name, const int* ptr) const;
+    void bind_scalar (const std::string& name, double* ptr) const;
+    void bind_scalar (const std::string& name, const double* ptr) const;
+    void bind_scalar (const std::string& name, bool* ptr) const;
+    void bind_scalar (const std::string& name, const bool* ptr) const;
+    void bind_scalar (const std::string& name, std::string* ptr) const;
+    void bind_scalar (const std::string& name,
+		      const std::string* ptr) const;
+
+    /* Bind a counter that C++ threads, and Perl in other interpreters,
+       update at the same time.  Reads are atomic loads, and an
+       assignment adds the difference between the new value and the
+       one last read, as one atomic add, so `$hits++' and `$bytes +=
+       $n' are never lost.  An outright assignment is such an add too,
+       so reset counters from C++.  */
+    void bind_counter (const std::string& name, long* ptr) const;
+    void bind_counter (const std::string& name, unsigned long* ptr) const;
+
+    // Undo bind_scalar or bind_counter.  $NAME keeps its last value.
+    void unbind_scalar (const std::string& name) const;
+
     // Perl operator equivalents.
     inline Pickle::Scalar undef () const;
 
+    /* A lock for threads sharing this interpreter.  Threads acquire
+       it in the order they asked, and acquiring it makes the
+       interpreter current on the thread until release.
+
+	 Interpreter::Lock lock (*interp);   // shared by the threads
+	 {
+	   Interpreter::Lock::Guard g (lock);
+	   call_function ("handle", args);
+	 }
+
+       In combining mode, run() queues a call, and whichever thread
+       holds the lock runs the queued calls before releasing it, so a
+       burst of short calls costs one handoff rather than one each.
+       Calls so run must throw only Exception*, which reaches the
+       caller of run().  */
+    class Lock
+    {
+    private:
+      Lock_imp* imp;
+      Lock (const Lock&);
+      Lock& operator= (const Lock&);
+
+    public:
+      // Counts and times, in nanoseconds, since construction or
+      // reset_stats().  Read while other threads use the lock, they
+      // may be slightly stale.
+      struct Stats
+      {
+	unsigned long acquisitions;
+	unsigned long combined;        // calls run() ran from the queue
+	unsigned long long wait_ns;    // total, including combined calls
+	unsigned long long max_wait_ns;
+	unsigned long long hold_ns;
+	unsigned long long max_hold_ns;
+      };
+
+      explicit Lock (const Interpreter& i);
+      ~Lock ();
+
+      void acquire ();
+      void release ();
+
+      // Run FN (ARG) holding the lock, or in combining mode, have the
+      // holder run it.
+      void run (void (*fn) (void*), void* arg);
+
+      void combining (bool on);
+      Stats stats () const;
+      void reset_stats ();
+
+      class Guard
+      {
+      private:
+	Lock& lock;
+	Guard (const Guard&);
+	Guard& operator= (const Guard&);
+      public:
+	Guard (Lock& l) : lock (l) { lock .acquire (); }
+	~Guard () { lock .release (); }
+      };
+    };
+
   };
 
   class Init_Exception : public std::exception
@@ -186,17 +357,45 @@ namespace Pickle
     friend class Hashref;
     friend class Coderef;
     friend class Globref;
+    friend class GlobalHandle;
+    friend class Scope;
+    friend class Visitor;
+    template <class T> friend class Bound_base;
     friend std::ostream& operator << (std::ostream& os, const Scalar& o);
     friend std::istream& operator >> (std::istream& os, Scalar& o);
 
+    // Refcount management in a given interpreter, for Bound.
+    void drop (const Interpreter&);
+    void assign (const Interpreter&, const Scalar&);
+
   public:
-    Scalar (Scalar_imp* i) : imp (i) {}
+    Scalar (Scalar_imp* i) : imp (i) { PICKLE_TRACK_NEW (this, i); }
     Scalar_imp* get_imp () const { return imp; }
 
     // Manage reference counts.
     ~Scalar ();
     Scalar (const Scalar&);
     Scalar& operator= (const Scalar&);
+#ifdef PICKLE_RVALUE_REFS
+    // A moved-from Scalar may only be assigned to or destroyed.
+    Scalar (Scalar&& o) : imp (o.imp)
+    { o.imp = 0; PICKLE_TRACK_NEW (this, imp); PICKLE_TRACK_SET (&o, 0); }
+    Scalar& operator= (Scalar&& o)
+    {
+      Scalar_imp* t = imp; imp = o.imp; o.imp = t;
+      PICKLE_TRACK_SET (this, imp);
+      PICKLE_TRACK_SET (&o, t);
+      return *this;
+    }
+#endif
+
+    // Transfer ownership of one reference count.  release() returns the
+    // SV and leaves this Scalar empty, like a moved-from one; adopt()
+    // takes an SV whose reference the caller owns and drops the old one.
+    Scalar_imp* release ()
+    { Scalar_imp* t = imp; imp = 0; PICKLE_TRACK_SET (this, 0); return t; }
+    Scalar& adopt (Scalar_imp* sv)
+    { Scalar old (imp); imp = sv; PICKLE_TRACK_SET (this, sv); return *this; }
 
     // 'undef'
     Scalar ();
@@ -206,10 +405,28 @@ namespace Pickle
     Interpreter* get_interpreter ();
 
     // Runtime type information.
+    // kind - classify this in one step.
     // is_<type> - return true if this is of type <type>
     // check_<type> - die if not is_<type>()
     // <type> - convert this to type <type>, optionally checking.
 
+    // kind() looks only at the SV's flags and referent type, unless
+    // RESOLVE_OVERLOADS is true.  Then an object whose class overloads
+    // dereferencing is classified by the first of @{} %{} ${} &{} *{}
+    // that it overloads.  The overload is not called.
+    enum Kind { UNDEF, PLAIN, SCALARREF, ARRAYREF, HASHREF, CODEREF,
+		GLOBREF };
+    Kind kind (bool resolve_overloads = false) const;
+
+    // Classify this once and pass it to the matching Visitor method.
+    void visit (Visitor& v) const;
+
+    // Approximate bytes used by this SV and everything reachable from
+    // it through references, array elements and hash values, each SV
+    // counted once.  Code, globs and the stashes of objects are
+    // counted but not followed.
+    unsigned long deep_size () const;
+
     bool is_scalarref () const;
     void check_scalarref () const;
     Scalarref& scalarref (bool must_check)
@@ -309,6 +526,17 @@ namespace Pickle
     bool as_bool () const;
     operator bool () const { return as_bool (); }
 
+    // Explicit-context versions of the common conversions.  These act
+    // in the given interpreter instead of looking up the current one,
+    // which on threaded Perls is a thread-local access.  See Bound.
+    bool defined (const Interpreter&) const;
+    unsigned long as_ulong (const Interpreter&) const;
+    long as_long (const Interpreter&) const;
+    int as_int (const Interpreter&) const;
+    std::string as_string (const Interpreter&) const;
+    double as_double (const Interpreter&) const;
+    bool as_bool (const Interpreter&) const;
+
     // Convert data to/from XML using XML::Dumper, which must have been loaded.
     std::string as_xml () const;
     static Scalar from_xml (const std::string& s);
@@ -361,9 +589,18 @@ namespace Pickle
   {
   public:
     Scalarref (const Scalarref& r) : Scalar (r) {}
+    Scalarref& operator= (const Scalarref& r)
+    { Scalar::operator= (r); return *this; }
     static void check (const Scalar& s);  // Die if s is not a scalar ref.
     Scalarref (const Scalar& s, bool must_check = true) : Scalar (s)
     { if (must_check) check_scalarref (); }
+#ifdef PICKLE_RVALUE_REFS
+    Scalarref (Scalarref&& r) : Scalar (std::move (r)) {}
+    Scalarref& operator= (Scalarref&& r)
+    { Scalar::operator= (std::move (r)); return *this; }
+    Scalarref (Scalar&& s, bool must_check = true) : Scalar (std::move (s))
+    { if (must_check) check_scalarref (); }
+#endif
 
     // Create a new, uninitialized value.
     Scalarref ();
@@ -373,6 +610,10 @@ namespace Pickle
 
     Scalar fetch () const;
     void store (const Scalar&);
+
+    // Explicit-context versions.
+    Scalar fetch (const Interpreter&) const;
+    void store (const Interpreter&, const Scalar&);
   };
 
 
@@ -381,9 +622,18 @@ namespace Pickle
   public:
     Arrayref ();
     Arrayref (const Arrayref& r) : Scalar (r) {}
+    Arrayref& operator= (const Arrayref& r)
+    { Scalar::operator= (r); return *this; }
     static void check (const Scalar& s);  // Die if s is not an array ref.
     Arrayref (const Scalar& s, bool must_check = true) : Scalar (s)
     { if (must_check) check_arrayref (); }
+#ifdef PICKLE_RVALUE_REFS
+    Arrayref (Arrayref&& r) : Scalar (std::move (r)) {}
+    Arrayref& operator= (Arrayref&& r)
+    { Scalar::operator= (std::move (r)); return *this; }
+    Arrayref (Scalar&& s, bool must_check = true) : Scalar (std::move (s))
+    { if (must_check) check_arrayref (); }
+#endif
 
     // Look up an array in the symbol table.
     Arrayref (const std::string& name);
@@ -405,10 +655,32 @@ namespace Pickle
 
     size_t push (const Scalar& elt);
     size_t push (const List& elts);
+#ifdef PICKLE_RVALUE_REFS
+    // Hand VAL's SV to the array instead of sharing it.
+    Scalar& store (size_t index, Scalar&& val)
+    { return at (index) = std::move (val); }
+    size_t push (Scalar&& elt);
+#endif
     inline List deref () const;
 
     Arrayref& clear ();
     Scalar shift ();
+
+    // Make a tied array that reads and writes the elements of V in
+    // place, as Perl uses it.  V must outlive the array.  The second
+    // form ties any Array_binding, which the array then owns.
+    template <class T>
+    static Arrayref bind (std::vector<T>& v);
+    static Arrayref bind (Array_binding* b);
+
+    // Explicit-context versions.
+    size_t size (const Interpreter&) const;
+    Scalar fetch (const Interpreter&, size_t index) const;
+    Scalar& store (const Interpreter&, size_t index, const Scalar& val);
+    size_t push (const Interpreter&, const Scalar& elt);
+#ifdef PICKLE_RVALUE_REFS
+    size_t push (const Interpreter&, Scalar&& elt);
+#endif
   };
 
 
@@ -431,10 +703,22 @@ namespace Pickle
     List (const Arrayref& a) : arrayref (a) {}
     List (const Scalar& s, bool must_check = true)
       : arrayref (s, must_check) {}
+#ifdef PICKLE_RVALUE_REFS
+    List (List&& l) : arrayref (std::move (l.arrayref)) {}
+    List& operator= (List&& l)
+    { arrayref = std::move (l.arrayref); return *this; }
+    List (Arrayref&& a) : arrayref (std::move (a)) {}
+    List (Scalar&& s, bool must_check = true)
+      : arrayref (std::move (s), must_check) {}
+#endif
 
     size_t size () const { return arrayref .size (); }
     List& add (const Scalar& s) { arrayref .push (s); return *this; }
     List& operator<< (const Scalar& s) { return add (s); }
+#ifdef PICKLE_RVALUE_REFS
+    List& add (Scalar&& s) { arrayref .push (std::move (s)); return *this; }
+    List& operator<< (Scalar&& s) { return add (std::move (s)); }
+#endif
     operator const Arrayref& () const { return arrayref; }
     operator Arrayref& () { return arrayref; }
 
@@ -453,16 +737,38 @@ namespace Pickle
   public:
     Hashref ();
     Hashref (const Hashref& r) : Scalar (r) {}
+    Hashref& operator= (const Hashref& r)
+    { Scalar::operator= (r); return *this; }
     Hashref (const Scalar& s, bool must_check = true) : Scalar (s)
     { if (must_check) check_hashref (); }
+#ifdef PICKLE_RVALUE_REFS
+    Hashref (Hashref&& r) : Scalar (std::move (r)) {}
+    Hashref& operator= (Hashref&& r)
+    { Scalar::operator= (std::move (r)); return *this; }
+    Hashref (Scalar&& s, bool must_check = true) : Scalar (std::move (s))
+    { if (must_check) check_hashref (); }
+#endif
 
     // Lookup a hash in the symbol table.
     Hashref (const std::string& name);
     Hashref (const char* name);
 
+    // Make a tied hash over MAP, whose keys are std::string, such as a
+    // std::map or std::unordered_map.  MAP must outlive the hash.
+    template <class Map>
+    static Hashref bind (Map& map);
+    static Hashref bind (Hash_binding* b);
+
     Scalar fetch (const Scalar& key) const;
     Scalar& store (const Scalar& key, const Scalar& val);
+#ifdef PICKLE_RVALUE_REFS
+    // Hand VAL's SV to the hash instead of sharing it.
+    Scalar& store (const Scalar& key, Scalar&& val);
+#endif
 
+    // Explicit-context versions.
+    Scalar fetch (const Interpreter&, const Scalar& key) const;
+    Scalar& store (const Interpreter&, const Scalar& key, const Scalar& val);
   };
 
 
@@ -470,9 +776,65 @@ namespace Pickle
   {
   public:
     Coderef (const Coderef& r) : Scalar (r) {}
+    Coderef& operator= (const Coderef& r)
+    { Scalar::operator= (r); return *this; }
     Coderef (const Scalar& s, bool must_check = true) : Scalar (s)
     { if (must_check) check_coderef (); }
+#ifdef PICKLE_RVALUE_REFS
+    Coderef (Coderef&& r) : Scalar (std::move (r)) {}
+    Coderef& operator= (Coderef&& r)
+    { Scalar::operator= (std::move (r)); return *this; }
+    Coderef (Scalar&& s, bool must_check = true) : Scalar (std::move (s))
+    { if (must_check) check_coderef (); }
+#endif
 
+    // Call the sub, as call_function does.
+    Scalar operator() (Context cx = SCALAR) const;
+    Scalar operator() (const Scalar& a, Context cx = SCALAR) const;
+    Scalar operator() (const Scalar& a, const Scalar& b,
+		       Context cx = SCALAR) const;
+    Scalar operator() (const Scalar& a, const Scalar& b, const Scalar& c,
+		       Context cx = SCALAR) const;
+    Scalar operator() (const List& args, Context cx = SCALAR) const;
+
+    /* An Invoker calls one sub many times, with a fixed number of
+       arguments and a fixed context.  It keeps its argument scalars
+       from call to call and sets their values in place, and works out
+       the call flags once.  A call in VOID context returns undef, and
+       a call with no arguments leaves @_ alone, as `&name;' does.
+
+	 Coderef::Invoker count (handler, 2, VOID);
+	 for (...)
+	   count .set (0, key) .set (1, n) ();
+
+       Unlike call_function, an Invoker does not localize $@.  An
+       argument that the sub keeps a reference to is replaced, not
+       overwritten, by the next set().
+    */
+    class Invoker
+    {
+    private:
+      Invoker_imp* imp;
+      Invoker (const Invoker&);
+      Invoker& operator= (const Invoker&);
+
+    public:
+      explicit Invoker (const Coderef& code, unsigned nargs = 0,
+			Context cx = SCALAR);
+      ~Invoker ();
+
+      Invoker& set (unsigned i, long n);
+      Invoker& set (unsigned i, int n) { return set (i, (long) n); }
+      Invoker& set (unsigned i, double d);
+      Invoker& set (unsigned i, const char* s);
+      Invoker& set (unsigned i, const char* s, size_t len);
+      Invoker& set (unsigned i, const std::string& s)
+      { return set (i, s .data (), s .size ()); }
+      // Copy the value of V.
+      Invoker& set (unsigned i, const Scalar& v);
+
+      Scalar operator() ();
+    };
   };
 
 
@@ -480,9 +842,992 @@ namespace Pickle
   {
   public:
     Globref (const Globref& r) : Scalar (r) {}
+    Globref& operator= (const Globref& r)
+    { Scalar::operator= (r); return *this; }
     Globref (const Scalar& s, bool must_check = true) : Scalar (s)
     { if (must_check) check_globref (); }
+#ifdef PICKLE_RVALUE_REFS
+    Globref (Globref&& r) : Scalar (std::move (r)) {}
+    Globref& operator= (Globref&& r)
+    { Scalar::operator= (std::move (r)); return *this; }
+    Globref (Scalar&& s, bool must_check = true) : Scalar (std::move (s))
+    { if (must_check) check_globref (); }
+#endif
+
+    // Filehandles over C++ data, in perlio.cc.  Perl reads a span
+    // of memory in place; DATA must outlive the handle.
+    Globref (const char* data, size_t len);
+    // Read or write through SB, which must outlive the handle.  MODE
+    // is "r", "w" or "r+".
+    explicit Globref (std::streambuf* sb, const char* mode = "r");
+    // Take over FD, as open ($fh, "<&=", $fd) does.  MODE is as for
+    // fdopen.  Closing the handle closes FD.
+    Globref (int fd, const char* mode);
+  };
+
+
+  /* A Visitor receives a value already classified by Scalar::kind, as
+     the matching subclass.  The default methods for references descend
+     into the referent, through its dereference overload only if
+     RESOLVE_OVERLOADS is set, so deep traversals classify each SV exactly
+     once; the other defaults do nothing.  Override the cases of
+     interest.  Descending into a hash resets its iterator.  A cyclic
+     structure is visited forever unless an override breaks the cycle.
+  */
+  class Visitor
+  {
+  public:
+    // Passed to Scalar::kind.
+    bool resolve_overloads;
+
+    Visitor (bool resolve = false) : resolve_overloads (resolve) {}
+    virtual ~Visitor () {}
+
+    virtual void undef (const Scalar&) {}
+    virtual void plain (const Scalar&) {}
+    virtual void scalarref (const Scalarref& r);
+    virtual void arrayref (const Arrayref& a);
+    virtual void hashref (const Hashref& h);
+    virtual void coderef (const Coderef&) {}
+    virtual void globref (const Globref&) {}
+  };
+
+
+  /* A GlobalHandle names a package variable such as $Config::x.  It
+     looks up the glob once, when constructed, instead of parsing the
+     name and walking the symbol table on every access.  Each access
+     reads the glob's current contents, so the handle follows `local',
+     `*x = \$y' and redefinition of subs.  If the glob itself is deleted
+     from its package, refresh() looks the name up again.
+  */
+  class GlobalHandle : public Globref
+  {
+  public:
+    GlobalHandle (const GlobalHandle& g) : Globref (g) {}
+    GlobalHandle& operator= (const GlobalHandle& g)
+    { Scalar::operator= (g); return *this; }
+    GlobalHandle (const Scalar& s, bool must_check = true)
+      : Globref (s, must_check) {}
+
+    // Look up NAME, which may contain NUL characters.
+    GlobalHandle (const std::string& name);
+    GlobalHandle (const char* name);
+
+    // The glob's scalar, array, hash and sub.  code() throws if the
+    // sub is not defined.
+    Scalarref scalar () const;
+    Arrayref array () const;
+    Hashref hash () const;
+    Coderef code () const;
+
+    // Shortcuts for the scalar, like Scalarref::fetch and store.
+    Scalar fetch () const;
+    void store (const Scalar&);
+    Scalar fetch (const Interpreter&) const;
+    void store (const Interpreter&, const Scalar&);
+
+    void refresh ();
+  };
+
+
+  /* A Scope brackets code that makes many short-lived values.  It does
+     ENTER and SAVETMPS when constructed, and FREETMPS and LEAVE when
+     destroyed.  temp() makes a mortal SV owned by the scope and returns
+     a reference to it, so the value costs no refcount traffic of its
+     own and is freed in bulk with the rest.  References returned by
+     temp() are valid until the scope ends.
+
+     In a loop, call recycle() at the top of each iteration.  Later
+     temp() calls then overwrite the scope's earlier values in order
+     instead of allocating, except where Perl kept a reference to one.
+
+       Scope scope (interp);
+       for (size_t i = 0; i < n; i++)
+         {
+           scope .recycle ();
+           total += h .fetch (scope .temp (keys [i])) .as_long ();
+         }
+  */
+  class Scope
+  {
+  private:
+    Interpreter_imp* interpreter_imp;
+    std::deque<Scalar_imp*> temps;
+    size_t next;
+    unsigned long n_allocated;
+    unsigned long n_recycled;
+
+    Scope (const Scope&);
+    Scope& operator= (const Scope&);
+
+    Scalar_imp* reusable ();
+    const Scalar& keep (Scalar_imp* sv);
+    const Scalar& kept ();
+
+  public:
+    // Use the current interpreter, or the given one.
+    Scope ();
+    Scope (const Interpreter& interp);
+    ~Scope ();
+
+    const Scalar& temp (long i);
+    const Scalar& temp (unsigned long i);
+    const Scalar& temp (int i);
+    const Scalar& temp (unsigned int i);
+    const Scalar& temp (double d);
+    const Scalar& temp (const std::string& s);
+    const Scalar& temp (const char* s);
+    const Scalar& temp (const char* s, unsigned long len);
+
+    // Start reusing this scope's temporaries from the first one.
+    // Values returned by earlier temp() calls may be overwritten.
+    void recycle () { next = 0; }
+
+    // Number of temporaries created with a fresh SV, and with a
+    // recycled one.
+    unsigned long allocated () const { return n_allocated; }
+    unsigned long recycled () const { return n_recycled; }
+  };
+
+
+  /* Bound<T> is a T that remembers its interpreter.  Its conversions,
+     element access and refcounting use that interpreter directly
+     instead of looking up the current one, so on threaded Perls they
+     avoid a thread-local access per operation.  Elements fetched are
+     Bound<Scalar>s in the same interpreter.  Everything else is
+     inherited from T and works as usual.
+
+       Bound<Arrayref> a (interp, call_function ("get_list", LIST));
+       for (size_t i = 0; i < a .size (); i++)
+         total += a .fetch (i) .as_long ();
+  */
+
+  template <class T>
+  class Bound_base : public T
+  {
+  private:
+    const Interpreter* interp;
+
+  public:
+    Bound_base (const Interpreter& i, const T& t) : T (t), interp (&i) {}
+    // Take over SV's reference, as Scalar (Scalar_imp*) does.
+    Bound_base (const Interpreter& i, Scalar_imp* sv) : T (sv), interp (&i) {}
+    Bound_base (const Bound_base& b) : T (b), interp (b.interp) {}
+    Bound_base& operator= (const Bound_base& b)
+    { this->assign (*interp, b); return *this; }
+    Bound_base& operator= (const T& t)
+    { this->assign (*interp, t); return *this; }
+    ~Bound_base () { this->drop (*interp); }
+
+    const Interpreter& interpreter () const { return *interp; }
+    const Interpreter* get_interpreter () const { return interp; }
+
+    // T's conversions that take an interpreter still work.
+    using T::defined;
+    using T::as_ulong;
+    using T::as_long;
+    using T::as_int;
+    using T::as_string;
+    using T::as_double;
+    using T::as_bool;
+
+    bool defined () const { return T::defined (*interp); }
+    unsigned long as_ulong () const { return T::as_ulong (*interp); }
+    operator unsigned long () const { return as_ulong (); }
+    long as_long () const { return T::as_long (*interp); }
+    operator long () const { return as_long (); }
+    int as_int () const { return T::as_int (*interp); }
+    operator int () const { return as_int (); }
+    std::string as_string () const { return T::as_string (*interp); }
+    operator std::string () const { return as_string (); }
+    double as_double () const { return T::as_double (*interp); }
+    operator double () const { return as_double (); }
+    bool as_bool () const { return T::as_bool (*interp); }
+    operator bool () const { return as_bool (); }
+  };
+
+  template <class T>
+  class Bound : public Bound_base<T>
+  {
+  public:
+    Bound (const Interpreter& i, const T& t) : Bound_base<T> (i, t) {}
+    Bound (const Interpreter& i, Scalar_imp* sv) : Bound_base<T> (i, sv) {}
+    using Bound_base<T>::operator=;
+  };
+
+  template <>
+  class Bound<Scalarref> : public Bound_base<Scalarref>
+  {
+  public:
+    Bound (const Interpreter& i, const Scalarref& t)
+      : Bound_base<Scalarref> (i, t) {}
+    using Bound_base<Scalarref>::operator=;
+
+    Bound<Scalar> fetch () const;
+    void store (const Scalar& v)
+    { Scalarref::store (interpreter (), v); }
+  };
+
+  template <>
+  class Bound<Arrayref> : public Bound_base<Arrayref>
+  {
+  public:
+    Bound (const Interpreter& i, const Arrayref& t)
+      : Bound_base<Arrayref> (i, t) {}
+    using Bound_base<Arrayref>::operator=;
+
+    size_t size () const
+    { return Arrayref::size (interpreter ()); }
+    Bound<Scalar> fetch (size_t index) const;
+    Scalar& store (size_t index, const Scalar& val)
+    { return Arrayref::store (interpreter (), index, val); }
+    size_t push (const Scalar& elt)
+    { return Arrayref::push (interpreter (), elt); }
+#ifdef PICKLE_RVALUE_REFS
+    size_t push (Scalar&& elt)
+    { return Arrayref::push (interpreter (), std::move (elt)); }
+#endif
+  };
 
+  template <>
+  class Bound<Hashref> : public Bound_base<Hashref>
+  {
+  public:
+    Bound (const Interpreter& i, const Hashref& t)
+      : Bound_base<Hashref> (i, t) {}
+    using Bound_base<Hashref>::operator=;
+
+    Bound<Scalar> fetch (const Scalar& key) const;
+    Scalar& store (const Scalar& key, const Scalar& val)
+    { return Hashref::store (interpreter (), key, val); }
+  };
+
+
+  /* The C++ side of a container tied by Arrayref::bind or
+     Hashref::bind.  Perl's element magic and tie methods call these,
+     converting elements with Scalar's constructors and conversions.
+     A vector of double, long or int also sets KIND and VEC, and the
+     tie then reads and writes the vector directly, making no Scalars.
+     Perl's shift, unshift and splice are not supported on a bound
+     array.  */
+  class Array_binding
+  {
+  public:
+    enum Kind { OTHER, DOUBLES, LONGS, INTS };
+    Kind kind;
+    void* vec;
+
+    Array_binding (Kind k = OTHER, void* v = 0) : kind (k), vec (v) {}
+    virtual ~Array_binding () {}
+    virtual size_t size () const = 0;
+    virtual void resize (size_t n) = 0;
+    virtual Scalar fetch (size_t i) const = 0;
+    virtual void store (size_t i, const Scalar& val) = 0;
+  };
+
+  template <class T>
+  inline Array_binding::Kind bind_kind (std::vector<T>*)
+  { return Array_binding::OTHER; }
+  inline Array_binding::Kind bind_kind (std::vector<double>*)
+  { return Array_binding::DOUBLES; }
+  inline Array_binding::Kind bind_kind (std::vector<long>*)
+  { return Array_binding::LONGS; }
+  inline Array_binding::Kind bind_kind (std::vector<int>*)
+  { return Array_binding::INTS; }
+
+  template <class T>
+  class Vector_binding : public Array_binding
+  {
+  private:
+    std::vector<T>& v;
+
+  public:
+    Vector_binding (std::vector<T>& vec)
+      : Array_binding (bind_kind (&vec), &vec), v (vec) {}
+    size_t size () const { return v .size (); }
+    void resize (size_t n) { v .resize (n); }
+    Scalar fetch (size_t i) const { return Scalar (v [i]); }
+    void store (size_t i, const Scalar& val) { v [i] = T (val); }
+  };
+
+  template <class T>
+  Arrayref Arrayref::bind (std::vector<T>& v)
+  { return bind (new Vector_binding<T> (v)); }
+
+  // Keys in FIRSTKEY/NEXTKEY order come from first() and next(),
+  // which return false when there are no more.  Map_binding walks the
+  // keys as they were at first(), skipping any erased since, so Perl
+  // may store and delete while it iterates.
+  class Hash_binding
+  {
+  public:
+    virtual ~Hash_binding () {}
+    virtual size_t size () const = 0;
+    // Set VAL and return true if KEY is present.
+    virtual bool fetch (const std::string& key, Scalar& val) const = 0;
+    virtual void store (const std::string& key, const Scalar& val) = 0;
+    virtual bool exists (const std::string& key) const = 0;
+    // Remove KEY, setting VAL to its value, if present.
+    virtual bool erase (const std::string& key, Scalar& val) = 0;
+    virtual void clear () = 0;
+    virtual bool first (std::string& key) = 0;
+    virtual bool next (std::string& key) = 0;
+  };
+
+  template <class Map>
+  class Map_binding : public Hash_binding
+  {
+  private:
+    typedef typename Map::mapped_type T;
+    Map& map;
+    // A store can rehash an unordered map, invalidating iterators, so
+    // iteration goes over a copy of the keys.
+    std::vector<std::string> keys;
+    size_t pos;  // the key next() tries
+
+  public:
+    Map_binding (Map& m) : map (m), pos (0) {}
+    size_t size () const { return map .size (); }
+    bool fetch (const std::string& key, Scalar& val) const
+    {
+      typename Map::const_iterator it = map .find (key);
+      if (it == map .end ())
+	return false;
+      val = Scalar (it->second);
+      return true;
+    }
+    void store (const std::string& key, const Scalar& val)
+    { map [key] = T (val); }
+    bool exists (const std::string& key) const
+    { return map .find (key) != map .end (); }
+    bool erase (const std::string& key, Scalar& val)
+    {
+      typename Map::iterator it = map .find (key);
+      if (it == map .end ())
+	return false;
+      val = Scalar (it->second);
+      map .erase (it);
+      return true;
+    }
+    void clear () { map .clear (); }
+    bool first (std::string& key)
+    {
+      keys .clear ();
+      keys .reserve (map .size ());
+      for (typename Map::const_iterator it = map .begin ();
+	   it != map .end (); ++it)
+	keys .push_back (it->first);
+      pos = 0;
+      return next (key);
+    }
+    bool next (std::string& key)
+    {
+      while (pos < keys .size ())
+	{
+	  const std::string& k = keys [pos++];
+	  if (map .find (k) != map .end ())
+	    {
+	      key = k;
+	      return true;
+	    }
+	}
+      std::vector<std::string> () .swap (keys);
+      return false;
+    }
+  };
+
+  template <class Map>
+  Hashref Hashref::bind (Map& map)
+  { return bind (new Map_binding<Map> (map)); }
+
+
+  /* The untyped half of Class, below.  A Perl object is a reference
+     to a blessed scalar whose magic holds the C++ pointer and, through
+     the class's metadata, how to delete it.  */
+  class Class_base
+  {
+  public:
+    enum { MAX_ARGS = 8 };
+
+    // Call the method at PM on OBJ with ARGS, returning its result or
+    // an empty Scalar.
+    typedef Scalar (*method_thunk) (void* obj, const void* pm,
+				    const Scalar* args);
+    typedef void* (*ctor_thunk) (const Scalar* args);
+    typedef void (*dtor_thunk) (void* obj);
+
+  private:
+    std::string package;
+    Scalar meta;
+
+  protected:
+    Class_base (const std::string& package, dtor_thunk dtor);
+    // Define PACKAGE::NAME.  PM is copied.
+    void add_method (const std::string& name, method_thunk fn,
+		     const void* pm, size_t pm_size, unsigned nargs);
+    void add_ctor (const std::string& name, ctor_thunk fn, unsigned nargs);
+    Scalar wrap (void* obj, bool owned) const;
+    void* unwrap (const Scalar& obj) const;
+  };
+
+#ifdef PICKLE_RVALUE_REFS
+  template <unsigned... I> struct Class_indices {};
+  template <unsigned N, unsigned... I>
+  struct Class_make_indices : Class_make_indices<N - 1, N - 1, I...> {};
+  template <unsigned... I>
+  struct Class_make_indices<0, I...> { typedef Class_indices<I...> type; };
+
+  // Convert an argument as Scalar's conversion operators do.
+  template <class A>
+  inline typename std::decay<A>::type
+  class_arg (const Scalar& s) { return s; }
+
+  template <class R>
+  struct Class_result
+  {
+    template <class C, class M, class... X>
+    static Scalar call (C* obj, M pm, X&&... x)
+    { return Scalar ((obj->*pm) (std::forward<X> (x)...)); }
+  };
+
+  template <>
+  struct Class_result<void>
+  {
+    template <class C, class M, class... X>
+    static Scalar call (C* obj, M pm, X&&... x)
+    {
+      (obj->*pm) (std::forward<X> (x)...);
+      return Scalar ((Scalar_imp*) 0);
+    }
+  };
+
+  /* Class<T> exposes the C++ class T to Perl as a package.
+
+       Pickle::Class<Counter> ("Counter")
+	 .ctor<long> ()
+	 .method ("add", &Counter::add)
+	 .method ("total", &Counter::total);
+
+       my $c = Counter->new (5);
+       $c->add (2);
+
+     Each method is its own XSUB, which finds the object through magic
+     and converts its arguments straight to the parameter types, as
+     Scalar's conversion operators do.  Parameters are taken by value
+     or const reference, at most MAX_ARGS of them, and results convert
+     with Scalar's constructors.  An object made by the constructor
+     owns its T and deletes it when Perl frees the object; wrap() makes
+     one for an existing T.  A method called on anything but an object
+     of this class dies.  */
+  template <class T>
+  class Class : public Class_base
+  {
+  private:
+    template <class R, class... A, unsigned... I>
+    static Scalar invoke (T* obj, R (T::*pm) (A...), const Scalar* args,
+			  Class_indices<I...>)
+    { return Class_result<R>::call (obj, pm, class_arg<A> (args [I])...); }
+
+    template <class R, class... A, unsigned... I>
+    static Scalar invoke (T* obj, R (T::*pm) (A...) const,
+			  const Scalar* args, Class_indices<I...>)
+    { return Class_result<R>::call (obj, pm, class_arg<A> (args [I])...); }
+
+    template <class M, unsigned N>
+    static Scalar call (void* obj, const void* pm, const Scalar* args)
+    {
+      return invoke ((T*) obj, *(const M*) pm, args,
+		     typename Class_make_indices<N>::type ());
+    }
+
+    template <class... A, unsigned... I>
+    static void* construct (const Scalar* args, Class_indices<I...>)
+    { return new T (class_arg<A> (args [I])...); }
+
+    template <class... A>
+    static void* construct (const Scalar* args)
+    {
+      return construct<A...>
+	(args, typename Class_make_indices<sizeof... (A)>::type ());
+    }
+
+    static void destroy (void* obj) { delete (T*) obj; }
+
+  public:
+    explicit Class (const std::string& package)
+      : Class_base (package, &destroy) {}
+
+    template <class R, class... A>
+    Class& method (const std::string& name, R (T::*pm) (A...))
+    {
+      static_assert (sizeof... (A) <= MAX_ARGS, "too many arguments");
+      add_method (name, &call<R (T::*) (A...), sizeof... (A)>, &pm,
+		  sizeof pm, sizeof... (A));
+      return *this;
+    }
+
+    template <class R, class... A>
+    Class& method (const std::string& name, R (T::*pm) (A...) const)
+    {
+      static_assert (sizeof... (A) <= MAX_ARGS, "too many arguments");
+      add_method (name, &call<R (T::*) (A...) const, sizeof... (A)>, &pm,
+		  sizeof pm, sizeof... (A));
+      return *this;
+    }
+
+    // Define a constructor, NAME, called as a class method, which
+    // passes its arguments to T's constructor taking A.
+    template <class... A>
+    Class& ctor (const std::string& name = "new")
+    {
+      static_assert (sizeof... (A) <= MAX_ARGS, "too many arguments");
+      add_ctor (name, &construct<A...>, sizeof... (A));
+      return *this;
+    }
+
+    // A Perl object for OBJ, which it deletes when freed if OWNED.
+    Scalar wrap (T* obj, bool owned = true) const
+    { return Class_base::wrap (obj, owned); }
+    // The T in OBJ, or 0 if OBJ is not an object of this class.
+    T* unwrap (const Scalar& obj) const
+    { return (T*) Class_base::unwrap (obj); }
+  };
+#endif  // PICKLE_RVALUE_REFS
+
+
+  // Memory use of an interpreter, from Interpreter::memory_stats.
+  // Sizes are approximate: bodies are reckoned from Perl's structure
+  // sizes, and malloc overhead is not counted.
+  struct Memory_stats
+  {
+    enum Kind { SCALAR, ARRAY, HASH, CODE, GLOB, IO, OTHER, KINDS };
+
+    unsigned long svs;               // live SVs
+    unsigned long by_kind [KINDS];   // live SVs by type
+    unsigned long free_svs;          // unused arena slots
+    unsigned long long head_bytes;   // arena slots, used or not
+    unsigned long long body_bytes;   // SV bodies
+    unsigned long long string_bytes; // string buffers
+    unsigned long long array_bytes;  // array element vectors
+    unsigned long long hash_bytes;   // hash buckets and entries
+
+    // SVs held by a live Scalar and by nothing else, and their deep
+    // size.  Known only after a full walk in a library built with
+    // PICKLE_TRACK, otherwise 0.
+    unsigned long pinned_svs;
+    unsigned long long pinned_bytes;
+
+    // The fraction of arena slots examined, 1 for a full walk.
+    double sampled;
+
+    unsigned long long total_bytes () const
+    { return head_bytes + body_bytes + string_bytes + array_bytes
+	+ hash_bytes; }
+  };
+
+
+  /* Profiler times every crossing between C++ and Perl: call_function,
+     call_method, eval_string and calls from Perl into subs made with
+     define_sub.  For each target it keeps a call count, total time,
+     self time (total less time spent in nested crossings) and a
+     histogram of call latencies.  Counters are per thread, so threads
+     do not contend, and snapshot() sums them.
+
+     Profiling is off by default, which costs one test per crossing.
+
+       Profiler::enable ();
+       run_workload ();
+       Profiler::dump (cout);
+  */
+  class Profiler
+  {
+  public:
+    // Bucket B counts calls taking 2**B to 2**(B+1) nanoseconds.  The
+    // last bucket also counts all longer calls.
+    enum { BUCKETS = 32 };
+
+    struct Entry
+    {
+      // "call_function", "call_method", "eval_string" or "xsub".
+      std::string kind;
+      // Sub or method name, or the start of the evaluated code.
+      std::string target;
+      unsigned long calls;
+      unsigned long long total_ns;
+      unsigned long long self_ns;
+      unsigned long histogram [BUCKETS];
+    };
+
+    static void enable (bool on = true);
+    static bool enabled ();
+
+    // Zero all counters.
+    static void reset ();
+
+    // Return the counters summed over threads, one entry per target.
+    static std::vector<Entry> snapshot ();
+
+    // Write a snapshot in the Prometheus text exposition format.
+    static void dump (std::ostream& os);
+  };
+
+  /* Sampler interrupts the process HZ times per CPU second and records
+     the native call stack together with the Perl context stack of the
+     interpreter running on the interrupted thread.  dump() writes the
+     samples as folded stacks for flamegraph.pl, with Perl subs in
+     place of the interpreter's own frames between call_function or
+     eval_string and the next sub made with define_sub.
+
+       Sampler::start ();
+       run_workload ();
+       Sampler::stop ();
+       Sampler::dump (out);
+
+     Native frames are named only if the program is linked with
+     -rdynamic.  Once MAX_SAMPLES are taken, further ones are dropped.
+  */
+  class Sampler
+  {
+  public:
+    static void start (unsigned hz = 997, unsigned long max_samples = 8192);
+    static void stop ();
+
+    // Discard all samples.
+    static void reset ();
+
+    static unsigned long samples ();
+    static unsigned long dropped ();
+
+    // Write one line per distinct stack: frames outermost first,
+    // separated by `;', then a space and the number of samples.
+    static void dump (std::ostream& os);
+  };
+
+  /* EventQueue carries events from any number of C++ threads to the
+     thread running an interpreter, without locks.  Producers post
+     numbers, strings or native payloads; the interpreter's thread
+     drains them in order of posting, converting a whole batch into
+     the elements of one array.  fd() is a descriptor, an eventfd on
+     Linux and a pipe elsewhere, that polls readable while events are
+     pending, for the Perl event loop to watch.
+
+       EventQueue q;
+       q .define_sub (interp, "Net", "events");
+       // Network threads:
+       q .post (msg);
+       // Perl, when q .fd () is readable:
+       //   handle ($_) for @{ Net::events () };
+
+     The queue holds CAPACITY events, rounded up to a power of two.
+     post() returns false and drops the event when it is full.
+  */
+  struct Event_ring;
+  class EventQueue
+  {
+  private:
+    Event_ring* ring;
+    EventQueue (const EventQueue&);
+    EventQueue& operator= (const EventQueue&);
+
+  public:
+    // Make a Perl value of PAYLOAD, on the interpreter's thread, and
+    // free PAYLOAD.
+    typedef Scalar (*convert_fn) (const Interpreter&, void* payload);
+
+    explicit EventQueue (size_t capacity = 1024);
+    ~EventQueue ();
+
+    // Post from any thread.  Strings are copied.
+    bool post (long n);
+    bool post (int n) { return post ((long) n); }
+    bool post (double d);
+    bool post (const char* s, size_t len);
+    bool post (const std::string& s);
+    bool post (convert_fn fn, void* payload);
+
+    int fd () const;
+    size_t pending () const;
+    unsigned long dropped () const;
+
+    // On the interpreter's thread, convert up to MAX pending events,
+    // or all if MAX is 0, into one array.
+    Arrayref drain (const Interpreter& i, size_t max = 0);
+
+    // Define PACKAGE::NAME ([MAX]) to drain into an array reference,
+    // converting events in I, which the sub keeps a pointer to.  Once
+    // the queue is destroyed, the sub croaks.
+    void define_sub (const Interpreter& i, const std::string& package,
+		     const std::string& name);
+
+    // The work of an async sub, done on a worker thread, away from
+    // the interpreter.  It gets the sub's arguments as strings and
+    // returns its result, or throws a std::exception.
+    typedef std::string (*async_sub) (const std::vector<std::string>& args);
+
+    // Define PACKAGE::NAME to return a Pickle::Promise at once and run
+    // FN on one of the queue's worker threads.  Draining the queue
+    // settles the promise, which is then among the events drained.
+    // Once the queue is destroyed, the sub croaks.
+    void define_async_sub (const Interpreter& i, const std::string& package,
+			   const std::string& name, async_sub fn);
+
+    // The number of worker threads, 4 by default, started when the
+    // first async sub is defined.
+    void async_threads (unsigned n);
+  };
+
+  /* Pool runs threads each with an interpreter of its own, made with
+     ARGS if given, for parallel_map.  Values cross between
+     interpreters in a native binary format, so only plain data can:
+     numbers, strings, and references to arrays, hashes and scalars,
+     blessed or not.  Code, glob, regexp, lvalue and I/O references
+     make it throw.
+
+       Pool pool (8, args);
+       pool .eval_each ("use My::Transform;");
+       Arrayref out = parallel_map (in, "\\&My::Transform::run", pool);
+
+     A Pool serves one calling thread at a time.
+  */
+  struct Pool_imp;
+  class Pool
+  {
+  private:
+    Pool_imp* imp;
+    Pool (const Pool&);
+    Pool& operator= (const Pool&);
+    friend Arrayref parallel_map (const Arrayref&, const std::string&,
+				  Pool&);
+    friend class RegexScanner;
+
+  public:
+    explicit Pool (unsigned threads);
+    Pool (unsigned threads, const std::vector<std::string>& args);
+    ~Pool ();
+
+    unsigned size () const;
+
+    // Evaluate CODE in each interpreter.  Throws the first error.
+    void eval_each (const std::string& code);
+
+    // parallel_map sizes chunks to take about NS nanoseconds, by
+    // default 2000000, at the cost per item measured so far.
+    // chunk_size returns the largest chunk of the last parallel_map.
+    void chunk_time (unsigned long ns);
+    size_t chunk_size () const;
+  };
+
+  // Perform `[ map { $code->($_) } @$input ]' across POOL's threads.
+  // CODE is evaluated in each interpreter and must return a code
+  // reference, as `\&name' or `sub { ... }' do.  The sub sees each
+  // element in $_ and $_[0], and is called in list context.  Results
+  // are in the order of the input.  If the sub dies, so does
+  // parallel_map, after the chunks already started have finished.
+  Arrayref parallel_map (const Arrayref& input, const std::string& code,
+			 Pool& pool);
+
+  /* A Feed passes records to a Perl sub in batches, so that one call
+     serves many records.  The sub gets a reference to an array of byte
+     strings.  Feed reuses the array and its scalars from batch to
+     batch, so the sub must copy whatever it keeps.
+
+       Feed feed (interp, interp .Coderef ("Log::parse"), 512);
+       while (getline (in, line))
+         feed .push (line);
+       feed .flush ();
+
+     run() calls PRODUCER on a new thread, which pushes records while
+     the calling thread hands the last batch to Perl.  There are two
+     batches: push() waits while both are full, and returns false if
+     the sub has died, after which the producer should return.  run()
+     throws what the sub or the producer threw.
+  */
+  struct Feed_imp;
+  class Feed
+  {
+  private:
+    Feed_imp* imp;
+    Feed (const Feed&);
+    Feed& operator= (const Feed&);
+
+  public:
+    typedef void (*producer_fn) (Feed& feed, void* arg);
+
+    Feed (const Interpreter& i, const Scalar& handler, size_t batch = 256);
+    // Records not yet flushed are dropped.
+    ~Feed ();
+
+    // Outside run(), on the interpreter's thread, push() calls the
+    // sub when a batch fills, and throws if it dies.
+    bool push (const char* data, size_t len);
+    bool push (const std::string& s) { return push (s .data (), s .size ()); }
+    // Pass on a partial batch.
+    void flush ();
+
+    void run (producer_fn producer, void* arg = 0);
+
+    unsigned long records () const;
+    unsigned long batches () const;
+  };
+
+  /* A Regex is a pattern compiled by Perl, from
+     Interpreter::compile_regex, that matches C++ strings in place.
+     The subject is lent to the engine for the call, not copied into a
+     Perl string, and capture offsets come back in a Match.
+
+       Regex re = interp .compile_regex ("^(\\w+)=(\\d+)");
+       Regex::Match m;
+       if (re .match (line .data (), line .size (), m))
+         value = atoi (line .c_str () + m .start (2));
+
+     Subjects are bytes.  A Regex is used only on the thread running
+     its interpreter.
+  */
+  class Regex
+  {
+  public:
+    enum { MAX_GROUPS = 15 };
+
+    // Offsets in the subject of the whole match, group 0, and of the
+    // first MAX_GROUPS capture groups; -1 for a group that did not
+    // take part.
+    struct Match
+    {
+      unsigned groups;  // capture groups in the pattern, up to MAX_GROUPS
+      long starts [MAX_GROUPS + 1];
+      long ends [MAX_GROUPS + 1];
+
+      bool matched (unsigned n) const
+      { return n <= groups && starts [n] >= 0; }
+      long start (unsigned n = 0) const { return starts [n]; }
+      long end (unsigned n = 0) const { return ends [n]; }
+      long length (unsigned n = 0) const { return ends [n] - starts [n]; }
+    };
+
+    // Match at or after offset FROM.
+    bool match (const char* s, size_t len, Match& m, size_t from = 0) const;
+    bool match (const char* s, size_t len) const;
+    bool match (const std::string& s, Match& m, size_t from = 0) const
+    { return match (s .data (), s .size (), m, from); }
+    bool match (const std::string& s) const
+    { return match (s .data (), s .size ()); }
+#ifdef PICKLE_STRING_VIEW
+    bool match (std::string_view s, Match& m, size_t from = 0) const
+    { return match (s .data (), s .size (), m, from); }
+    bool match (std::string_view s) const
+    { return match (s .data (), s .size ()); }
+#endif
+
+    // The number of capture groups, which may exceed MAX_GROUPS.
+    unsigned groups () const;
+
+    // The pattern as a qr// object, for Perl code.
+    const Scalar& qr () const { return re; }
+
+  private:
+    friend class Interpreter;
+    friend struct Scanner_imp;
+    Interpreter_imp* perl;
+    Scalar re;       // a reference to the REGEXP
+    Scalar subject;  // lends the subject to the engine
+    Regex (Interpreter_imp* p, const Scalar& r, const Scalar& s)
+      : perl (p), re (r), subject (s) {}
+  };
+
+  /* A RegexScanner matches one pattern against many C++ strings on
+     the threads of a Pool.  Each thread's interpreter compiles the
+     pattern once, when the scanner is made, and scans a share of the
+     strings in place.
+
+       RegexScanner scanner (pool, "(GET|POST) (\\S+)");
+       RegexScanner::Result r = scanner .scan (lines);
+       for (size_t k = 0; k < r .size (); k++)
+         hits [lines [r .index [k]] .substr (r .start (k, 2),
+                                             r .length (k, 2))]++;
+
+     The scanner must not outlive the pool, and the pool serves one of
+     scan() and parallel_map at a time.
+  */
+  class RegexScanner
+  {
+  private:
+    Scanner_imp* imp;
+    RegexScanner (const RegexScanner&);
+    RegexScanner& operator= (const RegexScanner&);
+
+  public:
+    // The matches in columns: the index of each matching string, in
+    // ascending order, and the start and end offsets of its groups,
+    // WIDTH per match, group 0 first.  Groups that did not take part
+    // have offsets of -1.
+    struct Result
+    {
+      unsigned width;  // capture groups + 1
+      std::vector<size_t> index;
+      std::vector<long> starts;
+      std::vector<long> ends;
+
+      size_t size () const { return index .size (); }
+      long start (size_t k, unsigned group = 0) const
+      { return starts [k * width + group]; }
+      long end (size_t k, unsigned group = 0) const
+      { return ends [k * width + group]; }
+      long length (size_t k, unsigned group = 0) const
+      { return end (k, group) - start (k, group); }
+    };
+
+    // Throws the compiler's error for a bad pattern.  FLAGS are as
+    // for Interpreter::compile_regex.
+    RegexScanner (Pool& pool, const std::string& pattern,
+		  const std::string& flags = "");
+    ~RegexScanner ();
+
+    Result scan (const std::vector<std::string>& subjects) const;
+    Result scan (const char* const* data, const size_t* lens,
+		 size_t n) const;
+  };
+
+  /* A Packer runs Perl's pack and unpack with one template, for
+     binary records in C++ buffers.  Each call passes the record
+     straight to Perl's pack engine and writes the values into the
+     caller's vector, reusing its scalars.
+
+       Packer rec (interp, "N n/a* C");
+       std::vector<Scalar> v;
+       while (read_record (buf, len))
+         {
+           rec .unpack (buf, len, v);
+           ...
+         }
+
+     The numeric forms store values as numbers, for templates of
+     numbers only.  A bad template or record throws Perl's error.
+  */
+  struct Packer_imp;
+  class Packer
+  {
+  private:
+    Packer_imp* imp;
+    Packer (const Packer&);
+    Packer& operator= (const Packer&);
+
+  public:
+    Packer (const Interpreter& i, const std::string& tmpl);
+    ~Packer ();
+
+    // Unpack the LEN bytes at DATA.  Each returns the number of values
+    // unpacked; the numeric forms store at most MAX of them.
+    size_t unpack (const char* data, size_t len,
+		   std::vector<Scalar>& out) const;
+    size_t unpack (const char* data, size_t len, long* out,
+		   size_t max) const;
+    size_t unpack (const char* data, size_t len, double* out,
+		   size_t max) const;
+    size_t unpack (const std::string& s, std::vector<Scalar>& out) const
+    { return unpack (s .data (), s .size (), out); }
+
+    // Pack ARGS into OUT, replacing its contents.
+    void pack (const std::vector<Scalar>& args, std::string& out) const;
   };
 
 
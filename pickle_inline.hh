@@ -0,0 +1,149 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+/* Fast paths for the commonest operations, for code that includes
+   this instead of pickle.hh.  It brings in the Perl headers, and with
+   them Perl's many macros, so the program must be compiled with the
+   flags of the perl that the library was built for.
+
+   Each fast path avoids the interpreter context lookup, which on
+   threaded Perls is a thread-local access, where Perl itself would
+   not need the interpreter.  The functions in Pickle::Inline mirror
+   Scalar and Arrayref members of the same names:
+
+     for (size_t i = 0; i < Inline::size (a); i++)
+       total += Inline::as_long (Inline::at (a, i));
+
+   They are static, so each translation unit has its own copy, and
+   the library's members, in inline.cc, are written with them.  */
+
+#ifndef _PICKLE_INLINE_HH
+#define _PICKLE_INLINE_HH
+
+#include "pickle_int.hh"
+
+#if REFCNT_COUNT
+#  define PICKLE_COUNT_DEC() (++pickle_refcnt_decs)
+#else
+#  define PICKLE_COUNT_DEC() ((void) 0)
+#endif
+
+namespace Pickle
+{
+  namespace Inline
+  {
+
+    // Drop a reference to SV, looking up the interpreter only if SV
+    // dies.
+    static inline void
+    drop (SV* sv)
+    {
+      if (SvREFCNT (sv) > 1)
+	{
+	  PICKLE_COUNT_DEC ();
+	  --SvREFCNT (sv);
+	}
+      else
+	{
+	  dInterp;
+	  SvREFCNT_dec (sv);
+	}
+    }
+
+    // Values with get magic, and those not yet in the wanted form, go
+    // the long way.
+
+    static inline bool
+    defined (const Scalar& s)
+    {
+      return SvOK (s .get_imp ());
+    }
+
+    static inline unsigned long
+    as_ulong (const Scalar& s)
+    {
+      SV* sv = s .get_imp ();
+      if (SvIOK (sv) && ! SvGMAGICAL (sv))
+	return SvUVX (sv);
+      dInterp;
+      return SvUV (sv);
+    }
+
+    static inline long
+    as_long (const Scalar& s)
+    {
+      SV* sv = s .get_imp ();
+      if (SvIOK (sv) && ! SvGMAGICAL (sv))
+	return SvIVX (sv);
+      dInterp;
+      return SvIV (sv);
+    }
+
+    static inline int
+    as_int (const Scalar& s)
+    {
+      return as_long (s);
+    }
+
+    static inline double
+    as_double (const Scalar& s)
+    {
+      SV* sv = s .get_imp ();
+      if (SvNOK (sv) && ! SvGMAGICAL (sv))
+	return SvNVX (sv);
+      dInterp;
+      return SvNV (sv);
+    }
+
+    // Tied arrays need the interpreter.
+
+    static inline size_t
+    size (const Arrayref& a)
+    {
+      AV* av = (AV*) SvRV (a .get_imp ());
+      if (! SvRMAGICAL (av))
+	return AvFILLp (av) + 1;
+      dInterp;
+      return 1 + av_len (av);
+    }
+
+    // The slot holding element INDEX, created if need be.
+    static inline SV**
+    slot (const Arrayref& a, size_t index)
+    {
+      AV* av = (AV*) SvRV (a .get_imp ());
+      if (! SvRMAGICAL (av) && (SSize_t) index <= AvFILLp (av)
+	  && AvARRAY (av) [index])
+	return &AvARRAY (av) [index];
+      dInterp;
+      return av_fetch (av, index, 1);
+    }
+
+    // The element aliased as a Scalar, as Arrayref::at returns it.
+    static inline const Scalar&
+    at (const Arrayref& a, size_t index)
+    {
+      return *(const Scalar*) slot (a, index);
+    }
+
+  }
+}
+
+#endif  // _PICKLE_INLINE_HH
@@ -18,6 +18,9 @@
    MA 02111-1307  USA
 */
 
+#ifndef _PICKLE_INT_HH
+#define _PICKLE_INT_HH
+
 using namespace std;
 
 extern "C"
@@ -66,6 +69,11 @@ extern "C"
 #endif // !defined(pTHX)
 
 
+#ifndef GvSVn  // Before 5.10, globs always have a scalar.
+#  define GvSVn GvSV
+#endif
+
+
 #define Interpreter_imp PerlInterpreter
 #define interpreter_imp my_perl
 #define Scalar_imp SV
@@ -81,19 +89,162 @@ extern "C"
 #  define dInterp dNOOP
 #endif
 
+namespace Pickle
+{
+  // Find or create the glob NAME, which may contain NUL characters.
+  GV* fetch_gv (pTHX_ const char* name, STRLEN len, svtype type);
+
+  // Die in Perl with E's message, deleting E, from an XSUB or magic.
+  void propagate_to_perl (pTHX_ Exception* e);
+}
+
+// Declare the context of an explicitly given Interpreter.
+#ifdef PERL_IMPLICIT_CONTEXT
+#  define dInterpOf(i) PerlInterpreter* my_perl = (i) .my_perl
+#else
+#  define dInterpOf(i) dNOOP
+#endif
+
+
+namespace Pickle
+{
+  // Boundary profiler hooks, defined in profile.cc.  prof_enter
+  // returns a frame to pass to prof_leave, or -1.
+  extern bool profiling;
+  enum Prof_kind { PROF_CALL, PROF_METHOD, PROF_EVAL, PROF_XSUB };
+  int prof_enter (pTHX_ Prof_kind kind, SV* target);
+  int prof_enter (Prof_kind kind, const char* name, size_t len);
+  void prof_leave (int frame);
+
+  // The name of the sub TARGET, a CV, a reference to one or a name,
+  // formatted in BUF if need be.
+  const char* sub_name (pTHX_ SV* target, char* buf, size_t size);
+
+  // Time a crossing for the lifetime of the guard.  Code that may
+  // croak must call leave() first, since croak skips destructors.
+  class Prof_guard
+  {
+  private:
+    int frame;
+
+  public:
+    Prof_guard (pTHX_ Prof_kind kind, SV* target)
+      : frame (profiling ? prof_enter (aTHX_ kind, target) : -1) {}
+    Prof_guard (Prof_kind kind, const char* name, size_t len)
+      : frame (profiling ? prof_enter (kind, name, len) : -1) {}
+    ~Prof_guard () { leave (); }
+    void leave ()
+    {
+      if (frame >= 0)
+	prof_leave (frame);
+      frame = -1;
+    }
+  };
+}
+
+
+// USDT probes for perf and bpftrace, compiled in wherever <sys/sdt.h>
+// exists unless PICKLE_USDT is defined as 0.  A tracer attaching to a
+// probe sets its semaphore, so probe arguments are worked out only
+// while someone is listening; otherwise a probe is a test and a nop.
+// The semaphores are defined in interpreter.cc.
+#ifndef PICKLE_USDT
+#  ifdef __has_include
+#    if __has_include (<sys/sdt.h>)
+#      define PICKLE_USDT 1
+#    endif
+#  endif
+#endif
+
+#if PICKLE_USDT
+#  define _SDT_HAS_SEMAPHORES 1
+#  include <sys/sdt.h>
+#  define PICKLE_PROBES(_)						\
+  _(interp_new) _(interp_free)						\
+  _(call_entry) _(call_return)						\
+  _(xsub_entry) _(xsub_return)						\
+  _(eval_entry) _(eval_return)						\
+  _(exception)
+#  define PICKLE_PROBE_SEMAPHORE(name)					\
+  extern "C" unsigned short pickle_##name##_semaphore;
+PICKLE_PROBES (PICKLE_PROBE_SEMAPHORE)
+#  ifdef __GNUC__
+#    define PICKLE_PROBE_ENABLED(name)					\
+  __builtin_expect (pickle_##name##_semaphore != 0, 0)
+#  else
+#    define PICKLE_PROBE_ENABLED(name) (pickle_##name##_semaphore != 0)
+#  endif
+#  define PICKLE_PROBE1(name, a) STAP_PROBE1 (pickle, name, a)
+#  define PICKLE_PROBE2(name, a, b) STAP_PROBE2 (pickle, name, a, b)
+#else
+#  define PICKLE_PROBE_ENABLED(name) 0
+#  define PICKLE_PROBE1(name, a) ((void) (a))
+#  define PICKLE_PROBE2(name, a, b) ((void) (a), (void) (b))
+#endif
+
 
-#ifndef REFCNT_DEBUG
-#  define REFCNT_DEBUG 0
+namespace Pickle
+{
+  // Worker threads for EventQueue::define_async_sub, in async.cc.
+  // async_define starts them, if POOL is null, and defines the sub,
+  // adding it to DEFS.  async_detach makes the subs in DEFS croak.
+  struct Async_pool;
+  struct Async_def;
+  void async_define (pTHX_ EventQueue* queue, Async_pool*& pool,
+		     Async_def*& defs, unsigned threads,
+		     const std::string& fullname, EventQueue::async_sub fn);
+  void async_stop (Async_pool* pool);
+  void async_detach (Async_def* defs);
+}
+
+
+namespace Pickle
+{
+  // Copy values between interpreters, in pool.cc.  freeze appends SV
+  // to OUT in Pickle's native transfer format, and thaw makes a new SV
+  // of the value at P, advancing P.  Both throw on what they cannot
+  // copy.  put_len and get_len write and read the format's lengths.
+  void freeze (pTHX_ SV* sv, std::string& out, int depth = 0);
+  SV* thaw (pTHX_ const char*& p, const char* end);
+  void put_len (std::string& out, size_t n);
+  size_t get_len (const char*& p, const char* end);
+
+  // Run native work on a Pool's threads, and wait for it.  FN gets
+  // the worker's interpreter and number.  pool_each calls FN once on
+  // every worker; pool_run calls it once with each of the N ARGS, on
+  // any worker.  Both throw the first Exception that FN threw.
+  typedef void (*Pool_fn) (const Interpreter& i, void* arg, unsigned worker);
+  void pool_each (Pool_imp* pool, Pool_fn fn, void* arg);
+  void pool_run (Pool_imp* pool, Pool_fn fn, void* const* args, size_t n);
+}
+
+
+#ifdef PICKLE_TRACK
+namespace Pickle
+{
+  // Call FN with the SV of each of the interpreter's live Scalars, in
+  // track.cc.
+  void track_each (pTHX_ void (*fn) (const void* sv, void* arg), void* arg);
+}
 #endif
-#if REFCNT_DEBUG
-// extern "C" for easier breakpoint setting.
-extern "C" SV* my_sv_refcnt_inc (SV* sv);
-extern "C" void my_sv_refcnt_dec (SV* sv);
-inline SV* my_inline_sv_refcnt_inc (SV* sv) { return SvREFCNT_inc (sv); }
-inline void my_inline_sv_refcnt_dec (SV* sv) { SvREFCNT_dec (sv); }
+
+
+// Tally refcount operations, for bench_pickle's churn report.
+#ifndef REFCNT_COUNT
+#  define REFCNT_COUNT 0
+#endif
+#if REFCNT_COUNT
+extern "C" unsigned long pickle_refcnt_incs;
+extern "C" unsigned long pickle_refcnt_decs;
+inline SV* my_counted_sv_refcnt_inc (SV* sv)
+{ ++pickle_refcnt_incs; return SvREFCNT_inc (sv); }
+inline void my_counted_sv_refcnt_dec (pTHX_ SV* sv)
+{ ++pickle_refcnt_decs; SvREFCNT_dec (sv); }
 
 #undef SvREFCNT_inc
-#define SvREFCNT_inc(_sv) ({ SV* sv = const_cast<SV*> (_sv); if (!SvIMMORTAL(sv)) cerr << "inc " << (sv) << " line " << __LINE__ << " to " << 1 + SvREFCNT(sv) << endl; my_sv_refcnt_inc (sv); })
+#define SvREFCNT_inc(_sv) my_counted_sv_refcnt_inc ((SV*) (_sv))
 #undef SvREFCNT_dec
-#define SvREFCNT_dec(_sv) ({ SV* sv = const_cast<SV*> (_sv); if (!SvIMMORTAL(sv)) cerr << "dec " << (sv) << " line " << __LINE__ << " to " << SvREFCNT(sv) - 1 << endl; my_sv_refcnt_dec (sv); })
-#endif  // REFCNT_DEBUG
+#define SvREFCNT_dec(_sv) my_counted_sv_refcnt_dec (aTHX_ (SV*) (_sv))
+#endif  // REFCNT_COUNT
+
+#endif  // _PICKLE_INT_HH
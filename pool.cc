@@ -0,0 +1,807 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+#include "pickle_int.hh"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+
+namespace Pickle
+{
+
+  // Native transfer format.  Values are copied between interpreters
+  // as a type byte followed by the value in host byte order: lengths
+  // of strings and result lists as base-128 varints, element counts
+  // of arrays and hashes as 32-bit numbers, patched in after the
+  // elements are written.
+
+  enum
+  {
+    T_UNDEF, T_IV, T_UV, T_NV, T_STR, T_UTF8, T_ARRAY, T_HASH,
+    T_REF, T_BLESS
+  };
+  enum { MAX_DEPTH = 512 };
+
+  void
+  put_len (string& out, size_t n)
+  {
+    while (n >= 0x80)
+      {
+	out += (char) (n | 0x80);
+	n >>= 7;
+      }
+    out += (char) n;
+  }
+
+  static void
+  need (const char* p, const char* end, size_t n)
+  {
+    if ((size_t) (end - p) < n)
+      throw new Exception ("thaw: truncated value");
+  }
+
+  size_t
+  get_len (const char*& p, const char* end)
+  {
+    size_t n = 0;
+    for (int shift = 0; p < end; shift += 7)
+      {
+	unsigned char c = *p++;
+	n |= (size_t) (c & 0x7f) << shift;
+	if (! (c & 0x80))
+	  return n;
+      }
+    throw new Exception ("thaw: truncated length");
+  }
+
+  template <class T>
+  static void
+  put_raw (string& out, T v)
+  {
+    out .append ((const char*) &v, sizeof v);
+  }
+
+  template <class T>
+  static T
+  get_raw (const char*& p, const char* end)
+  {
+    T v;
+    need (p, end, sizeof v);
+    memcpy (&v, p, sizeof v);
+    p += sizeof v;
+    return v;
+  }
+
+  static void
+  put_str (string& out, int type, const char* s, STRLEN len)
+  {
+    out += (char) type;
+    put_len (out, len);
+    out .append (s, len);
+  }
+
+  void
+  freeze (pTHX_ SV* sv, string& out, int depth)
+  {
+    if (depth > MAX_DEPTH)
+      throw new Exception ("freeze: structure too deep or cyclic");
+
+    SvGETMAGIC (sv);
+    if (SvROK (sv))
+      {
+	SV* rv = SvRV (sv);
+	if (SvOBJECT (rv))
+	  {
+	    const char* name = HvNAME (SvSTASH (rv));
+	    put_str (out, T_BLESS, name, strlen (name));
+	  }
+	switch (SvTYPE (rv))
+	  {
+	  case SVt_PVAV:
+	    {
+	      AV* av = (AV*) rv;
+	      U32 n = av_len (av) + 1;
+	      out += (char) T_ARRAY;
+	      put_raw (out, n);
+	      for (U32 i = 0; i < n; i++)
+		{
+		  SV** e = av_fetch (av, i, 0);
+		  if (e)
+		    freeze (aTHX_ *e, out, depth + 1);
+		  else
+		    out += (char) T_UNDEF;
+		}
+	    }
+	    break;
+
+	  case SVt_PVHV:
+	    {
+	      HV* hv = (HV*) rv;
+	      U32 n = 0;
+	      out += (char) T_HASH;
+	      size_t at = out .size ();
+	      put_raw (out, n);
+	      hv_iterinit (hv);
+	      while (HE* he = hv_iternext (hv))
+		{
+		  STRLEN len;
+		  if (HeKLEN (he) == HEf_SVKEY)  // tied
+		    {
+		      const char* k = SvPV (HeSVKEY (he), len);
+		      put_str (out, SvUTF8 (HeSVKEY (he)) ? T_UTF8 : T_STR,
+			       k, len);
+		    }
+		  else
+		    put_str (out, HeKUTF8 (he) ? T_UTF8 : T_STR,
+			     HeKEY (he), HeKLEN (he));
+		  freeze (aTHX_ hv_iterval (hv, he), out, depth + 1);
+		  n++;
+		}
+	      memcpy (&out [at], &n, sizeof n);
+	    }
+	    break;
+
+	  case SVt_PVGV:
+	  case SVt_PVLV:
+	  case SVt_PVIO:
+	  case SVt_PVCV:
+	  case SVt_PVFM:
+#if PERL_REVISION > 5 || PERL_VERSION >= 11
+	  case SVt_REGEXP:
+#endif
+	    throw new Exception (string ("freeze: cannot copy a ")
+				 + sv_reftype (rv, 0) + " reference");
+
+	  default:
+	    out += (char) T_REF;
+	    freeze (aTHX_ rv, out, depth + 1);
+	  }
+      }
+    else if (! SvOK (sv))
+      out += (char) T_UNDEF;
+    else if (SvPOK (sv) || ! (SvIOK (sv) || SvNOK (sv)))
+      {
+	STRLEN len;
+	const char* s = SvPV_nomg (sv, len);
+	put_str (out, SvUTF8 (sv) ? T_UTF8 : T_STR, s, len);
+      }
+    else if (SvIOK (sv))
+      {
+	out += (char) (SvIsUV (sv) ? T_UV : T_IV);
+	put_raw (out, SvIVX (sv));
+      }
+    else
+      {
+	out += (char) T_NV;
+	put_raw (out, SvNVX (sv));
+      }
+  }
+
+  SV*
+  thaw (pTHX_ const char*& p, const char* end)
+  {
+    need (p, end, 1);
+    switch (*p++)
+      {
+      case T_UNDEF:
+	return newSV (0);
+      case T_IV:
+	return newSViv (get_raw<IV> (p, end));
+      case T_UV:
+	return newSVuv (get_raw<UV> (p, end));
+      case T_NV:
+	return newSVnv (get_raw<NV> (p, end));
+
+      case T_STR:
+      case T_UTF8:
+	{
+	  bool utf8 = p [-1] == T_UTF8;
+	  size_t len = get_len (p, end);
+	  need (p, end, len);
+	  SV* sv = newSVpvn (p, len);
+	  if (utf8)
+	    SvUTF8_on (sv);
+	  p += len;
+	  return sv;
+	}
+
+      case T_ARRAY:
+	{
+	  U32 n = get_raw<U32> (p, end);
+	  AV* av = newAV ();
+	  Scalar ret (newRV_noinc ((SV*) av));
+	  if (n)
+	    av_extend (av, n - 1);
+	  for (U32 i = 0; i < n; i++)
+	    av_push (av, thaw (aTHX_ p, end));
+	  return ret .release ();
+	}
+
+      case T_HASH:
+	{
+	  U32 n = get_raw<U32> (p, end);
+	  HV* hv = newHV ();
+	  Scalar ret (newRV_noinc ((SV*) hv));
+	  for (U32 i = 0; i < n; i++)
+	    {
+	      need (p, end, 1);
+	      bool utf8 = *p++ == T_UTF8;
+	      I32 len = get_len (p, end);
+	      need (p, end, len);
+	      const char* key = p;
+	      p += len;
+	      hv_store (hv, key, utf8 ? -len : len, thaw (aTHX_ p, end), 0);
+	    }
+	  return ret .release ();
+	}
+
+      case T_REF:
+	return newRV_noinc (thaw (aTHX_ p, end));
+
+      case T_BLESS:
+	{
+	  size_t len = get_len (p, end);
+	  need (p, end, len);
+	  HV* stash = gv_stashpvn (p, len, GV_ADD);
+	  p += len;
+	  Scalar ret (thaw (aTHX_ p, end));
+	  sv_bless (ret .get_imp (), stash);
+	  return ret .release ();
+	}
+      }
+    throw new Exception ("thaw: bad type");
+  }
+
+
+  // The pool.  Workers take jobs from one queue under one lock; a job
+  // is a chunk of items or, for eval_each, code for one worker.  The
+  // calling thread freezes chunks ahead of the workers and thaws the
+  // results in order as they finish.
+
+  struct Pool_job
+  {
+    int worker;            // the worker to run it, or -1 for any
+    const string* code;    // a sub for a map, otherwise code to eval
+    unsigned long gen;     // which map, or 0 for eval_each
+    Pool_fn fn;            // native work, if set
+    void* arg;
+    size_t items;
+    string in;
+    string out;
+    string error;
+    unsigned long long ns;
+    bool done;
+  };
+
+  struct Pool_imp
+  {
+    pthread_mutex_t lock;
+    pthread_cond_t work;   // a job was queued, or stopping was set
+    pthread_cond_t done;   // a job finished, or a worker started
+    std::deque<Pool_job*> queue;
+    vector<pthread_t> threads;
+    vector<string> args;
+    unsigned started;
+    string init_error;
+    bool stopping;
+    unsigned long gen;
+    unsigned long long chunk_ns;
+    size_t chunk;
+  };
+
+  // Perl keeps some state across all interpreters, so they are made
+  // and destroyed one at a time.
+  static pthread_mutex_t construct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  static inline unsigned long long
+  now_ns ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  static Pool_job*
+  take (Pool_imp* pool, int id)
+  {
+    for (std::deque<Pool_job*>::iterator it = pool->queue .begin ();
+	 it != pool->queue .end (); ++it)
+      if ((*it)->worker < 0 || (*it)->worker == id)
+	{
+	  Pool_job* job = *it;
+	  pool->queue .erase (it);
+	  return job;
+	}
+    return 0;
+  }
+
+  // Run the sub CV on one frozen item, with the item in $_ and $_[0],
+  // and append its results to OUT.
+  static bool
+  map_item (pTHX_ SV* cv, const char*& p, const char* end, string& out,
+	    string& error)
+  {
+    dSP;
+    int count = 0;
+    bool ok = true;
+
+    ENTER;
+    SAVETMPS;
+    try
+      {
+	SV* item = sv_2mortal (thaw (aTHX_ p, end));
+	SAVESPTR (GvSV (PL_defgv));
+	GvSV (PL_defgv) = item;
+	PUSHMARK (SP);
+	XPUSHs (item);
+	PUTBACK;
+	count = call_sv (cv, G_ARRAY | G_EVAL);
+	SPAGAIN;
+	if (SvTRUE (ERRSV))
+	  {
+	    error = SvPV_nolen (ERRSV);
+	    ok = false;
+	  }
+	else
+	  {
+	    put_len (out, count);
+	    for (int i = count - 1; i >= 0; i--)
+	      freeze (aTHX_ SP [-i], out, 0);
+	  }
+      }
+    catch (Exception* e)
+      {
+	error = e->what ();
+	delete e;
+	ok = false;
+      }
+    SPAGAIN;
+    SP -= count;
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+    return ok;
+  }
+
+  static void
+  run_job (pTHX_ Pool_job* job, SV*& cv, unsigned long& gen,
+	   const Interpreter& interp, int id)
+  {
+    if (job->fn)
+      {
+	try
+	  {
+	    job->fn (interp, job->arg, id);
+	  }
+	catch (Exception* e)
+	  {
+	    job->error = e->what ();
+	    delete e;
+	  }
+	return;
+      }
+    if (job->gen == 0)
+      {
+	ENTER;
+	SAVETMPS;
+	eval_pv (job->code->c_str (), FALSE);
+	if (SvTRUE (ERRSV))
+	  job->error = SvPV_nolen (ERRSV);
+	FREETMPS;
+	LEAVE;
+	return;
+      }
+
+    // Compile the sub once per map.
+    if (gen != job->gen)
+      {
+	if (cv)
+	  SvREFCNT_dec (cv);
+	cv = 0;
+	gen = job->gen;
+	ENTER;
+	SAVETMPS;
+	SV* sub = eval_pv (job->code->c_str (), FALSE);
+	if (SvROK (sub) && SvTYPE (SvRV (sub)) == SVt_PVCV)
+	  cv = SvREFCNT_inc (SvRV (sub));
+	FREETMPS;
+	LEAVE;
+      }
+    if (! cv)
+      {
+	job->error = SvTRUE (ERRSV) ? SvPV_nolen (ERRSV)
+	  : "parallel_map: code does not return a code reference";
+	return;
+      }
+
+    unsigned long long t0 = now_ns ();
+    const char* p = job->in .data ();
+    const char* end = p + job->in .size ();
+    for (size_t i = 0; i < job->items; i++)
+      if (! map_item (aTHX_ cv, p, end, job->out, job->error))
+	break;
+    job->ns = now_ns () - t0;
+  }
+
+  struct Worker_start
+  {
+    Pool_imp* pool;
+    int id;
+  };
+
+  static void*
+  worker_main (void* arg)
+  {
+    Pool_imp* pool = ((Worker_start*) arg)->pool;
+    int id = ((Worker_start*) arg)->id;
+    delete (Worker_start*) arg;
+
+    Interpreter* interp = 0;
+    string error;
+    pthread_mutex_lock (&construct_lock);
+    try
+      {
+	interp = pool->args .empty () ? new Interpreter
+	  : new Interpreter (pool->args);
+      }
+    catch (Init_Exception* e)
+      {
+	error = e->what ();
+	delete e;
+      }
+    pthread_mutex_unlock (&construct_lock);
+
+    pthread_mutex_lock (&pool->lock);
+    pool->started++;
+    if (! interp && pool->init_error .empty ())
+      pool->init_error = error;
+    pthread_cond_broadcast (&pool->done);
+    pthread_mutex_unlock (&pool->lock);
+    if (! interp)
+      return 0;
+
+    dTHX;
+    SV* cv = 0;
+    unsigned long gen = 0;
+    for (;;)
+      {
+	pthread_mutex_lock (&pool->lock);
+	Pool_job* job;
+	while (! (job = take (pool, id)) && ! pool->stopping)
+	  pthread_cond_wait (&pool->work, &pool->lock);
+	pthread_mutex_unlock (&pool->lock);
+	if (! job)
+	  break;
+
+	run_job (aTHX_ job, cv, gen, *interp, id);
+
+	pthread_mutex_lock (&pool->lock);
+	job->done = true;
+	pthread_cond_broadcast (&pool->done);
+	pthread_mutex_unlock (&pool->lock);
+      }
+
+    if (cv)
+      SvREFCNT_dec (cv);
+    pthread_mutex_lock (&construct_lock);
+    delete interp;
+    pthread_mutex_unlock (&construct_lock);
+    return 0;
+  }
+
+  static void
+  start (Pool_imp* pool, unsigned threads)
+  {
+    pthread_mutex_init (&pool->lock, 0);
+    pthread_cond_init (&pool->work, 0);
+    pthread_cond_init (&pool->done, 0);
+    pool->started = 0;
+    pool->stopping = false;
+    pool->gen = 0;
+    pool->chunk_ns = 2000000;
+    pool->chunk = 0;
+
+    for (unsigned i = 0; i < threads; i++)
+      {
+	Worker_start* w = new Worker_start;
+	w->pool = pool;
+	w->id = i;
+	pthread_t t;
+	if (pthread_create (&t, 0, worker_main, w) != 0)
+	  {
+	    delete w;
+	    break;
+	  }
+	pool->threads .push_back (t);
+      }
+
+    pthread_mutex_lock (&pool->lock);
+    while (pool->started < pool->threads .size ())
+      pthread_cond_wait (&pool->done, &pool->lock);
+    pthread_mutex_unlock (&pool->lock);
+  }
+
+  static void
+  stop (Pool_imp* pool)
+  {
+    pthread_mutex_lock (&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast (&pool->work);
+    pthread_mutex_unlock (&pool->lock);
+    for (size_t i = 0; i < pool->threads .size (); i++)
+      pthread_join (pool->threads [i], 0);
+    pthread_cond_destroy (&pool->work);
+    pthread_cond_destroy (&pool->done);
+    pthread_mutex_destroy (&pool->lock);
+  }
+
+  static void
+  check_started (Pool_imp* pool, unsigned threads)
+  {
+    string error = pool->init_error;
+    if (threads == 0)
+      error = "no threads";
+    else if (error .empty () && pool->threads .size () < threads)
+      error = "cannot create thread";
+    if (! error .empty ())
+      {
+	stop (pool);
+	delete pool;
+	throw new Exception ("Pool: " + error);
+      }
+  }
+
+  Pool::Pool (unsigned threads) : imp (new Pool_imp)
+  {
+    start (imp, threads);
+    check_started (imp, threads);
+  }
+
+  Pool::Pool (unsigned threads, const vector<string>& args)
+    : imp (new Pool_imp)
+  {
+    imp->args = args;
+    start (imp, threads);
+    check_started (imp, threads);
+  }
+
+  Pool::~Pool ()
+  {
+    stop (imp);
+    delete imp;
+  }
+
+  unsigned
+  Pool::size () const
+  {
+    return imp->threads .size ();
+  }
+
+  void
+  Pool::chunk_time (unsigned long ns)
+  {
+    imp->chunk_ns = ns ? ns : 1;
+  }
+
+  size_t
+  Pool::chunk_size () const
+  {
+    return imp->chunk;
+  }
+
+  static void
+  wait_for (Pool_imp* pool, Pool_job* job)
+  {
+    pthread_mutex_lock (&pool->lock);
+    while (! job->done)
+      pthread_cond_wait (&pool->done, &pool->lock);
+    pthread_mutex_unlock (&pool->lock);
+  }
+
+  static void
+  submit (Pool_imp* pool, Pool_job* job)
+  {
+    pthread_mutex_lock (&pool->lock);
+    pool->queue .push_back (job);
+    pthread_cond_broadcast (&pool->work);
+    pthread_mutex_unlock (&pool->lock);
+  }
+
+  static Pool_job*
+  new_job (int worker, const string* code, unsigned long gen)
+  {
+    Pool_job* job = new Pool_job;
+    job->worker = worker;
+    job->code = code;
+    job->gen = gen;
+    job->fn = 0;
+    job->arg = 0;
+    job->items = 0;
+    job->ns = 0;
+    job->done = false;
+    return job;
+  }
+
+  // Wait for JOBS and free them, then throw the first error.
+  static void
+  finish (Pool_imp* pool, vector<Pool_job*>& jobs)
+  {
+    string error;
+    for (size_t i = 0; i < jobs .size (); i++)
+      {
+	wait_for (pool, jobs [i]);
+	if (error .empty ())
+	  error = jobs [i]->error;
+	delete jobs [i];
+      }
+    if (! error .empty ())
+      throw new Exception (error);
+  }
+
+  void
+  Pool::eval_each (const string& code)
+  {
+    vector<Pool_job*> jobs;
+    for (unsigned i = 0; i < size (); i++)
+      {
+	jobs .push_back (new_job (i, &code, 0));
+	submit (imp, jobs .back ());
+      }
+    finish (imp, jobs);
+  }
+
+  void
+  pool_each (Pool_imp* pool, Pool_fn fn, void* arg)
+  {
+    vector<Pool_job*> jobs;
+    for (unsigned i = 0; i < pool->threads .size (); i++)
+      {
+	jobs .push_back (new_job (i, 0, 0));
+	jobs .back ()->fn = fn;
+	jobs .back ()->arg = arg;
+	submit (pool, jobs .back ());
+      }
+    finish (pool, jobs);
+  }
+
+  void
+  pool_run (Pool_imp* pool, Pool_fn fn, void* const* args, size_t n)
+  {
+    vector<Pool_job*> jobs;
+    for (size_t i = 0; i < n; i++)
+      {
+	jobs .push_back (new_job (-1, 0, 0));
+	jobs .back ()->fn = fn;
+	jobs .back ()->arg = args [i];
+	submit (pool, jobs .back ());
+      }
+    finish (pool, jobs);
+  }
+
+  // Size the next chunk to take about chunk_ns at the cost per item
+  // measured so far, but keep at least four chunks per thread for
+  // what remains, so that threads finish together.
+  static size_t
+  next_chunk (Pool_imp* pool, unsigned long long ns, size_t items,
+	      size_t remaining)
+  {
+    size_t n;
+    if (items == 0)
+      n = 16;
+    else
+      {
+	unsigned long long per_item = ns / items;
+	n = per_item ? pool->chunk_ns / per_item : 65536;
+      }
+    size_t share = remaining / (pool->threads .size () * 4);
+    if (n > share)
+      n = share;
+    if (n > 65536)
+      n = 65536;
+    return n ? n : 1;
+  }
+
+  Arrayref
+  parallel_map (const Arrayref& input, const string& code, Pool& pool)
+  {
+    dTHX;
+    Pool_imp* imp = pool.imp;
+    AV* in = (AV*) SvRV (input .get_imp ());
+    size_t n = av_len (in) + 1;
+    AV* out = newAV ();
+    Arrayref ret (newRV_noinc ((SV*) out), false);
+
+    pthread_mutex_lock (&imp->lock);
+    unsigned long gen = ++imp->gen;
+    pthread_mutex_unlock (&imp->lock);
+    imp->chunk = 0;
+
+    std::deque<Pool_job*> running;
+    size_t next = 0;
+    size_t max_running = imp->threads .size () * 2;
+    unsigned long long ns = 0;
+    size_t measured = 0;
+    Exception* error = 0;
+
+    while (! running .empty () || (next < n && ! error))
+      {
+	// Keep the workers fed.
+	while (next < n && ! error && running .size () < max_running)
+	  {
+	    Pool_job* job = new_job (-1, &code, gen);
+	    size_t chunk = next_chunk (imp, ns, measured, n - next);
+	    if (chunk > imp->chunk)
+	      imp->chunk = chunk;
+	    try
+	      {
+		for (; job->items < chunk && next < n;
+		     job->items++, next++)
+		  {
+		    SV** e = av_fetch (in, next, 0);
+		    if (e)
+		      freeze (aTHX_ *e, job->in, 0);
+		    else
+		      job->in += (char) T_UNDEF;
+		  }
+	      }
+	    catch (Exception* e)
+	      {
+		error = e;
+		delete job;
+		break;
+	      }
+	    running .push_back (job);
+	    submit (imp, job);
+	  }
+	if (running .empty ())
+	  break;
+
+	// Merge the oldest chunk.
+	Pool_job* job = running .front ();
+	running .pop_front ();
+	wait_for (imp, job);
+	ns += job->ns;
+	measured += job->items;
+	if (! job->error .empty () && ! error)
+	  error = new Exception (job->error);
+	try
+	  {
+	    const char* p = job->out .data ();
+	    const char* end = p + job->out .size ();
+	    while (! error && p < end)
+	      for (size_t k = get_len (p, end); k > 0; k--)
+		av_push (out, thaw (aTHX_ p, end));
+	  }
+	catch (Exception* e)
+	  {
+	    error = e;
+	  }
+	delete job;
+      }
+
+    if (error)
+      throw error;
+    return ret;
+  }
+
+}
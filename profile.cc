@@ -0,0 +1,487 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+#include <pthread.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+// Each thread writes only its own counters, so updates need no
+// read-modify-write instructions; relaxed stores just keep snapshot()
+// from seeing torn values.  A slot's hash is published last, with
+// release semantics, so readers see its name once they see the hash.
+#ifdef __ATOMIC_RELAXED
+#  define PROF_GET(x) __atomic_load_n (&(x), __ATOMIC_RELAXED)
+#  define PROF_SET(x, v) __atomic_store_n (&(x), (v), __ATOMIC_RELAXED)
+#  define PROF_ACQUIRE(x) __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#  define PROF_PUBLISH(x, v) __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+#else  // XXX assume aligned word accesses are atomic.
+#  define PROF_GET(x) (x)
+#  define PROF_SET(x, v) ((x) = (v))
+#  define PROF_ACQUIRE(x) (x)
+#  define PROF_PUBLISH(x, v) ((x) = (v))
+#endif
+#define PROF_ADD(x, n) PROF_SET (x, (x) + (n))
+
+// Where available, time with the cycle counter, which costs a fraction
+// of a clock_gettime call.
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#  define PROF_TSC 1
+#endif
+
+
+namespace Pickle
+{
+
+  bool profiling;
+
+  static const char* const kind_names [] = {
+    "call_function", "call_method", "eval_string", "xsub"
+  };
+
+  enum { SLOTS = 512, MAX_DEPTH = 128, NAME_LEN = 96 };
+
+  struct Slot
+  {
+    unsigned long hash;  // 0 if the slot is free
+    const void* id;      // the CV, or 0 if keyed by name
+    int kind;
+    size_t name_len;
+    char name [NAME_LEN];
+    unsigned long calls;
+    unsigned long long total_ns;
+    unsigned long long self_ns;
+    unsigned long histogram [Profiler::BUCKETS];
+  };
+
+  struct Frame
+  {
+    Slot* slot;
+    unsigned long long start;     // in ticks
+    unsigned long long children;  // in nanoseconds
+  };
+
+  // One thread's counters.  The overflow slot collects targets that
+  // do not fit in the others.  Tables are never freed, so counts from
+  // threads that have exited still appear in snapshots.
+  struct Table
+  {
+    Slot slots [SLOTS + 1];
+    Frame frames [MAX_DEPTH];
+    int depth;
+    Table* next;
+  };
+
+  static __thread Table* my_table;
+  static Table* all_tables;
+  static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  static inline unsigned long long
+  now_ns ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+#if PROF_TSC
+  // Nanoseconds per tick, times 2**16.
+  static unsigned long long tick_scale;
+
+  static inline unsigned long long
+  ticks ()
+  {
+    return __builtin_ia32_rdtsc ();
+  }
+
+  static inline unsigned long long
+  ticks_to_ns (unsigned long long t)
+  {
+    return (t * tick_scale) >> 16;
+  }
+
+  // Time the cycle counter against the system clock for 2ms.
+  static void
+  calibrate ()
+  {
+    if (tick_scale)
+      return;
+    unsigned long long n0 = now_ns (), t0 = ticks ();
+    unsigned long long n1, t1;
+    do
+      n1 = now_ns (), t1 = ticks ();
+    while (n1 - n0 < 2000000);
+    tick_scale = ((n1 - n0) << 16) / (t1 - t0);
+  }
+#else
+#  define ticks now_ns
+#  define ticks_to_ns(t) (t)
+#  define calibrate()
+#endif
+
+  static inline int
+  bucket (unsigned long long ns)
+  {
+#ifdef __GNUC__
+    int b = 63 - __builtin_clzll (ns | 1);
+#else
+    int b = 0;
+    while (ns >>= 1)
+      b++;
+#endif
+    return b < Profiler::BUCKETS ? b : Profiler::BUCKETS - 1;
+  }
+
+  static Table*
+  table ()
+  {
+    Table* t = my_table;
+    if (t)
+      return t;
+
+    t = (Table*) calloc (1, sizeof *t);
+    if (! t)
+      return 0;
+    Slot* other = &t->slots [SLOTS];
+    other->hash = 1;
+    other->name_len = strlen ("(other)");
+    memcpy (other->name, "(other)", other->name_len + 1);
+
+    pthread_mutex_lock (&tables_lock);
+    t->next = all_tables;
+    all_tables = t;
+    pthread_mutex_unlock (&tables_lock);
+    return my_table = t;
+  }
+
+  // Return the slot for a target, or a free slot for the caller to
+  // fill, or the overflow slot.
+  static Slot*
+  find (Table* t, unsigned long hash, int kind, const void* id,
+	const char* name, size_t len)
+  {
+    size_t i = hash & (SLOTS - 1);
+    for (size_t n = 0; n < SLOTS; n++, i = (i + 1) & (SLOTS - 1))
+      {
+	Slot* s = &t->slots [i];
+	if (s->hash == 0)
+	  return s;
+	if (s->hash == hash && s->kind == kind && s->id == id
+	    && (id || (s->name_len == len
+		       && memcmp (s->name, name, len) == 0)))
+	  return s;
+      }
+    return &t->slots [SLOTS];
+  }
+
+  static void
+  fill (Slot* s, unsigned long hash, int kind, const void* id,
+	const char* name, size_t len)
+  {
+    s->kind = kind;
+    s->id = id;
+    s->name_len = len;
+    memcpy (s->name, name, len);
+    s->name [len] = '\0';
+    PROF_PUBLISH (s->hash, hash);
+  }
+
+  // Mix in the name a word at a time; names are usually short, so
+  // this beats a bytewise hash by several nanoseconds per call.
+  static inline unsigned long
+  hash_name (int kind, const char* name, size_t len)
+  {
+    const unsigned long long k = 0x9E3779B97F4A7C15ULL;
+    unsigned long long h = (len + kind) * k;
+    unsigned long long w;
+    size_t i = 0;
+    for (; i + sizeof w <= len; i += sizeof w)
+      {
+	memcpy (&w, name + i, sizeof w);
+	h = (h ^ w) * k;
+	h ^= h >> 32;
+      }
+    // The tail goes in bytewise: a memcpy of variable length is a
+    // library call, and costs more than the loop.
+    w = 0;
+    for (; i < len; i++)
+      w = (w << 8) | (unsigned char) name [i];
+    h = (h ^ w) * k;
+    h ^= h >> 32;
+    unsigned long ret = h;
+    return ret > 1 ? ret : ret + 2;
+  }
+
+  static int
+  push (Table* t, Slot* s)
+  {
+    if (t->depth >= MAX_DEPTH)
+      return -1;
+    Frame& f = t->frames [t->depth];
+    f.slot = s;
+    f.children = 0;
+    f.start = ticks ();
+    return t->depth++;
+  }
+
+  // Evaluated code is named by its first line, all other targets by
+  // their full name, truncated to fit a slot.
+  int
+  prof_enter (Prof_kind kind, const char* name, size_t len)
+  {
+    Table* t = table ();
+    if (! t)
+      return -1;
+
+    if (kind == PROF_EVAL)
+      {
+	const char* nl = (const char*) memchr (name, '\n', len);
+	if (nl)
+	  len = nl - name;
+      }
+    if (len > NAME_LEN - 1)
+      len = NAME_LEN - 1;
+
+    unsigned long hash = hash_name (kind, name, len);
+
+    Slot* s = find (t, hash, kind, 0, name, len);
+    if (s->hash == 0)
+      fill (s, hash, kind, 0, name, len);
+    return push (t, s);
+  }
+
+  const char*
+  sub_name (pTHX_ SV* target, char* buf, size_t size)
+  {
+    if (SvROK (target))
+      target = SvRV (target);
+    if (SvTYPE (target) != SVt_PVCV)
+      return SvPV_nolen (target);
+
+    GV* gv = CvGV ((CV*) target);
+    HV* stash = gv ? GvSTASH (gv) : 0;
+    const char* pkg = stash ? HvNAME (stash) : 0;
+    snprintf (buf, size, "%s::%s", pkg ? pkg : "main",
+	      gv ? GvNAME (gv) : "__ANON__");
+    return buf;
+  }
+
+  // Subs are identified by their CV, so a call costs no string work.
+  // XXX A CV freed and reallocated keeps the old name.
+  int
+  prof_enter (pTHX_ Prof_kind kind, SV* target)
+  {
+    if (SvROK (target))
+      target = SvRV (target);
+    if (SvTYPE (target) != SVt_PVCV)
+      {
+	STRLEN len;
+	const char* name = SvPV (target, len);
+	return prof_enter (kind, name, len);
+      }
+
+    Table* t = table ();
+    if (! t)
+      return -1;
+
+    unsigned long hash = ((unsigned long) target >> 4) * 2654435761UL + kind;
+    if (hash <= 1)
+      hash += 2;
+
+    Slot* s = find (t, hash, kind, target, 0, 0);
+    if (s->hash == 0)
+      {
+	char name [NAME_LEN];
+	sub_name (aTHX_ target, name, sizeof name);
+	fill (s, hash, kind, target, name, strlen (name));
+      }
+    return push (t, s);
+  }
+
+  // Frames abandoned by a croak are closed along with the first
+  // enclosing frame that does finish, which absorbs their time.
+  void
+  prof_leave (int frame)
+  {
+    unsigned long long end = ticks ();
+    Table* t = my_table;
+    if (frame >= t->depth)
+      return;
+
+    Frame& f = t->frames [frame];
+    unsigned long long elapsed = ticks_to_ns (end - f.start);
+    Slot* s = f.slot;
+    PROF_ADD (s->calls, 1);
+    PROF_ADD (s->total_ns, elapsed);
+    PROF_ADD (s->self_ns, elapsed > f.children ? elapsed - f.children : 0);
+    PROF_ADD (s->histogram [bucket (elapsed)], 1);
+
+    t->depth = frame;
+    if (frame > 0)
+      t->frames [frame - 1] .children += elapsed;
+  }
+
+  void
+  Profiler::enable (bool on)
+  {
+    if (on)
+      calibrate ();
+    profiling = on;
+  }
+
+  bool
+  Profiler::enabled ()
+  {
+    return profiling;
+  }
+
+  // XXX Counts a thread adds while this runs may survive the reset.
+  void
+  Profiler::reset ()
+  {
+    pthread_mutex_lock (&tables_lock);
+    for (Table* t = all_tables; t; t = t->next)
+      for (int i = 0; i <= SLOTS; i++)
+	{
+	  Slot* s = &t->slots [i];
+	  PROF_SET (s->calls, 0);
+	  PROF_SET (s->total_ns, 0);
+	  PROF_SET (s->self_ns, 0);
+	  for (int b = 0; b < BUCKETS; b++)
+	    PROF_SET (s->histogram [b], 0);
+	}
+    pthread_mutex_unlock (&tables_lock);
+  }
+
+  static bool
+  by_total (const Profiler::Entry& a, const Profiler::Entry& b)
+  {
+    return a.total_ns > b.total_ns;
+  }
+
+  vector<Profiler::Entry>
+  Profiler::snapshot ()
+  {
+    map<pair<int, string>, Entry> sums;
+
+    pthread_mutex_lock (&tables_lock);
+    for (Table* t = all_tables; t; t = t->next)
+      for (int i = 0; i <= SLOTS; i++)
+	{
+	  Slot* s = &t->slots [i];
+	  if (PROF_ACQUIRE (s->hash) == 0 || PROF_GET (s->calls) == 0)
+	    continue;
+
+	  pair<int, string> key (s->kind, string (s->name, s->name_len));
+	  map<pair<int, string>, Entry>::iterator it = sums .find (key);
+	  if (it == sums .end ())
+	    {
+	      Entry e;
+	      e.kind = kind_names [s->kind];
+	      e.target = key.second;
+	      e.calls = 0;
+	      e.total_ns = e.self_ns = 0;
+	      for (int b = 0; b < BUCKETS; b++)
+		e.histogram [b] = 0;
+	      it = sums .insert (make_pair (key, e)) .first;
+	    }
+	  Entry& e = it->second;
+	  e.calls += PROF_GET (s->calls);
+	  e.total_ns += PROF_GET (s->total_ns);
+	  e.self_ns += PROF_GET (s->self_ns);
+	  for (int b = 0; b < BUCKETS; b++)
+	    e.histogram [b] += PROF_GET (s->histogram [b]);
+	}
+    pthread_mutex_unlock (&tables_lock);
+
+    vector<Entry> ret;
+    for (map<pair<int, string>, Entry>::iterator it = sums .begin ();
+	 it != sums .end (); ++it)
+      ret .push_back (it->second);
+    sort (ret .begin (), ret .end (), by_total);
+    return ret;
+  }
+
+  static string
+  labels (const Profiler::Entry& e)
+  {
+    string ret ("kind=\"");
+    ret .append (e.kind) .append ("\",target=\"");
+    for (size_t i = 0; i < e.target .size (); i++)
+      switch (e.target [i])
+	{
+	case '\\': ret .append ("\\\\"); break;
+	case '"':  ret .append ("\\\""); break;
+	case '\n': ret .append ("\\n");  break;
+	default:   ret += e.target [i];  break;
+	}
+    return ret .append ("\"");
+  }
+
+  void
+  Profiler::dump (ostream& os)
+  {
+    vector<Entry> entries = snapshot ();
+    ostringstream out;
+    out .precision (9);
+
+    out << "# HELP pickle_calls_total Crossings between C++ and Perl.\n"
+	<< "# TYPE pickle_calls_total counter\n";
+    for (size_t i = 0; i < entries .size (); i++)
+      out << "pickle_calls_total{" << labels (entries [i]) << "} "
+	  << entries [i] .calls << "\n";
+
+    out << "# HELP pickle_self_seconds_total Time not spent in nested"
+      " crossings.\n"
+	<< "# TYPE pickle_self_seconds_total counter\n";
+    for (size_t i = 0; i < entries .size (); i++)
+      out << "pickle_self_seconds_total{" << labels (entries [i]) << "} "
+	  << entries [i] .self_ns * 1e-9 << "\n";
+
+    out << "# HELP pickle_call_seconds Latency of each crossing.\n"
+	<< "# TYPE pickle_call_seconds histogram\n";
+    for (size_t i = 0; i < entries .size (); i++)
+      {
+	const Entry& e = entries [i];
+	string l = labels (e);
+	unsigned long cum = 0;
+	for (int b = 0; b < BUCKETS - 1; b++)
+	  {
+	    cum += e.histogram [b];
+	    out << "pickle_call_seconds_bucket{" << l << ",le=\""
+		<< (double) (2ULL << b) * 1e-9 << "\"} " << cum << "\n";
+	  }
+	out << "pickle_call_seconds_bucket{" << l << ",le=\"+Inf\"} "
+	    << e.calls << "\n"
+	    << "pickle_call_seconds_sum{" << l << "} "
+	    << e.total_ns * 1e-9 << "\n"
+	    << "pickle_call_seconds_count{" << l << "} "
+	    << e.calls << "\n";
+      }
+    os << out .str ();
+  }
+
+}
@@ -0,0 +1,334 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+
+// Without this, XSUB.h makes aTHX the thread's current interpreter
+// rather than the Regex's own.
+#define PERL_NO_GET_CONTEXT
+#include "pickle_int.hh"
+#include <XSUB.h>
+
+namespace Pickle
+{
+
+  // pregcomp croaks on a bad pattern, so it runs in an XSUB called
+  // with G_EVAL, which catches the error as eval_string does.
+  static void
+  xs_compile (pTHX_ CV*)
+  {
+    dXSARGS;
+    if (items != 2)
+      croak ("Usage: compile (pattern, flags)");
+    REGEXP* rx = pregcomp (ST (0), (U32) SvUV (ST (1)));
+    SV* qr = newRV_noinc ((SV*) rx);
+    sv_bless (qr, gv_stashpv ("Regexp", GV_ADD));
+    ST (0) = sv_2mortal (qr);
+    XSRETURN (1);
+  }
+
+  static U32
+  regex_flags (const string& flags)
+  {
+    U32 f = 0;
+    for (size_t i = 0; i < flags .size (); i++)
+      switch (flags [i])
+	{
+	case 'i': f |= RXf_PMf_FOLD; break;
+	case 'm': f |= RXf_PMf_MULTILINE; break;
+	case 's': f |= RXf_PMf_SINGLELINE; break;
+	case 'x': f |= RXf_PMf_EXTENDED; break;
+	case 'n': f |= RXf_PMf_NOCAPTURE; break;
+	default:
+	  throw new Exception ("compile_regex: unknown flag '"
+			       + flags .substr (i, 1) + "'");
+	}
+    return f;
+  }
+
+  Regex
+  Interpreter::compile_regex (const string& pattern, const string& flags) const
+  {
+    U32 f = regex_flags (flags);
+    CV* cv = newXS (0, xs_compile, const_cast<char*> (__FILE__));
+    SV* qr = 0;
+    SV* err = 0;
+    {
+      dSP;
+      ENTER;
+      SAVETMPS;
+      save_scalar (PL_errgv);
+      PUSHMARK (SP);
+      XPUSHs (sv_2mortal (newSVpvn (pattern .data (), pattern .size ())));
+      XPUSHs (sv_2mortal (newSVuv (f)));
+      PUTBACK;
+      int n = call_sv ((SV*) cv, G_SCALAR | G_EVAL);
+      SPAGAIN;
+      if (n == 1)
+	qr = SvREFCNT_inc (POPs);
+      PUTBACK;
+      if (SvTRUE (ERRSV))
+	err = newSVsv (ERRSV);
+      FREETMPS;
+      LEAVE;
+    }
+    SvREFCNT_dec (cv);
+
+    if (err || ! qr || ! SvROK (qr))
+      {
+	if (qr)
+	  SvREFCNT_dec (qr);
+	if (err)
+	  throw new Exception (Pickle::Scalar (err));
+	throw new Exception ("compile_regex: no pattern");
+      }
+    // The subject SV's string is the caller's, so has no length to
+    // free; it is pointed at each subject only for the match.
+    SV* subject = newSV_type (SVt_PV);
+    return Regex (my_perl, Pickle::Scalar (qr), Pickle::Scalar (subject));
+  }
+
+  // Match RX against the LEN bytes at S, from offset FROM, lending
+  // them to the engine in SV.  The offsets are left in RX.
+  static inline bool
+  exec (pTHX_ REGEXP* rx, SV* sv, const char* s, size_t len, size_t from)
+  {
+    char* p = const_cast<char*> (s);
+    SvPV_set (sv, p);
+    SvCUR_set (sv, len);
+    SvPOK_only (sv);
+    I32 ok = pregexec (rx, p + from, p + len, p, 0, sv, 1);
+    SvOK_off (sv);
+    SvPV_set (sv, 0);
+    SvCUR_set (sv, 0);
+    return ok != 0;
+  }
+
+  bool
+  Regex::match (const char* s, size_t len, Match& m, size_t from) const
+  {
+    if (from > len)
+      return false;
+#ifdef PERL_IMPLICIT_CONTEXT
+    PerlInterpreter* my_perl = perl;
+#endif
+    REGEXP* rx = (REGEXP*) SvRV (re .get_imp ());
+    if (! exec (aTHX_ rx, subject .get_imp (), s, len, from))
+      return false;
+
+    const regexp_paren_pair* offs = RX_OFFS (rx);
+    unsigned n = RX_NPARENS (rx);
+    m.groups = n < (unsigned) MAX_GROUPS ? n : (unsigned) MAX_GROUPS;
+    for (unsigned g = 0; g <= m.groups; g++)
+      if (g <= RX_LASTPAREN (rx) && offs [g] .start != -1)
+	{
+	  m.starts [g] = offs [g] .start;
+	  m.ends [g] = offs [g] .end;
+	}
+      else
+	m.starts [g] = m.ends [g] = -1;
+    return true;
+  }
+
+  bool
+  Regex::match (const char* s, size_t len) const
+  {
+#ifdef PERL_IMPLICIT_CONTEXT
+    PerlInterpreter* my_perl = perl;
+#endif
+    return exec (aTHX_ (REGEXP*) SvRV (re .get_imp ()),
+		 subject .get_imp (), s, len, 0);
+  }
+
+  unsigned
+  Regex::groups () const
+  {
+    return RX_NPARENS ((REGEXP*) SvRV (re .get_imp ()));
+  }
+
+
+
+  // RegexScanner keeps a Regex per worker of its pool, compiled and
+  // freed on the worker's own thread.  A scan cuts the subjects into
+  // a few shards per thread, which workers take as they come free,
+  // and joins the shards' columns in order.
+
+  enum { SHARDS_PER_THREAD = 4 };
+
+  struct Scanner_imp
+  {
+    Pool_imp* pool;
+    string pattern;
+    string flags;
+    vector<Regex*> regexes;
+    unsigned width;
+
+    static void scan_shard (const Interpreter& i, void* arg,
+			    unsigned worker);
+  };
+
+  struct Scan_shard
+  {
+    const Scanner_imp* scanner;
+    const string* strings;
+    const char* const* data;
+    const size_t* lens;
+    size_t begin;
+    size_t end;
+    RegexScanner::Result out;
+  };
+
+  static void
+  compile_on (const Interpreter& i, void* arg, unsigned worker)
+  {
+    Scanner_imp* s = (Scanner_imp*) arg;
+    s->regexes [worker] = new Regex (i .compile_regex (s->pattern,
+							s->flags));
+  }
+
+  static void
+  free_on (const Interpreter&, void* arg, unsigned worker)
+  {
+    Scanner_imp* s = (Scanner_imp*) arg;
+    delete s->regexes [worker];
+    s->regexes [worker] = 0;
+  }
+
+  RegexScanner::RegexScanner (Pool& pool, const string& pattern,
+			      const string& flags)
+    : imp (new Scanner_imp)
+  {
+    imp->pool = pool.imp;
+    imp->pattern = pattern;
+    imp->flags = flags;
+    imp->regexes .resize (pool .size ());
+    try
+      {
+	pool_each (imp->pool, compile_on, imp);
+      }
+    catch (Exception*)
+      {
+	pool_each (imp->pool, free_on, imp);
+	delete imp;
+	throw;
+      }
+    imp->width = imp->regexes [0]->groups () + 1;
+  }
+
+  RegexScanner::~RegexScanner ()
+  {
+    pool_each (imp->pool, free_on, imp);
+    delete imp;
+  }
+
+  void
+  Scanner_imp::scan_shard (const Interpreter&, void* arg, unsigned worker)
+  {
+    Scan_shard* sh = (Scan_shard*) arg;
+    const Regex* re = sh->scanner->regexes [worker];
+    unsigned width = sh->scanner->width;
+#ifdef PERL_IMPLICIT_CONTEXT
+    PerlInterpreter* my_perl = re->perl;
+#endif
+    REGEXP* rx = (REGEXP*) SvRV (re->re .get_imp ());
+    SV* sv = re->subject .get_imp ();
+    RegexScanner::Result& out = sh->out;
+
+    for (size_t k = sh->begin; k < sh->end; k++)
+      {
+	bool ok = sh->strings
+	  ? exec (aTHX_ rx, sv, sh->strings [k] .data (),
+		  sh->strings [k] .size (), 0)
+	  : exec (aTHX_ rx, sv, sh->data [k], sh->lens [k], 0);
+	if (! ok)
+	  continue;
+	const regexp_paren_pair* offs = RX_OFFS (rx);
+	U32 last = RX_LASTPAREN (rx);
+	out.index .push_back (k);
+	for (unsigned g = 0; g < width; g++)
+	  if (g <= last && offs [g] .start != -1)
+	    {
+	      out.starts .push_back (offs [g] .start);
+	      out.ends .push_back (offs [g] .end);
+	    }
+	  else
+	    {
+	      out.starts .push_back (-1);
+	      out.ends .push_back (-1);
+	    }
+      }
+  }
+
+  static RegexScanner::Result
+  scan_all (const Scanner_imp* imp, const string* strings,
+	    const char* const* data, const size_t* lens, size_t n)
+  {
+    size_t shards = imp->regexes .size () * SHARDS_PER_THREAD;
+    if (shards > n)
+      shards = n ? n : 1;
+    vector<Scan_shard> shard (shards);
+    vector<void*> args (shards);
+    for (size_t i = 0; i < shards; i++)
+      {
+	shard [i] .scanner = imp;
+	shard [i] .strings = strings;
+	shard [i] .data = data;
+	shard [i] .lens = lens;
+	shard [i] .begin = n * i / shards;
+	shard [i] .end = n * (i + 1) / shards;
+	shard [i] .out.width = imp->width;
+	args [i] = &shard [i];
+      }
+    pool_run (imp->pool, Scanner_imp::scan_shard, &args [0], shards);
+
+    RegexScanner::Result r;
+    r.width = imp->width;
+    size_t matches = 0;
+    for (size_t i = 0; i < shards; i++)
+      matches += shard [i] .out .size ();
+    r.index .reserve (matches);
+    r.starts .reserve (matches * r.width);
+    r.ends .reserve (matches * r.width);
+    for (size_t i = 0; i < shards; i++)
+      {
+	RegexScanner::Result& o = shard [i] .out;
+	r.index .insert (r.index .end (), o.index .begin (), o.index .end ());
+	r.starts .insert (r.starts .end (), o.starts .begin (),
+			  o.starts .end ());
+	r.ends .insert (r.ends .end (), o.ends .begin (), o.ends .end ());
+      }
+    return r;
+  }
+
+  RegexScanner::Result
+  RegexScanner::scan (const vector<string>& subjects) const
+  {
+    return scan_all (imp, subjects .empty () ? 0 : &subjects [0], 0, 0,
+		     subjects .size ());
+  }
+
+  RegexScanner::Result
+  RegexScanner::scan (const char* const* data, const size_t* lens,
+		      size_t n) const
+  {
+    return scan_all (imp, 0, data, lens, n);
+  }
+
+}
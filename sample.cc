@@ -0,0 +1,397 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <map>
+#include <ostream>
+
+namespace Pickle
+{
+
+  // The signal handler only reads memory and writes into a sample
+  // allocated beforehand.  It copies names out of the interpreter
+  // rather than keeping pointers, since subs and evaluated code may be
+  // gone by the time of the dump.
+  //
+  // XXX The handler can catch the interpreter halfway through pushing
+  // a context, and then reads a stale sub from it.  Subs that fail a
+  // type check are named "?".
+
+  enum { NATIVE_DEPTH = 64, NAMES_LEN = 1024, FILE_LEN = 128, MAX_SI = 32 };
+
+  // Frames 0 and 1 of a native stack are the handler and the signal
+  // trampoline.
+  enum { SKIP = 2 };
+
+  // Perl frame names are stored outermost first, each followed by a
+  // NUL.  An empty name marks a C-level entry into Perl.
+  struct Sample
+  {
+    int done;
+    int native_depth;
+    void* native [NATIVE_DEPTH];
+    int perl_depth;
+    char names [NAMES_LEN];
+    char file [FILE_LEN];  // where Perl was, or empty
+    long line;
+  };
+
+  static Sample* buf;
+  static unsigned long capacity;
+  static unsigned long next;
+  static unsigned long n_dropped;
+  static bool running;
+  static struct sigaction old_action;
+
+  // Append the LEN bytes at S and a NUL, if there is room.
+  static bool
+  add (char*& p, char* end, const char* s, size_t len)
+  {
+    if (len + 1 > (size_t) (end - p))
+      return false;
+    for (size_t i = 0; i < len; i++)
+      p [i] = s [i] == ';' ? ':' : s [i];
+    p [len] = 0;
+    p += len + 1;
+    return true;
+  }
+
+  static bool
+  add_sub (pTHX_ char*& p, char* end, CV* cv)
+  {
+    char name [256];
+    char* n = name;
+    HV* stash = 0;
+    const char* sub = "__ANON__";
+    size_t sub_len = 8;
+
+    if (! cv || SvTYPE (cv) != SVt_PVCV)
+      return add (p, end, "?", 1);
+#ifdef CvNAMED  // Lexical subs have no glob.
+    if (CvNAMED (cv))
+      {
+	stash = CvSTASH (cv);
+	sub = HEK_KEY (CvNAME_HEK (cv));
+	sub_len = HEK_LEN (CvNAME_HEK (cv));
+      }
+    else
+#endif
+      {
+	GV* gv = CvGV (cv);
+	if (gv && SvTYPE (gv) == SVt_PVGV)
+	  {
+	    stash = GvSTASH (gv);
+	    sub = GvNAME (gv);
+	    sub_len = GvNAMELEN (gv);
+	  }
+      }
+
+    const char* pkg = stash ? HvNAME (stash) : 0;
+    size_t pkg_len = pkg ? strlen (pkg) : 0;
+    if (pkg_len + sub_len + 2 > sizeof name)
+      return add (p, end, "?", 1);
+    memcpy (n, pkg ? pkg : "main", pkg ? pkg_len : 4);
+    n += pkg ? pkg_len : 4;
+    *n++ = ':';
+    *n++ = ':';
+    memcpy (n, sub, sub_len);
+    n += sub_len;
+    return add (p, end, name, n - name);
+  }
+
+  static void
+  record_perl (Sample& s)
+  {
+    s.perl_depth = 0;
+    s.file [0] = 0;
+    s.line = 0;
+#ifdef PERL_IMPLICIT_CONTEXT
+    dTHX;
+    if (! aTHX)
+      return;
+#endif
+    if (! PL_curstackinfo)
+      return;
+
+    PERL_SI* sis [MAX_SI];
+    int n = 0;
+    for (PERL_SI* si = PL_curstackinfo; si && n < MAX_SI; si = si->si_prev)
+      sis [n++] = si;
+
+    char* p = s.names;
+    char* end = s.names + NAMES_LEN;
+    while (n-- > 0)
+      {
+	PERL_SI* si = sis [n];
+	for (I32 i = 0; i <= si->si_cxix && i <= si->si_cxmax; i++)
+	  {
+	    PERL_CONTEXT* cx = &si->si_cxstack [i];
+	    bool ok;
+	    switch (CxTYPE (cx))
+	      {
+	      case CXt_SUB:
+		ok = add_sub (aTHX_ p, end, cx->blk_sub.cv);
+		break;
+
+	      case CXt_EVAL:
+		// call_sv and eval_sv leave nowhere to return to.
+		if (cx->blk_eval.retop)
+		  ok = add (p, end, "(eval)", 6);
+		else
+		  ok = add (p, end, "", 0);
+		break;
+
+	      default:
+		continue;
+	      }
+	    if (! ok)
+	      return;
+	    s.perl_depth++;
+	  }
+      }
+
+    if (PL_curcop)
+      {
+	const char* file = CopFILE (PL_curcop);
+	size_t i = 0;
+	for (; file && file [i] && i < FILE_LEN - 1; i++)
+	  s.file [i] = file [i] == ';' ? ':' : file [i];
+	s.file [i] = 0;
+	s.line = CopLINE (PL_curcop);
+      }
+  }
+
+  static void
+  on_sigprof (int, siginfo_t*, void*)
+  {
+    int saved_errno = errno;
+    unsigned long i = __atomic_fetch_add (&next, 1, __ATOMIC_RELAXED);
+    if (i < capacity)
+      {
+	Sample& s = buf [i];
+	s.native_depth = backtrace (s.native, NATIVE_DEPTH);
+	record_perl (s);
+	__atomic_store_n (&s.done, 1, __ATOMIC_RELEASE);
+      }
+    else
+      __atomic_fetch_add (&n_dropped, 1, __ATOMIC_RELAXED);
+    errno = saved_errno;
+  }
+
+  void
+  Sampler::start (unsigned hz, unsigned long max_samples)
+  {
+    if (running)
+      stop ();
+    if (max_samples != capacity)
+      {
+	free (buf);
+	buf = (Sample*) calloc (max_samples, sizeof *buf);
+	capacity = buf ? max_samples : 0;
+	next = 0;
+	if (! buf)
+	  throw new Exception ("Sampler: out of memory");
+      }
+
+    // The first backtrace loads the unwinder, which is not safe in a
+    // signal handler.
+    void* frame;
+    backtrace (&frame, 1);
+
+    struct sigaction sa;
+    memset (&sa, 0, sizeof sa);
+    sa.sa_sigaction = on_sigprof;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset (&sa.sa_mask);
+    sigaction (SIGPROF, &sa, &old_action);
+
+    struct itimerval tv;
+    long usec = hz ? 1000000 / hz : 0;
+    tv.it_interval.tv_sec = 0;
+    tv.it_interval.tv_usec = usec > 0 ? usec : 1;
+    tv.it_value = tv.it_interval;
+    setitimer (ITIMER_PROF, &tv, 0);
+    running = true;
+  }
+
+  void
+  Sampler::stop ()
+  {
+    if (! running)
+      return;
+    struct itimerval tv;
+    memset (&tv, 0, sizeof tv);
+    setitimer (ITIMER_PROF, &tv, 0);
+    sigaction (SIGPROF, &old_action, 0);
+    running = false;
+  }
+
+  // XXX Not safe while sampling on another thread.
+  void
+  Sampler::reset ()
+  {
+    for (unsigned long i = 0; i < capacity; i++)
+      buf [i] .done = 0;
+    next = 0;
+    n_dropped = 0;
+  }
+
+  unsigned long
+  Sampler::samples ()
+  {
+    unsigned long n = __atomic_load_n (&next, __ATOMIC_RELAXED);
+    return n < capacity ? n : capacity;
+  }
+
+  unsigned long
+  Sampler::dropped ()
+  {
+    return __atomic_load_n (&n_dropped, __ATOMIC_RELAXED);
+  }
+
+  // Name the code at ADDR, which is a return address unless LEAF.
+  static const string&
+  symbol (void* addr, bool leaf, map<void*, string>& cache)
+  {
+    map<void*, string>::iterator it = cache .find (addr);
+    if (it != cache .end ())
+      return it->second;
+
+    string& name = cache [addr];
+    Dl_info info;
+    if (dladdr ((char*) addr - ! leaf, &info) && info.dli_sname)
+      {
+	int status;
+	char* d = abi::__cxa_demangle (info.dli_sname, 0, 0, &status);
+	name = d ? d : info.dli_sname;
+	free (d);
+      }
+    else if (dladdr ((char*) addr - ! leaf, &info) && info.dli_fname)
+      {
+	const char* base = strrchr (info.dli_fname, '/');
+	name = string ("[") + (base ? base + 1 : info.dli_fname) + "]";
+      }
+    else
+      name = "[unknown]";
+    for (size_t i = 0; i < name .size (); i++)
+      if (name [i] == ';')
+	name [i] = ':';
+    return name;
+  }
+
+  static bool
+  starts_with (const string& s, const char* prefix)
+  {
+    return s .compare (0, strlen (prefix), prefix) == 0;
+  }
+
+  static void
+  append (string& out, const vector<const char*>& frames)
+  {
+    for (size_t i = 0; i < frames .size (); i++)
+      out .append (";") .append (frames [i]);
+  }
+
+  // Native frames from call_function or eval_string to the next
+  // xs_entry_* are the interpreter's; the Perl frames entered there
+  // replace them.
+  static string
+  fold (const Sample& s, map<void*, string>& cache)
+  {
+    vector<vector<const char*> > segs (1);
+    const char* q = s.names;
+    for (int k = 0; k < s.perl_depth; k++, q += strlen (q) + 1)
+      if (*q)
+	segs .back () .push_back (q);
+      else
+	segs .push_back (vector<const char*> ());
+
+    string out;
+    size_t seg = 0;
+    bool in_perl = false;
+    bool perl_last = false;
+    for (int k = s.native_depth - 1; k >= SKIP; k--)
+      {
+	const string& name = symbol (s.native [k], k == SKIP, cache);
+	bool entry = starts_with (name, "Pickle::Interpreter::call_function(sv*")
+	  || starts_with (name, "Pickle::Interpreter::eval_string(");
+	bool xsub = starts_with (name, "Pickle::xs_entry_");
+
+	if ((entry || xsub) && seg == 0 && ! segs [0] .empty ())
+	  {
+	    append (out, segs [0]);
+	    segs [0] .clear ();
+	  }
+	if (in_perl && ! xsub)
+	  continue;
+
+	out .append (";") .append (name);
+	perl_last = false;
+	in_perl = false;
+	if (entry && ++seg < segs .size ())
+	  {
+	    append (out, segs [seg]);
+	    in_perl = perl_last = true;
+	  }
+      }
+
+    // Perl frames not matched with native ones go on the end.
+    for (size_t k = seg == 0 ? 0 : seg + 1; k < segs .size (); k++)
+      if (! segs [k] .empty ())
+	{
+	  append (out, segs [k]);
+	  perl_last = true;
+	}
+    if ((in_perl || perl_last) && s.file [0])
+      {
+	char line [24];
+	snprintf (line, sizeof line, ":%ld", s.line);
+	out .append (";") .append (s.file) .append (line);
+      }
+    return out .empty () ? out : out .substr (1);
+  }
+
+  void
+  Sampler::dump (ostream& os)
+  {
+    map<void*, string> cache;
+    map<string, unsigned long> stacks;
+    unsigned long n = samples ();
+    for (unsigned long i = 0; i < n; i++)
+      if (__atomic_load_n (&buf [i] .done, __ATOMIC_ACQUIRE))
+	stacks [fold (buf [i], cache)]++;
+
+    for (map<string, unsigned long>::iterator it = stacks .begin ();
+	 it != stacks .end (); ++it)
+      os << it->first << " " << it->second << "\n";
+    os .flush ();
+  }
+
+}
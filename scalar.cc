@@ -40,12 +40,6 @@ namespace Pickle
     return string (p, len);
   }
 
-  Scalar::~Scalar ()
-  {
-    dInterp;
-    SvREFCNT_dec (imp);
-  }
-
   static inline SV*
   new_scalar ()
   {
@@ -53,24 +47,27 @@ namespace Pickle
     return newSVsv (&PL_sv_undef);
   }
 
-  Scalar::Scalar () : imp (new_scalar ()) {}
+  Scalar::Scalar () : imp (new_scalar ()) { PICKLE_TRACK_NEW (this, imp); }
 
-  Scalar::Scalar (const Scalar& o) : imp (o.imp)
+  void
+  Scalar::drop (const Interpreter& i)
   {
-    dTHX;
-    SvREFCNT_inc (imp);
+    dInterpOf (i);
+    SvREFCNT_dec (imp);
+    imp = 0;
+    PICKLE_TRACK_SET (this, 0);
   }
 
-  Scalar&
-  Scalar::operator= (const Scalar& o)
+  void
+  Scalar::assign (const Interpreter& i, const Scalar& o)
   {
-    dInterp;
+    dInterpOf (i);
     SV* t;
 
     t = imp;
     imp = SvREFCNT_inc (o.imp);
+    PICKLE_TRACK_SET (this, imp);
     SvREFCNT_dec (t);
-    return *this;
   }
 
   // Not-yet-implemented value-to-interpreter mapping.
@@ -87,31 +84,88 @@ namespace Pickle
     return Interpreter::get_current ();
   }
 
+  // Classify a reference by the type of its referent.
+  static inline Scalar::Kind
+  referent_kind (SV* rv)
+  {
+    switch (SvTYPE (SvRV (rv)))
+      {
+      case SVt_PVAV: return Scalar::ARRAYREF;
+      case SVt_PVHV: return Scalar::HASHREF;  // XXX Ignoring pseudohashes.
+      case SVt_PVCV: return Scalar::CODEREF;
+      case SVt_PVGV: return Scalar::GLOBREF;  // In my book, globs are
+					      // not scalars.
+      default:       return Scalar::SCALARREF;
+      }
+  }
+
+  // Replace `sv' with the result of its dereference overloading for
+  // METH, if any.  See pp_rv2av in pp_hot.c .
+#if defined (amagic_deref_call)
+#  define DEREF_OVERLOAD(meth) (sv = amagic_deref_call (sv, CAT2 (meth, _amg)))
+#elif !defined (PERL_5005)
+   // tryAMAGICunDEREF needs `sp' and a var named `sv'.
+#  define DEREF_OVERLOAD(meth) STMT_START { djSP; tryAMAGICunDEREF (meth); } STMT_END
+#else
+#  define DEREF_OVERLOAD(meth) NOOP
+#endif
+
+#ifndef PERL_MAGIC_overload_table
+#  define PERL_MAGIC_overload_table 'c'
+#endif
+
+  // Return true if the class of object SV overloads METHOD, without
+  // calling the overload.
+  static bool
+  has_overload (pTHX_ SV* sv, int method)
+  {
+    HV* stash = SvSTASH (SvRV (sv));
+    if (! Gv_AMG (stash))
+      return false;
+    MAGIC* mg = mg_find ((SV*) stash, PERL_MAGIC_overload_table);
+    AMT* amtp = mg ? (AMT*) mg->mg_ptr : 0;
+    return amtp && AMT_AMAGIC (amtp) && amtp->table [method];
+  }
+
+  Scalar::Kind
+  Scalar::kind (bool resolve_overloads) const
+  {
+    SV* sv = imp;
+    if (! SvROK (sv))
+      return SvOK (sv) ? PLAIN : UNDEF;
+
+    if (resolve_overloads && SvAMAGIC (sv))
+      {
+	dInterp;
+	if (has_overload (aTHX_ sv, to_av_amg))
+	  return ARRAYREF;
+	if (has_overload (aTHX_ sv, to_hv_amg))
+	  return HASHREF;
+	if (has_overload (aTHX_ sv, to_sv_amg))
+	  return SCALARREF;
+	if (has_overload (aTHX_ sv, to_cv_amg))
+	  return CODEREF;
+	if (has_overload (aTHX_ sv, to_gv_amg))
+	  return GLOBREF;
+      }
+    return referent_kind (sv);
+  }
+
+  // The is_<type> methods consult overloading only for objects whose
+  // class has some, so plain references need no interpreter context.
+
   bool
   Scalar::is_scalarref () const
   {
-    dInterp;
-    djSP;  // tryAMAGICunDEREF needs `sp'.
-    // tryAMAGICunDEREF needs a var named `sv'.
     SV* sv = const_cast<SV*> (imp);
     if (! SvROK (sv))
       return false;
-
-#ifndef PERL_5005
-    // See pp_rv2sv in pp.c .
-    tryAMAGICunDEREF(to_sv);
-#endif
-
-    // XXX
-    switch (SvTYPE (SvRV (sv)))
+    if (SvAMAGIC (sv))
       {
-      case SVt_PVAV:
-      case SVt_PVHV:
-      case SVt_PVCV:
-      case SVt_PVGV:  // In my book, globs are not scalars.
-	  return false;
+	dInterp;
+	DEREF_OVERLOAD (to_sv);  // See pp_rv2sv in pp.c .
       }
-    return true;
+    return SvROK (sv) && referent_kind (sv) == SCALARREF;
   }
 
   void
@@ -124,16 +178,15 @@ namespace Pickle
   bool
   Scalar::is_arrayref () const
   {
-    dInterp;
-    djSP;  // tryAMAGICunDEREF needs `sp'.
-    SV* sv = imp;  // tryAMAGICunDEREF needs a var named `sv'.
+    SV* sv = imp;
     if (! SvROK (sv))
       return false;
-
-#ifndef PERL_5005
-    tryAMAGICunDEREF(to_av);  // See pp_rv2av in pp_hot.c .
-#endif
-    return SvTYPE (SvRV (sv)) == SVt_PVAV;
+    if (SvAMAGIC (sv))
+      {
+	dInterp;
+	DEREF_OVERLOAD (to_av);  // See pp_rv2av in pp_hot.c .
+      }
+    return SvROK (sv) && SvTYPE (SvRV (sv)) == SVt_PVAV;
   }
 
   void
@@ -146,17 +199,16 @@ namespace Pickle
   bool
   Scalar::is_hashref () const
   {
-    dInterp;
-    djSP;  // tryAMAGICunDEREF needs `sp'.
-    SV* sv = imp;  // tryAMAGICunDEREF needs a var named `sv'.
+    SV* sv = imp;
     if (! SvROK (sv))
       return false;
-
-#ifndef PERL_5005
-    tryAMAGICunDEREF(to_hv);  // See pp_rv2hv in pp_hot.c .
-#endif
+    if (SvAMAGIC (sv))
+      {
+	dInterp;
+	DEREF_OVERLOAD (to_hv);  // See pp_rv2hv in pp_hot.c .
+      }
     // XXX Ignoring pseudohashes.
-    return SvTYPE (SvRV (sv)) == SVt_PVHV;
+    return SvROK (sv) && SvTYPE (SvRV (sv)) == SVt_PVHV;
   }
 
   void
@@ -169,18 +221,16 @@ namespace Pickle
   bool
   Scalar::is_globref () const
   {
-    dInterp;
-    djSP;  // tryAMAGICunDEREF needs `sp'.
-    // tryAMAGICunDEREF needs a var named `sv'.
     SV* sv = const_cast<SV*> (imp);
     if (! SvROK (sv))
       return false;
-
-#ifndef PERL_5005
-    tryAMAGICunDEREF(to_gv);  // See pp_rv2gv in pp.c .
-#endif
+    if (SvAMAGIC (sv))
+      {
+	dInterp;
+	DEREF_OVERLOAD (to_gv);  // See pp_rv2gv in pp.c .
+      }
     // XXX Leaving out stuff about SVt_PVIO.
-    return SvTYPE (SvRV (sv)) == SVt_PVGV;
+    return SvROK (sv) && SvTYPE (SvRV (sv)) == SVt_PVGV;
   }
 
   void
@@ -197,6 +247,73 @@ namespace Pickle
     return SvROK (imp) && SvTYPE (SvRV (imp)) == SVt_PVCV;
   }
 
+  // Typed traversal.
+
+  void
+  Scalar::visit (Visitor& v) const
+  {
+    switch (kind (v.resolve_overloads))
+      {
+      case UNDEF:     v .undef (*this);                        break;
+      case PLAIN:     v .plain (*this);                        break;
+      case SCALARREF: v .scalarref ((const Scalarref&) *this); break;
+      case ARRAYREF:  v .arrayref ((const Arrayref&) *this);   break;
+      case HASHREF:   v .hashref ((const Hashref&) *this);     break;
+      case CODEREF:   v .coderef ((const Coderef&) *this);     break;
+      case GLOBREF:   v .globref ((const Globref&) *this);     break;
+      }
+  }
+
+  void
+  Visitor::scalarref (const Scalarref& r)
+  {
+    dTHX;
+    SV* sv = r.imp;
+    if (resolve_overloads && SvAMAGIC (sv))
+      DEREF_OVERLOAD (to_sv);
+    if (SvROK (sv))
+      Scalar::ref (SvRV (sv)) .visit (*this);
+  }
+
+  void
+  Visitor::arrayref (const Arrayref& a)
+  {
+    dTHX;
+    SV* sv = a.imp;
+    if (resolve_overloads && SvAMAGIC (sv))
+      DEREF_OVERLOAD (to_av);
+    if (! SvROK (sv) || SvTYPE (SvRV (sv)) != SVt_PVAV)
+      return;
+
+    AV* av = (AV*) SvRV (sv);
+    I32 last = av_len (av);
+    for (I32 i = 0; i <= last; i++)
+      {
+	SV** svp = av_fetch (av, i, 0);
+	SV* elt = svp ? *svp : &PL_sv_undef;
+	Scalar::ref (elt) .visit (*this);
+      }
+  }
+
+  void
+  Visitor::hashref (const Hashref& h)
+  {
+    dTHX;
+    SV* sv = h.imp;
+    if (resolve_overloads && SvAMAGIC (sv))
+      DEREF_OVERLOAD (to_hv);
+    if (! SvROK (sv) || SvTYPE (SvRV (sv)) != SVt_PVHV)
+      return;
+
+    HV* hv = (HV*) SvRV (sv);
+    hv_iterinit (hv);
+    while (HE* he = hv_iternext (hv))
+      {
+	SV* val = hv_iterval (hv, he);
+	Scalar::ref (val) .visit (*this);
+      }
+  }
+
   void
   Scalar::check_coderef () const
   {
@@ -207,56 +324,63 @@ namespace Pickle
   // Conversion from native C++ types to scalar.
 
   static inline SV* make (unsigned long i) { dTHX; return newSVnv (i); }
-  Scalar::Scalar (unsigned long i) : imp (make (i)) {}
+  Scalar::Scalar (unsigned long i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (long i) { dTHX; return newSViv (i); }
-  Scalar::Scalar (long i) : imp (make (i)) {}
+  Scalar::Scalar (long i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (unsigned int i) { dTHX; return newSVnv (i); }
-  Scalar::Scalar (unsigned int i) : imp (make (i)) {}
+  Scalar::Scalar (unsigned int i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (int i) { dTHX; return newSViv (i); }
-  Scalar::Scalar (int i) : imp (make (i)) {}
+  Scalar::Scalar (int i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (unsigned short i) { dTHX; return newSVnv (i); }
-  Scalar::Scalar (unsigned short i) : imp (make (i)) {}
+  Scalar::Scalar (unsigned short i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (short i) { dTHX; return newSViv (i); }
-  Scalar::Scalar (short i) : imp (make (i)) {}
+  Scalar::Scalar (short i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (unsigned char i) { dTHX; return newSVnv (i); }
-  Scalar::Scalar (unsigned char i) : imp (make (i)) {}
+  Scalar::Scalar (unsigned char i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (signed char i) { dTHX; return newSViv (i); }
-  Scalar::Scalar (signed char i) : imp (make (i)) {}
+  Scalar::Scalar (signed char i) : imp (make (i))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (const string& s)
   { dTHX; return string_to_sv (aTHX_ s); }
-  Scalar::Scalar (const string& s) : imp (make (s)) {}
+  Scalar::Scalar (const string& s) : imp (make (s))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (const char* s)
   { dTHX; return newSVpv (const_cast<char*> (s), 0); }
-  Scalar::Scalar (const char* s) : imp (make (s)) {}
+  Scalar::Scalar (const char* s) : imp (make (s))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (const char* s, unsigned long len)
   { dTHX; return newSVpvn (const_cast<char*> (s), (STRLEN) len); }
-  Scalar::Scalar (const char* s, unsigned long len) : imp (make (s, len)) {}
+  Scalar::Scalar (const char* s, unsigned long len) : imp (make (s, len))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (double d) { dTHX; return newSVnv (d); }
-  Scalar::Scalar (double d) : imp (make (d)) {}
+  Scalar::Scalar (double d) : imp (make (d))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (float d) { dTHX; return newSVnv (d); }
-  Scalar::Scalar (float d) : imp (make (d)) {}
+  Scalar::Scalar (float d) : imp (make (d))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   static inline SV* make (bool b) { dTHX; return b ? &PL_sv_yes : &PL_sv_no; }
-  Scalar::Scalar (bool b) : imp (make (b)) {}
-
-  bool
-  Scalar::defined () const
-  {
-    dInterp;
-    return SvOK (imp);
-  }
+  Scalar::Scalar (bool b) : imp (make (b))
+  { PICKLE_TRACK_NEW (this, imp); }
 
   Scalar
   Scalar::ref () const
@@ -285,30 +409,12 @@ namespace Pickle
 
   // Conversions from scalar to basic C++ types.
 
-  unsigned long
-  Scalar::as_ulong () const
-  {
-    dInterp;
-    return SvUV (imp);
-  }
-  long
-  Scalar::as_long () const
-  {
-    dInterp;
-    return SvIV (imp);
-  }
   unsigned int
   Scalar::as_uint () const
   {
     dInterp;
     return SvUV (imp);
   }
-  int
-  Scalar::as_int () const
-  {
-    dInterp;
-    return SvIV (imp);
-  }
   unsigned short
   Scalar::as_ushort () const
   {
@@ -350,12 +456,6 @@ namespace Pickle
     return SvPV_nolen (imp);
 #endif
   }
-  double
-  Scalar::as_double () const
-  {
-    dInterp;
-    return SvNV (imp);
-  }
   float
   Scalar::as_float () const
   {
@@ -369,6 +469,21 @@ namespace Pickle
     return SvTRUE (imp);
   }
 
+  // Explicit-context conversions.
+
+  string
+  Scalar::as_string (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return sv_to_string (aTHX_ imp);
+  }
+  bool
+  Scalar::as_bool (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return SvTRUE (imp);
+  }
+
   Scalar
   Scalar::can (const string& meth) const
   {
@@ -433,6 +548,8 @@ namespace Pickle
   Scalar::call_method (const string& meth, const List& args,
 		       Context cx) const
   {
+    Prof_guard prof (PROF_METHOD, meth .data (), meth .size ());
+
     // Avoid perl_call_method because it cannot trap the no-such-method
     // error.  XXX
     {
@@ -34,14 +34,16 @@ namespace Pickle
   Scalarref::Scalarref () : Scalar (new_undef_scalarref ()) {}
 
   static inline SV*
-  lookup_scalar (const string& name)
+  lookup_scalar (const char* name, STRLEN len)
   {
     dTHX;
-    return newRV ((SV*) get_sv (const_cast<char*> (name .c_str ()), 1));
+    return newRV (GvSVn (fetch_gv (aTHX_ name, len, SVt_PV)));
   }
 
-  Scalarref::Scalarref (const string& name) : Scalar (lookup_scalar (name)) {}
-  Scalarref::Scalarref (const char* name) : Scalar (lookup_scalar (name)) {}
+  Scalarref::Scalarref (const string& name)
+    : Scalar (lookup_scalar (name .data (), name .size ())) {}
+  Scalarref::Scalarref (const char* name)
+    : Scalar (lookup_scalar (name, strlen (name))) {}
 
   Scalar
   Scalarref::fetch () const
@@ -50,6 +52,20 @@ namespace Pickle
     return newSVsv (SvRV (imp));
   }
 
+  Scalar
+  Scalarref::fetch (const Interpreter& i) const
+  {
+    dInterpOf (i);
+    return newSVsv (SvRV (imp));
+  }
+
+  Bound<Scalar>
+  Bound<Scalarref>::fetch () const
+  {
+    dInterpOf (interpreter ());
+    return Bound<Scalar> (interpreter (), newSVsv (SvRV (get_imp ())));
+  }
+
   void
   Scalarref::store (const Scalar& v)
   {
@@ -57,4 +73,11 @@ namespace Pickle
     sv_setsv (SvRV (imp), v.imp);
   }
 
+  void
+  Scalarref::store (const Interpreter& i, const Scalar& v)
+  {
+    dInterpOf (i);
+    sv_setsv (SvRV (imp), v.imp);
+  }
+
 }
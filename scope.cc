@@ -0,0 +1,152 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+#include "pickle_int.hh"
+
+
+namespace Pickle
+{
+
+  static inline PerlInterpreter*
+  current_context ()
+  {
+#ifdef PERL_IMPLICIT_CONTEXT
+    dTHX;
+    return aTHX;
+#else
+    return 0;
+#endif
+  }
+
+  Scope::Scope ()
+    : interpreter_imp (current_context ()), next (0),
+      n_allocated (0), n_recycled (0)
+  {
+    ENTER;
+    SAVETMPS;
+  }
+
+  Scope::Scope (const Interpreter& interp)
+    : interpreter_imp (interp.interpreter_imp), next (0),
+      n_allocated (0), n_recycled (0)
+  {
+    ENTER;
+    SAVETMPS;
+  }
+
+  Scope::~Scope ()
+  {
+    FREETMPS;
+    LEAVE;
+  }
+
+  // Return the SV at the recycling cursor if nothing but the mortal
+  // stack refers to it, else 0.
+  SV*
+  Scope::reusable ()
+  {
+    if (next >= temps .size ())
+      return 0;
+    SV* sv = temps [next];
+    if (SvREFCNT (sv) != 1 || SvMAGICAL (sv) || SvREADONLY (sv))
+      return 0;
+    return sv;
+  }
+
+  const Scalar&
+  Scope::keep (SV* sv)
+  {
+    sv_2mortal (sv);
+    n_allocated++;
+    if (next < temps .size ())
+      temps [next] = sv;
+    else
+      temps .push_back (sv);
+    return Scalar::ref (temps [next++]);
+  }
+
+  const Scalar&
+  Scope::kept ()
+  {
+    n_recycled++;
+    return Scalar::ref (temps [next++]);
+  }
+
+  const Scalar&
+  Scope::temp (long i)
+  {
+    if (SV* sv = reusable ())
+      {
+	sv_setiv (sv, i);
+	return kept ();
+      }
+    return keep (newSViv (i));
+  }
+
+  const Scalar&
+  Scope::temp (unsigned long i)
+  {
+    if (SV* sv = reusable ())
+      {
+	sv_setuv (sv, i);
+	return kept ();
+      }
+    return keep (newSVuv (i));
+  }
+
+  const Scalar& Scope::temp (int i) { return temp ((long) i); }
+  const Scalar& Scope::temp (unsigned int i)
+  { return temp ((unsigned long) i); }
+
+  const Scalar&
+  Scope::temp (double d)
+  {
+    if (SV* sv = reusable ())
+      {
+	sv_setnv (sv, d);
+	return kept ();
+      }
+    return keep (newSVnv (d));
+  }
+
+  const Scalar&
+  Scope::temp (const char* s, unsigned long len)
+  {
+    if (SV* sv = reusable ())
+      {
+	sv_setpvn (sv, const_cast<char*> (s), len);
+	return kept ();
+      }
+    return keep (newSVpvn (const_cast<char*> (s), len));
+  }
+
+  const Scalar&
+  Scope::temp (const string& s)
+  {
+    return temp (s .data (), s .size ());
+  }
+
+  const Scalar&
+  Scope::temp (const char* s)
+  {
+    return temp (s, strlen (s));
+  }
+
+}
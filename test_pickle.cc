@@ -1,6 +1,15 @@
 #include <iostream>
+#include <map>
+#include <sstream>
 #include "math.h"
+#include <poll.h>
+#include <pthread.h>
+#include <stdexcept>
+#include <stdio.h>
 #include "pickle.hh"
+#ifdef PICKLE_RVALUE_REFS
+#  include <unordered_map>
+#endif
 
 using namespace Pickle;
 using namespace std;
@@ -34,6 +43,69 @@ main (int argc, char** real_argv)
       void test_cb ();
       test_cb ();
 
+      void test_move ();
+      test_move ();
+
+      void test_bound ();
+      test_bound ();
+
+      void test_scope ();
+      test_scope ();
+
+      void test_global ();
+      test_global ();
+
+      void test_visit ();
+      test_visit ();
+
+      void test_profile ();
+      test_profile ();
+
+      void test_track ();
+      test_track ();
+
+      void test_memory ();
+      test_memory ();
+
+      void test_sample ();
+      test_sample ();
+
+      void test_events ();
+      test_events ();
+
+      void test_pool ();
+      test_pool ();
+
+      void test_lock ();
+      test_lock ();
+
+      void test_async ();
+      test_async ();
+
+      void test_io ();
+      test_io ();
+
+      void test_feed ();
+      test_feed ();
+
+      void test_regex ();
+      test_regex ();
+
+      void test_pack ();
+      test_pack ();
+
+      void test_invoker ();
+      test_invoker ();
+
+      void test_bind ();
+      test_bind ();
+
+      void test_tie ();
+      test_tie ();
+
+      void test_class ();
+      test_class ();
+
       Scalar a1[] = { 1, "2.1" };
       Arrayref a (sizeof a1 / sizeof a1 [0], a1);
       cerr << "a has " << a .size () << " elements." << endl;
@@ -180,3 +252,730 @@ static List my_cb (List& args, Context cx)
 		 << int (args[0]) + int (args[1])
 		 << int (args[2]) + int (args[3]);
 }
+
+void
+test_move ()
+{
+  Scalar s ("moved");
+  Scalar_imp* sv = s .release ();
+  Scalar t;
+  t .adopt (sv);
+  cerr << "adopted: " << t .as_string () << endl;
+#ifdef PICKLE_RVALUE_REFS
+  Arrayref a;
+  a .push (std::move (t));
+  Scalar u (std::move (a));
+  cerr << "moved: " << Arrayref (u) .fetch (0) .as_string () << endl;
+#endif
+}
+
+void
+test_bound ()
+{
+  const Interpreter& i = *p;
+  eval_string ("sub Test::Bound::DESTROY { $Test::Bound::freed++ }");
+  Scalarref freed ("Test::Bound::freed");
+  Scalar n ("42.5");
+  cerr << "bound: " << n .as_int (i) << " " << n .as_double (i) << " "
+       << n .as_string (i) << " " << Scalar () .defined (i);
+  {
+    Bound<Arrayref> a (i, Arrayref ());
+    a .push (1);
+    a .push ("two");
+    a .store (3, 4);
+    cerr << " " << a .size () << " " << a .fetch (1) .as_string ()
+	 << " " << a .fetch (2) .defined (i);
+
+    Bound<Hashref> h (i, Hashref ());
+    h .store ("k", a);
+    cerr << " " << Arrayref (h .fetch ("k")) .size (i);
+
+    Bound<Scalarref> r (i, Scalarref ("Test::Bound::x"));
+    r .store (7);
+    cerr << " " << r .fetch () .as_int () << " " << Bound<Scalar> (i, 8) .as_int ();
+
+    Bound<Scalar> obj (i, eval_string ("bless [], 'Test::Bound'"));
+    Bound<Scalar> copy (obj);
+    obj = Scalar (1);
+    cerr << " " << freed .fetch (i) .as_int (i);
+    copy = obj;
+    cerr << " " << freed .fetch (i) .as_int (i) << " " << int (copy);
+    obj = eval_string ("bless [], 'Test::Bound'");
+  }
+  cerr << " " << freed .fetch (i) .as_int (i) << endl;
+}
+
+void
+test_scope ()
+{
+  Hashref h;
+  Scope scope;
+  for (int i = 0; i < 3; i++)
+    {
+      scope .recycle ();
+      h .store (scope .temp ("k"), scope .temp (i));
+    }
+  cerr << "scope: " << h .fetch ("k") .as_int () << " "
+       << scope .allocated () << " allocated "
+       << scope .recycled () << " recycled" << endl;
+}
+
+void
+test_global ()
+{
+  GlobalHandle x ("Config::x");
+  x .store (5);
+  eval_string ("sub Config::x { 'first' }");
+  cerr << "global: " << eval_string ("$Config::x") .as_int () << " "
+       << call_function (x .code ()) .as_string ();
+  eval_string ("*Config::x = \\7; no warnings; sub Config::x { 'second' }");
+  cerr << " " << x .fetch () .as_int () << " "
+       << call_function (x .code ()) .as_string () << endl;
+
+  string name ("Config::a\0b", 11);
+  p ->Scalarref (name) .store ("nul");
+  cerr << "nul name: " << Scalarref (name) .fetch () .as_string () << " "
+       << Scalarref ("Config::a") .fetch () .defined () << endl;
+}
+
+class Kind_counter : public Visitor
+{
+public:
+  int counts [Scalar::GLOBREF + 1];
+  Kind_counter (bool resolve = false) : Visitor (resolve)
+  { for (int i = 0; i <= Scalar::GLOBREF; i++) counts [i] = 0; }
+  void undef (const Scalar& s) { counts [Scalar::UNDEF]++; }
+  void plain (const Scalar& s) { counts [Scalar::PLAIN]++; }
+  void scalarref (const Scalarref& r)
+  { counts [Scalar::SCALARREF]++; Visitor::scalarref (r); }
+  void arrayref (const Arrayref& a)
+  { counts [Scalar::ARRAYREF]++; Visitor::arrayref (a); }
+  void hashref (const Hashref& h)
+  { counts [Scalar::HASHREF]++; Visitor::hashref (h); }
+  void coderef (const Coderef& c) { counts [Scalar::CODEREF]++; }
+};
+
+void
+test_visit ()
+{
+  eval_string ("package Ov; use overload '@{}' => sub { [7] }, fallback => 1;");
+  Scalar obj = eval_string ("bless {a => 1}, 'Ov'");
+  cerr << "kind: " << obj .kind () << " " << obj .kind (true);
+  Kind_counter raw, resolved (true);
+  obj .visit (raw);
+  obj .visit (resolved);
+  cerr << " " << raw .counts [Scalar::HASHREF] << raw .counts [Scalar::PLAIN]
+       << " " << resolved .counts [Scalar::ARRAYREF]
+       << resolved .counts [Scalar::PLAIN] << endl;
+
+  Kind_counter k;
+  eval_string ("[1, undef, {a => \\'x', b => [2, sub {}]}]") .visit (k);
+  cerr << "visit:";
+  for (int i = 0; i <= Scalar::GLOBREF; i++)
+    cerr << " " << k .counts [i];
+  cerr << endl;
+}
+
+static Scalar
+prof_cb (Scalar& arg)
+{
+  return call_function ("Prof::inner", List () << arg);
+}
+
+void
+test_profile ()
+{
+  eval_string ("sub Prof::inner { $_[0] + 1 } sub Prof::outer { Prof::cb ($_[0]) }");
+  define_sub ("Prof", "cb", prof_cb);
+
+  Profiler::enable ();
+  for (int i = 0; i < 3; i++)
+    call_function ("Prof::outer", List () << i);
+  Profiler::enable (false);
+  call_function ("Prof::outer", List () << 0);
+
+  vector<Profiler::Entry> v = Profiler::snapshot ();
+  for (size_t i = 0; i < v .size (); i++)
+    {
+      const Profiler::Entry& e = v [i];
+      unsigned long n = 0;
+      for (int b = 0; b < Profiler::BUCKETS; b++)
+	n += e.histogram [b];
+      cerr << "profile: " << e.kind << " " << e.target << " " << e.calls
+	   << " " << (e.self_ns <= e.total_ns) << " " << (n == e.calls)
+	   << endl;
+    }
+  Profiler::reset ();
+}
+
+void
+test_track ()
+{
+#ifdef PICKLE_TRACK
+  unsigned long n = track_live_handles (*p);
+  {
+    Scalar* s = new Scalar ("tracked");
+    Arrayref a;
+    a .push (*s);
+    cerr << "track: " << track_live_handles (*p) - n;
+    delete s;
+    cerr << " " << track_live_handles (*p) - n;
+  }
+  cerr << " " << track_live_handles (*p) - n << " "
+       << (track_live_handles () >= track_live_handles (*p)) << endl;
+
+  // Worker interpreters report only their own Scalars, not HELD.
+  Scalar held ("held");
+  Pool pool (1);
+  pool .eval_each ("1");
+#endif
+}
+
+void
+test_memory ()
+{
+  Memory_stats m = p ->memory_stats ();
+  unsigned long kinds = 0;
+  for (int k = 0; k < Memory_stats::KINDS; k++)
+    kinds += m.by_kind [k];
+  cerr << "memory: " << (m.svs > 0) << (kinds == m.svs) << m.sampled
+       << (m.total_bytes () > m.head_bytes) << endl;
+
+  Scalar big = eval_string ("[ map { 'x' x 1000 } 1 .. 10 ]");
+  Scalar shared = eval_string ("my $a = [ 'x' x 1000 ]; [ $a, $a ]");
+  cerr << "deep_size: " << (big .deep_size () > 10000)
+       << (shared .deep_size () < 2000) << endl;
+
+  Memory_stats s = p ->memory_stats (4);
+  cerr << "sampled: " << (s.sampled > 0 && s.sampled <= 1);
+  for (int i = 0; i < 3; i++)
+    {
+      s = p ->memory_stats (1000000);
+      cerr << " " << (s.sampled > 0 && s.svs > 0);
+    }
+  cerr << endl;
+}
+
+static Scalar
+sample_cb (Scalar& arg)
+{
+  double x = 0;
+  for (long i = 0; i < 100000; i++)
+    x += i * 0.5;
+  return x + arg .as_double ();
+}
+
+void
+test_sample ()
+{
+  eval_string ("sub Sample::spin { my $x = 0; $x += Sample::cb ($_) for 1 .. 10; $x }");
+  define_sub ("Sample", "cb", sample_cb);
+
+  Sampler::start (1000);
+  for (int i = 0; i < 500 && Sampler::samples () < 20; i++)
+    call_function ("Sample::spin");
+  Sampler::stop ();
+
+  ostringstream folded;
+  Sampler::dump (folded);
+  cerr << "sample: " << (Sampler::samples () > 0)
+       << (folded .str () .find ("Sample::spin") != string::npos) << endl;
+  Sampler::reset ();
+}
+
+static Scalar
+event_pair (const Interpreter& i, void* payload)
+{
+  long* n = (long*) payload;
+  Scalar ret = eval_string ("[]");
+  Arrayref (ret) .push (i, n [0]);
+  Arrayref (ret) .push (i, n [1]);
+  delete [] n;
+  return ret;
+}
+
+void
+test_events ()
+{
+  EventQueue q (4);
+  struct pollfd pfd = { q .fd (), POLLIN, 0 };
+  bool idle = poll (&pfd, 1, 0) == 0;
+
+  long* pair = new long [2];
+  pair [0] = 3;
+  pair [1] = 4;
+  q .post (7);
+  q .post (string (100, 'x'));
+  q .post ("short");
+  q .post (event_pair, pair);
+  bool full = ! q .post (1.5);
+  bool ready = poll (&pfd, 1, 0) == 1;
+
+  q .define_sub (*p, "Events", "drain");
+  Scalar n = eval_string ("my $e = Events::drain (3); scalar @$e");
+  Arrayref rest = q .drain (*p);
+  Arrayref last (rest [0]);
+  cerr << "events: " << idle << full << ready << n .as_long ()
+       << rest .size () << last [1] .as_long () << q .dropped ();
+
+  {
+    EventQueue gone;
+    gone .define_sub (*p, "Events", "gone");
+  }
+  cerr << " " << eval_string ("eval { Events::gone (); 1 } ? 'called'"
+			      " : $@ =~ /^gone: queue destroyed/ ? 'croaked'"
+			      " : $@") .as_string () << endl;
+}
+
+void
+test_pool ()
+{
+  Pool pool (3);
+  pool .eval_each ("sub Twice::run {"
+		   " my $r = shift; ($r->{n} * 2) x ($r->{n} % 2) }");
+  Arrayref in = eval_string ("[ map { bless { n => $_,"
+			     " s => \"\\x{263a}\" }, 'R' } 1 .. 1000 ]");
+  Arrayref out = parallel_map (in, "\\&Twice::run", pool);
+  Arrayref ok = parallel_map (in, "sub { ref ($_) . length ($_->{s}) }", pool);
+  cerr << "parallel_map: " << out .size () << " " << out [0] .as_long ()
+       << out [499] .as_long () << " " << ok [999] .as_string () << endl;
+
+  try
+    {
+      parallel_map (in, "sub { die \"no\\n\" if $_->{n} == 700 }", pool);
+    }
+  catch (Exception* e)
+    {
+      cerr << "parallel_map died: " << e->what ();
+      delete e;
+    }
+  static const char* const unfreezable[] = {
+    "[\\*STDOUT]", "[qr/x/]", "[sub { 1 }]", "[\\substr ('abc', 1)]"
+  };
+  cerr << "parallel_map refused:";
+  for (size_t k = 0; k < sizeof unfreezable / sizeof *unfreezable; k++)
+    try
+      {
+	parallel_map (eval_string (unfreezable [k]), "sub { 1 }", pool);
+	cerr << " copied";
+      }
+    catch (Exception* e)
+      {
+	cerr << (k ? "; " : " ") << e->what ();
+	delete e;
+      }
+  cerr << endl;
+
+  vector<string> lines;
+  for (int i = 0; i < 1000; i++)
+    lines .push_back (i % 3 ? "GET /x" + string (i % 5, 'y') + " 200"
+		      : string ("noise"));
+  RegexScanner scanner (pool, "(GET|POST) (\\S+) (\\d+)( ms)?");
+  RegexScanner::Result r = scanner .scan (lines);
+  long total = 0;
+  for (size_t k = 0; k < r .size (); k++)
+    total += r .length (k, 2);
+  cerr << "scan: " << r .size () << " " << r.width << " " << r.index [1]
+       << " " << total << " " << r .start (1, 3) << r .start (1, 4) << endl;
+  try
+    {
+      RegexScanner bad (pool, "(unclosed");
+    }
+  catch (Exception* e)
+    {
+      cerr << "scan error: " << string (e->what ()) .substr (0, 14) << endl;
+      delete e;
+    }
+}
+
+static void
+lock_inc (void*)
+{
+  Scalarref c ("Lock::count");
+  c .store (c .fetch () .as_long () + 1);
+}
+
+static void*
+lock_thread (void* arg)
+{
+  Interpreter::Lock& lock = *(Interpreter::Lock*) arg;
+  for (int i = 0; i < 500; i++)
+    {
+      Interpreter::Lock::Guard g (lock);
+      lock_inc (0);
+    }
+  for (int i = 0; i < 500; i++)
+    lock .run (lock_inc, 0);
+  return 0;
+}
+
+void
+test_lock ()
+{
+  Interpreter::Lock lock (*p);
+  lock .combining (true);
+  pthread_t t [4];
+  for (int i = 0; i < 4; i++)
+    pthread_create (&t [i], 0, lock_thread, &lock);
+  for (int i = 0; i < 4; i++)
+    pthread_join (t [i], 0);
+
+  Interpreter::Lock::Stats s = lock .stats ();
+  cerr << "lock: " << Scalarref ("Lock::count") .fetch () .as_long ()
+       << " " << s.combined << " " << (s.acquisitions >= 2000) << endl;
+}
+
+static string
+async_join (const vector<string>& args)
+{
+  if (args .empty ())
+    throw runtime_error ("no args");
+  string r;
+  for (size_t i = 0; i < args .size (); i++)
+    r += args [i];
+  return r;
+}
+
+void
+test_async ()
+{
+  EventQueue q;
+  q .define_async_sub (*p, "Async", "join", async_join);
+  eval_string ("@Async::got = ();"
+	       " Async::join ('a', 'b', 3)"
+	       "   ->then (sub { push @Async::got, @_ });"
+	       " Async::join ()->then (undef, sub { push @Async::got, @_ });");
+
+  size_t settled = 0;
+  for (int tries = 0; settled < 2 && tries < 100; tries++)
+    {
+      struct pollfd pfd = { q .fd (), POLLIN, 0 };
+      poll (&pfd, 1, 100);
+      settled += q .drain (*p) .size ();
+    }
+  cerr << "async: " << settled << " "
+       << eval_string ("join '|', sort @Async::got") .as_string ();
+
+  // Workers holding completions for a full queue let it be destroyed.
+  {
+    EventQueue small (2);
+    small .define_async_sub (*p, "Async", "full", async_join);
+    eval_string ("Async::full ($_) for 1 .. 8");
+    for (int tries = 0; small .pending () < 2 && tries < 100; tries++)
+      poll (0, 0, 10);
+    cerr << " " << small .pending ();
+  }
+  cerr << " stopped "
+       << eval_string ("eval { Async::full (1); 1 } ? 'called'"
+		       " : $@ =~ /^full: queue destroyed/ ? 'croaked' : $@")
+    .as_string () << endl;
+}
+
+void
+test_io ()
+{
+  eval_string ("sub Io::lines { my $fh = shift; my @l = <$fh>;"
+	       " join ',', map ({ length } @l), tell ($fh), eof ($fh) ? 'eof' : '' }"
+	       " sub Io::put { my $fh = shift; print $fh @_; close $fh }"
+	       " sub Io::tail { my $fh = shift; seek $fh, -3, 2; scalar <$fh> }");
+  static const char data[] = "a\nbb\nccc";
+  cerr << "io span: "
+       << call_function ("Io::lines", List () << Globref (data, 8))
+    .as_string () << endl;
+
+  stringbuf in ("first\nsecond\nthird\n");
+  cerr << "io streambuf: "
+       << call_function ("Io::lines", List () << Globref (&in)) .as_string ()
+       << " " << call_function ("Io::tail", List () << Globref (&in))
+    .as_string ();
+  stringbuf out;
+  call_function ("Io::put", List () << Globref (&out, "w") << "x=" << 1);
+  cerr << "io out: " << out .str () << endl;
+}
+
+static void
+feed_produce (Feed& feed, void* arg)
+{
+  long n = (long) arg;
+  char buf [32];
+  for (long i = 0; i < n; i++)
+    {
+      int len = snprintf (buf, sizeof buf, "%ld", i);
+      if (! feed .push (buf, len))
+	return;
+    }
+}
+
+void
+test_feed ()
+{
+  eval_string ("sub Feed::got { $Feed::kept ||= \\$_[0][0];"
+	       " push @Feed::sizes, scalar @{$_[0]};"
+	       " push @Feed::all, map { uc } @{$_[0]} }"
+	       " sub Feed::sum { $Feed::sum += $_ for @{$_[0]} }"
+	       " sub Feed::die { die \"bad batch\\n\" }");
+  Feed feed (*p, p ->Coderef ("Feed::got"), 4);
+  for (char c = 'a'; c < 'k'; c++)
+    feed .push (&c, 1);
+  feed .flush ();
+  cerr << "feed: " << feed .records () << " " << feed .batches () << " "
+       << eval_string ("join (',', @Feed::sizes) . ' ' . join ('', @Feed::all)"
+		       " . ' ' . ${$Feed::kept}") .as_string () << endl;
+
+  Feed sum (*p, p ->Coderef ("Feed::sum"), 64);
+  sum .run (feed_produce, (void*) 1000);
+  cerr << "feed run: " << sum .batches () << " "
+       << eval_string ("$Feed::sum") .as_string () << endl;
+
+  Feed dies (*p, p ->Coderef ("Feed::die"), 8);
+  try
+    {
+      dies .run (feed_produce, (void*) 1000000);
+    }
+  catch (Exception* e)
+    {
+      cerr << "feed died: " << e ->what ();
+      delete e;
+    }
+}
+
+void
+test_regex ()
+{
+  Regex re = p ->compile_regex ("(\\w+) = (\\d+)(x)?", "x");
+  static const char line[] = "--Key=42--";
+  Regex::Match m;
+  cerr << "regex: " << re .match (line, sizeof line - 1, m) << " "
+       << re .groups () << " " << m.start () << "-" << m.end () << " "
+       << string (line + m.start (1), m .length (1)) << " "
+       << string (line + m.start (2), m .length (2)) << " "
+       << m .matched (3) << " " << re .match (string ("Key=")) << " "
+       << re .match (line, sizeof line - 1, m, 3) << m.start (1) << " "
+       << re .qr () .ref () .as_string () << endl;
+  try
+    {
+      p ->compile_regex ("(unclosed");
+    }
+  catch (Exception* e)
+    {
+      cerr << "regex error: " << string (e ->what ()) .substr (0, 18) << endl;
+      delete e;
+    }
+}
+
+void
+test_pack ()
+{
+  Packer rec (*p, "N n/a* C");
+  static const char data[] = "\0\0\1\2\0\3abcZ";
+  vector<Scalar> v;
+  size_t n = rec .unpack (data, sizeof data - 1, v);
+  Scalar first = v [0];
+  rec .unpack (data, sizeof data - 1, v);
+  cerr << "unpack: " << n << " " << v [0] .as_long () << " "
+       << v [1] .as_string () << " " << v [2] .as_int () << " "
+       << (v [0] .get_imp () != first .get_imp ());
+
+  long nums [2];
+  Packer shorts (*p, "n*");
+  n = shorts .unpack ("\0\7\1\0\0\1", 6, nums, 2);
+  cerr << " " << n << " " << nums [0] << " " << nums [1];
+
+  string out;
+  rec .pack (v, out);
+  cerr << " " << (out == string (data, sizeof data - 1)) << endl;
+  try
+    {
+      Packer bad (*p, "N/");
+      bad .unpack (data, 4, v);
+    }
+  catch (Exception* e)
+    {
+      cerr << "unpack error: " << string (e->what ()) .substr (0, 12) << endl;
+      delete e;
+    }
+}
+
+void
+test_invoker ()
+{
+  Coderef add = eval_string ("sub { my $t = 0; $t += $_ for @_;"
+			     " push @Inv::kept, \\$_[0] if $t == 7; $t }");
+  cerr << "coderef: " << add () .as_long () << " " << add (1) .as_long ()
+       << " " << add (1, 2) .as_long () << " " << add (1, 2, 3) .as_long ()
+       << " " << add (List () << 4 << 5, LIST) .as_string () .substr (0, 5);
+
+  Coderef::Invoker inv (add, 2);
+  long total = 0;
+  for (int i = 0; i < 5; i++)
+    total += inv .set (0, i) .set (1, 5.0) () .as_long ();
+  cerr << " " << total << " " << eval_string ("${$Inv::kept[0]}") .as_long ();
+
+  Coderef::Invoker count (eval_string ("sub { $Inv::n++ }"), 0, VOID);
+  for (int i = 0; i < 3; i++)
+    count ();
+  cerr << " " << eval_string ("$Inv::n") .as_long ();
+
+  Coderef::Invoker dies (eval_string ("sub { die \"no $_[0]\\n\" }"), 1,
+			 VOID);
+  try
+    {
+      dies .set (0, "way") ();
+    }
+  catch (Exception* e)
+    {
+      cerr << " " << e->what ();
+      delete e;
+    }
+}
+
+void
+test_bind ()
+{
+  long hits = 5;
+  double load = 0.5;
+  bool debug = false;
+  string host = "alpha";
+  const int limit = 10;
+  p->bind_scalar ("Cfg::load", &load);
+  p->bind_scalar ("Cfg::debug", &debug);
+  p->bind_scalar ("Cfg::host", &host);
+  p->bind_scalar ("Cfg::limit", &limit);
+  p->bind_counter ("Cfg::hits", &hits);
+
+  Coderef show = eval_string ("sub { $Cfg::hits++; $Cfg::hits += 2;"
+			      " join ',', $Cfg::load, $Cfg::debug ? 'y' : 'n',"
+			      " $Cfg::host, $Cfg::limit, $Cfg::hits }");
+  cerr << "bind: " << show () .as_string ();
+  load = 1.25;
+  debug = true;
+  host = "beta";
+  hits = 100;
+  cerr << " " << show () .as_string ();
+
+  eval_string ("$Cfg::load = 3; $Cfg::host = 'gamma'; $Cfg::debug = 0;"
+	       " $Cfg::hits -= 3");
+  cerr << " " << load << " " << host << " " << debug << " " << hits;
+  try
+    {
+      eval_string ("$Cfg::limit = 1");
+    }
+  catch (Exception* e)
+    {
+      cerr << " " << limit << " " << string (e->what ()) .substr (0, 12);
+      delete e;
+    }
+
+  p->unbind_scalar ("Cfg::hits");
+  eval_string ("$Cfg::hits = 0");
+  cerr << " " << hits << endl;
+
+  // The variables die with this frame.
+  p->unbind_scalar ("Cfg::load");
+  p->unbind_scalar ("Cfg::debug");
+  p->unbind_scalar ("Cfg::host");
+  p->unbind_scalar ("Cfg::limit");
+}
+
+void
+test_tie ()
+{
+  vector<double> v;
+  v .push_back (1.5);
+  v .push_back (2);
+  Arrayref a = Arrayref::bind (v);
+  Coderef sum = eval_string ("sub { my $t = 0; $t += $_ for @{$_[0]}; $t }");
+  cerr << "tie: " << sum (a) .as_double ();
+  eval_string ("sub { push @{$_[0]}, 4, 5; $_[0][0] = 10; pop @{$_[0]};"
+	       " $_ *= 2 for @{$_[0]}; $#{$_[0]} }") .coderef (true) (a);
+  cerr << " " << v .size () << " " << v [0] << " " << a .size ()
+       << " " << a .fetch (2) .as_int ();
+
+  vector<string> names (1, "x");
+  Arrayref n = Arrayref::bind (names);
+  eval_string ("sub { $_[0][2] = 'z'; join '/', @{$_[0]} }")
+    .coderef (true) (n);
+  cerr << " " << names .size () << names [2];
+  try
+    {
+      eval_string ("sub { shift @{$_[0]} }") .coderef (true) (n);
+    }
+  catch (Exception* e)
+    {
+      cerr << " " << string (e->what ()) .substr (0, 5);
+      delete e;
+    }
+
+  map<string, long> m;
+  m ["a"] = 1;
+  m ["b"] = 2;
+  Hashref h = Hashref::bind (m);
+  Scalar keys = eval_string ("sub { my $h = shift; $h->{c} = $h->{a} + 5;"
+			     " delete $h->{b}; my $n = 0;"
+			     " while (my ($k, $v) = each %$h) { $n += $v }"
+			     " join ',', $n, (sort keys %$h),"
+			     " exists $h->{b} ? 'b' : '-' }")
+    .coderef (true) (h);
+  cerr << " " << keys .as_string () << " " << m ["c"] << " " << m .size ();
+
+#ifdef PICKLE_RVALUE_REFS
+  // Stores during each may rehash; iteration sees the keys at its start.
+  unordered_map<string, long> u;
+  for (int i = 0; i < 4; i++)
+    u [string (1, 'a' + i)] = i;
+  Scalar seen = eval_string ("sub { my $h = shift; my $n = 0;"
+			     " while (my ($k) = each %$h) {"
+			     "   $h->{\"$k$_\"} = 1 for 1 .. 50; $n++ } $n }")
+    .coderef (true) (Hashref::bind (u));
+  cerr << " " << seen .as_int () << " " << u .size ();
+#endif
+  cerr << endl;
+}
+
+#ifdef PICKLE_RVALUE_REFS
+static int points_alive;
+
+struct Point
+{
+  double x, y;
+  Point (double x0, double y0) : x (x0), y (y0) { points_alive++; }
+  ~Point () { points_alive--; }
+  double norm2 () const { return x * x + y * y; }
+  void move (double dx, double dy) { x += dx; y += dy; }
+  string name (const string& prefix) const { return prefix + "point"; }
+};
+#endif
+
+void
+test_class ()
+{
+#ifdef PICKLE_RVALUE_REFS
+  Class<Point> point ("Test::Point");
+  point .ctor<double, double> ()
+    .method ("norm2", &Point::norm2)
+    .method ("move", &Point::move)
+    .method ("name", &Point::name);
+  Scalar r = eval_string ("my $p = Test::Point->new (3, 4); my $n = $p->norm2;"
+			  " $p->move (1, 1); [$n, $p->norm2, $p->name ('a ')]");
+  cerr << "class: " << Arrayref (r) .fetch (0) .as_int () << " "
+       << Arrayref (r) .fetch (1) .as_int () << " "
+       << Arrayref (r) .fetch (2) .as_string () << " " << points_alive;
+
+  Point local (1, 1);
+  Scalar w = point .wrap (&local, false);
+  Coderef norm = eval_string ("sub { $_[0]->norm2 }");
+  cerr << " " << norm (w) .as_int () << " " << (point .unwrap (w) == &local)
+       << " " << (point .unwrap (r) == 0);
+  try
+    {
+      norm (eval_string ("bless [], 'Test::Point'"));
+    }
+  catch (Exception* e)
+    {
+      cerr << " " << string (e->what ()) .substr (0, 5);
+      delete e;
+    }
+  w = Scalar ();
+  cerr << " " << points_alive << endl;
+#endif
+}
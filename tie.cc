@@ -0,0 +1,700 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+#include <XSUB.h>
+
+namespace Pickle
+{
+
+  // The tie object is a blessed reference to an IV holding the
+  // binding, which DESTROY deletes.
+  static void*
+  binding_of (pTHX_ SV* self)
+  {
+    return INT2PTR (void*, SvIV (SvRV (self)));
+  }
+
+  static void
+  set_num (pTHX_ SV* sv, double d) { sv_setnv (sv, d); }
+  static void
+  set_num (pTHX_ SV* sv, long n) { sv_setiv (sv, n); }
+  static void
+  set_num (pTHX_ SV* sv, int n) { sv_setiv (sv, n); }
+
+  static void
+  get_num (pTHX_ SV* sv, double& d) { d = SvNV (sv); }
+  static void
+  get_num (pTHX_ SV* sv, long& n) { n = SvIV (sv); }
+  static void
+  get_num (pTHX_ SV* sv, int& n) { n = (int) SvIV (sv); }
+
+  // The numeric fast path, straight to the vector.
+  template <class T>
+  static inline void
+  fetch_num (pTHX_ void* vec, size_t i, SV* sv)
+  {
+    vector<T>& v = *(vector<T>*) vec;
+    if (i < v .size ())
+      set_num (aTHX_ sv, v [i]);
+    else
+      sv_setsv (sv, &PL_sv_undef);
+  }
+
+  template <class T>
+  static inline void
+  store_num (pTHX_ void* vec, size_t i, SV* sv)
+  {
+    vector<T>& v = *(vector<T>*) vec;
+    if (i >= v .size ())
+      v .resize (i + 1);
+    get_num (aTHX_ sv, v [i]);
+  }
+
+  // Set SV to element I.
+  static void
+  fetch_elt (pTHX_ Array_binding* b, size_t i, SV* sv)
+  {
+    switch (b->kind)
+      {
+      case Array_binding::DOUBLES:
+	fetch_num<double> (aTHX_ b->vec, i, sv);
+	break;
+      case Array_binding::LONGS:
+	fetch_num<long> (aTHX_ b->vec, i, sv);
+	break;
+      case Array_binding::INTS:
+	fetch_num<int> (aTHX_ b->vec, i, sv);
+	break;
+      default:
+	if (i < b->size ())
+	  sv_setsv (sv, b->fetch (i) .get_imp ());
+	else
+	  sv_setsv (sv, &PL_sv_undef);
+	break;
+      }
+  }
+
+  static void
+  store_elt (pTHX_ Array_binding* b, size_t i, SV* sv)
+  {
+    switch (b->kind)
+      {
+      case Array_binding::DOUBLES:
+	store_num<double> (aTHX_ b->vec, i, sv);
+	break;
+      case Array_binding::LONGS:
+	store_num<long> (aTHX_ b->vec, i, sv);
+	break;
+      case Array_binding::INTS:
+	store_num<int> (aTHX_ b->vec, i, sv);
+	break;
+      default:
+	if (i >= b->size ())
+	  b->resize (i + 1);
+	b->store (i, Scalar (newSVsv (sv)));
+	break;
+      }
+  }
+
+  // Set SV to element I and reset the element, for delete.
+  static void
+  delete_elt (pTHX_ Array_binding* b, size_t i, SV* sv)
+  {
+    fetch_elt (aTHX_ b, i, sv);
+    if (i < b->size ())
+      store_elt (aTHX_ b, i, &PL_sv_undef);
+  }
+
+#define dARRAY(n, usage)						\
+  dXSARGS;								\
+  if (items != (n))							\
+    croak ("Usage: %s", (usage));					\
+  Array_binding* b = (Array_binding*) binding_of (aTHX_ ST (0))
+
+  static void
+  xs_array_fetch (pTHX_ CV*)
+  {
+    dARRAY (2, "FETCH (self, index)");
+    try
+      {
+	SV* sv = sv_newmortal ();
+	fetch_elt (aTHX_ b, SvUV (ST (1)), sv);
+	ST (0) = sv;
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_array_store (pTHX_ CV*)
+  {
+    dARRAY (3, "STORE (self, index, value)");
+    try
+      {
+	store_elt (aTHX_ b, SvUV (ST (1)), ST (2));
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (0);
+  }
+
+  static void
+  xs_array_fetchsize (pTHX_ CV*)
+  {
+    dARRAY (1, "FETCHSIZE (self)");
+    ST (0) = sv_2mortal (newSVuv (b->size ()));
+    XSRETURN (1);
+  }
+
+  static void
+  xs_array_storesize (pTHX_ CV*)
+  {
+    dARRAY (2, "STORESIZE (self, count)");
+    try
+      {
+	b->resize (SvUV (ST (1)));
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (0);
+  }
+
+  static void
+  xs_array_extend (pTHX_ CV*)
+  {
+    dXSARGS;
+    PERL_UNUSED_VAR (items);
+    XSRETURN (0);
+  }
+
+  static void
+  xs_array_clear (pTHX_ CV*)
+  {
+    dARRAY (1, "CLEAR (self)");
+    try
+      {
+	b->resize (0);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (0);
+  }
+
+  static void
+  xs_array_exists (pTHX_ CV*)
+  {
+    dARRAY (2, "EXISTS (self, index)");
+    ST (0) = boolSV (SvUV (ST (1)) < b->size ());
+    XSRETURN (1);
+  }
+
+  // A vector has no holes, so deleting resets the element.
+  static void
+  xs_array_delete (pTHX_ CV*)
+  {
+    dARRAY (2, "DELETE (self, index)");
+    try
+      {
+	SV* sv = sv_newmortal ();
+	delete_elt (aTHX_ b, SvUV (ST (1)), sv);
+	ST (0) = sv;
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_array_push (pTHX_ CV*)
+  {
+    dXSARGS;
+    if (items < 1)
+      croak ("Usage: PUSH (self, list)");
+    Array_binding* b = (Array_binding*) binding_of (aTHX_ ST (0));
+    try
+      {
+	size_t n = b->size ();
+	for (I32 i = 1; i < items; i++)
+	  store_elt (aTHX_ b, n++, ST (i));
+	ST (0) = sv_2mortal (newSVuv (n));
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_array_pop (pTHX_ CV*)
+  {
+    dARRAY (1, "POP (self)");
+    try
+      {
+	size_t n = b->size ();
+	SV* sv = sv_newmortal ();
+	fetch_elt (aTHX_ b, n - 1, sv);
+	if (n)
+	  b->resize (n - 1);
+	ST (0) = sv;
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  // XXX shift, unshift and splice would move every element of the
+  // vector; they are refused rather than made quietly slow.
+  static void
+  xs_array_refuse (pTHX_ CV* cv)
+  {
+    croak ("%s is not supported on a bound array", GvNAME (CvGV (cv)));
+  }
+
+  static void
+  xs_array_destroy (pTHX_ CV*)
+  {
+    dARRAY (1, "DESTROY (self)");
+    delete b;
+    sv_setiv (SvRV (ST (0)), 0);
+    XSRETURN (0);
+  }
+
+#undef dARRAY
+
+#define dHASH(n, usage)							\
+  dXSARGS;								\
+  if (items != (n))							\
+    croak ("Usage: %s", (usage));					\
+  Hash_binding* b = (Hash_binding*) binding_of (aTHX_ ST (0))
+
+  static string
+  key_of (pTHX_ SV* sv)
+  {
+    STRLEN len;
+    const char* p = SvPV (sv, len);
+    return string (p, len);
+  }
+
+  static SV*
+  key_sv (pTHX_ bool found, const string& key)
+  {
+    return found ? sv_2mortal (newSVpvn (key .data (), key .size ()))
+      : &PL_sv_undef;
+  }
+
+  static void
+  xs_hash_fetch (pTHX_ CV*)
+  {
+    dHASH (2, "FETCH (self, key)");
+    try
+      {
+	Scalar val ((SV*) 0);
+	ST (0) = (b->fetch (key_of (aTHX_ ST (1)), val)
+		  ? sv_2mortal (val .release ()) : &PL_sv_undef);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_hash_store (pTHX_ CV*)
+  {
+    dHASH (3, "STORE (self, key, value)");
+    try
+      {
+	b->store (key_of (aTHX_ ST (1)), Scalar (newSVsv (ST (2))));
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (0);
+  }
+
+  static void
+  xs_hash_exists (pTHX_ CV*)
+  {
+    dHASH (2, "EXISTS (self, key)");
+    try
+      {
+	ST (0) = boolSV (b->exists (key_of (aTHX_ ST (1))));
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_hash_delete (pTHX_ CV*)
+  {
+    dHASH (2, "DELETE (self, key)");
+    try
+      {
+	Scalar val ((SV*) 0);
+	ST (0) = (b->erase (key_of (aTHX_ ST (1)), val)
+		  ? sv_2mortal (val .release ()) : &PL_sv_undef);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_hash_clear (pTHX_ CV*)
+  {
+    dHASH (1, "CLEAR (self)");
+    try
+      {
+	b->clear ();
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (0);
+  }
+
+  static void
+  xs_hash_firstkey (pTHX_ CV*)
+  {
+    dHASH (1, "FIRSTKEY (self)");
+    try
+      {
+	string key;
+	ST (0) = key_sv (aTHX_ b->first (key), key);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_hash_nextkey (pTHX_ CV*)
+  {
+    dHASH (2, "NEXTKEY (self, lastkey)");
+    try
+      {
+	string key;
+	ST (0) = key_sv (aTHX_ b->next (key), key);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    XSRETURN (1);
+  }
+
+  static void
+  xs_hash_scalar (pTHX_ CV*)
+  {
+    dHASH (1, "SCALAR (self)");
+    ST (0) = sv_2mortal (newSVuv (b->size ()));
+    XSRETURN (1);
+  }
+
+  static void
+  xs_hash_destroy (pTHX_ CV*)
+  {
+    dHASH (1, "DESTROY (self)");
+    delete b;
+    sv_setiv (SvRV (ST (0)), 0);
+    XSRETURN (0);
+  }
+
+#undef dHASH
+
+  /* Element access goes through magic rather than methods.  The tie
+     magic has its own table, whose copy hook gives each element Perl
+     fetches `p' magic with the table below, so reading and assigning
+     an element calls into C++ directly.  Perl still finds the magic
+     by type, and calls the methods for push, pop, exists, keys and
+     the like.  */
+
+  // The key of an element: an index, or for a hash a string or SV.
+  static size_t
+  elt_index (MAGIC* mg)
+  {
+    return (size_t) mg->mg_len;
+  }
+
+  static string
+  elt_key (pTHX_ MAGIC* mg)
+  {
+    if (mg->mg_len == HEf_SVKEY)
+      return key_of (aTHX_ (SV*) mg->mg_ptr);
+    return string (mg->mg_ptr, mg->mg_len);
+  }
+
+  static int
+  array_elt_get (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Array_binding* b = (Array_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	fetch_elt (aTHX_ b, elt_index (mg), sv);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static int
+  array_elt_set (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Array_binding* b = (Array_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	store_elt (aTHX_ b, elt_index (mg), sv);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static int
+  array_elt_clear (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Array_binding* b = (Array_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	delete_elt (aTHX_ b, elt_index (mg), sv);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static int
+  hash_elt_get (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Hash_binding* b = (Hash_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	Scalar val ((SV*) 0);
+	if (b->fetch (elt_key (aTHX_ mg), val))
+	  sv_setsv (sv, val .get_imp ());
+	else
+	  sv_setsv (sv, &PL_sv_undef);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static int
+  hash_elt_set (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Hash_binding* b = (Hash_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	b->store (elt_key (aTHX_ mg), Scalar (newSVsv (sv)));
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static int
+  hash_elt_clear (pTHX_ SV* sv, MAGIC* mg)
+  {
+    Hash_binding* b = (Hash_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	Scalar val ((SV*) 0);
+	if (b->erase (elt_key (aTHX_ mg), val))
+	  sv_setsv (sv, val .get_imp ());
+	else
+	  sv_setsv (sv, &PL_sv_undef);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static MGVTBL array_elt_vtbl =
+    { array_elt_get, array_elt_set, 0, array_elt_clear, 0, 0, 0, 0 };
+  static MGVTBL hash_elt_vtbl =
+    { hash_elt_get, hash_elt_set, 0, hash_elt_clear, 0, 0, 0, 0 };
+
+  static int
+  array_copy (pTHX_ SV*, MAGIC* mg, SV* nsv, const char* name, I32 len)
+  {
+    sv_magicext (nsv, mg->mg_obj, PERL_MAGIC_tiedelem, &array_elt_vtbl,
+		 name, len);
+    return 1;
+  }
+
+  static int
+  hash_copy (pTHX_ SV*, MAGIC* mg, SV* nsv, const char* name, I32 len)
+  {
+    sv_magicext (nsv, mg->mg_obj, PERL_MAGIC_tiedelem, &hash_elt_vtbl,
+		 name, len);
+    return 1;
+  }
+
+  // The size hook returns the last index.
+  static U32
+  array_len (pTHX_ SV*, MAGIC* mg)
+  {
+    return (U32) ((Array_binding*) binding_of (aTHX_ mg->mg_obj))
+      ->size () - 1;
+  }
+
+  static int
+  array_clear (pTHX_ SV*, MAGIC* mg)
+  {
+    Array_binding* b = (Array_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	b->resize (0);
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static int
+  hash_clear (pTHX_ SV*, MAGIC* mg)
+  {
+    Hash_binding* b = (Hash_binding*) binding_of (aTHX_ mg->mg_obj);
+    try
+      {
+	b->clear ();
+      }
+    catch (Exception* e)
+      {
+	propagate_to_perl (aTHX_ e);
+      }
+    return 0;
+  }
+
+  static MGVTBL array_vtbl =
+    { 0, 0, array_len, array_clear, 0, array_copy, 0, 0 };
+  static MGVTBL hash_vtbl = { 0, 0, 0, hash_clear, 0, hash_copy, 0, 0 };
+
+  struct Tie_method
+  {
+    const char* name;
+    XSUBADDR_t fn;
+  };
+
+  static const Tie_method array_methods[] =
+    {
+      { "FETCH", xs_array_fetch }, { "STORE", xs_array_store },
+      { "FETCHSIZE", xs_array_fetchsize },
+      { "STORESIZE", xs_array_storesize },
+      { "EXTEND", xs_array_extend }, { "CLEAR", xs_array_clear },
+      { "EXISTS", xs_array_exists }, { "DELETE", xs_array_delete },
+      { "PUSH", xs_array_push }, { "POP", xs_array_pop },
+      { "SHIFT", xs_array_refuse }, { "UNSHIFT", xs_array_refuse },
+      { "SPLICE", xs_array_refuse }, { "DESTROY", xs_array_destroy },
+      { 0, 0 }
+    };
+
+  static const Tie_method hash_methods[] =
+    {
+      { "FETCH", xs_hash_fetch }, { "STORE", xs_hash_store },
+      { "EXISTS", xs_hash_exists }, { "DELETE", xs_hash_delete },
+      { "CLEAR", xs_hash_clear }, { "FIRSTKEY", xs_hash_firstkey },
+      { "NEXTKEY", xs_hash_nextkey }, { "SCALAR", xs_hash_scalar },
+      { "DESTROY", xs_hash_destroy },
+      { 0, 0 }
+    };
+
+  // Tie VAR to BINDING through PKG, defining PKG's methods the first
+  // time, and return a reference to VAR.
+  static SV*
+  tie (pTHX_ SV* var, const char* pkg, const Tie_method* methods,
+       MGVTBL* vtbl, void* binding)
+  {
+    HV* stash = gv_stashpv (pkg, 0);
+    if (! stash)
+      {
+	for (const Tie_method* m = methods; m->name; m++)
+	  {
+	    string name = string (pkg) + "::" + m->name;
+	    newXS (const_cast<char*> (name .c_str ()), m->fn,
+		   const_cast<char*> (__FILE__));
+	  }
+	stash = gv_stashpv (pkg, GV_ADD);
+      }
+    SV* obj = sv_bless (newRV_noinc (newSViv (PTR2IV (binding))), stash);
+    MAGIC* mg = sv_magicext (var, obj, PERL_MAGIC_tied, vtbl, 0, 0);
+    mg->mg_flags |= MGf_COPY;
+    SvREFCNT_dec (obj);
+    return newRV_noinc (var);
+  }
+
+  Arrayref
+  Arrayref::bind (Array_binding* b)
+  {
+    dTHX;
+    return Arrayref (Scalar (tie (aTHX_ (SV*) newAV (), "Pickle::TiedArray",
+				  array_methods, &array_vtbl, b)), false);
+  }
+
+  Hashref
+  Hashref::bind (Hash_binding* b)
+  {
+    dTHX;
+    return Hashref (Scalar (tie (aTHX_ (SV*) newHV (), "Pickle::TiedHash",
+				 hash_methods, &hash_vtbl, b)), false);
+  }
+
+}
@@ -0,0 +1,383 @@
+/* 
+   Copyright (C) 2000 by John Tobey,
+   jtobey@john-edwin-tobey.org.  All rights reserved.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to the
+   Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+   MA 02111-1307  USA
+*/
+
+
+#include "pickle_int.hh"
+
+#ifdef PICKLE_TRACK
+
+#include <pthread.h>
+#include <execinfo.h>
+#include <stdlib.h>
+#include <ostream>
+
+namespace Pickle
+{
+
+  // Live Scalars are recorded by address in per-thread tables, each
+  // under its own lock, which only a report or a Scalar destroyed by
+  // another thread contends for.  Such a Scalar is found by searching
+  // the other tables.  Each entry notes the interpreter current when
+  // its Scalar was made, so reports can be made per interpreter.
+  //
+  // One time in PICKLE_TRACK_SAMPLE (by default 256) the call stack
+  // that made the Scalar is saved for the report.  Scalars aliased
+  // onto array slots by Arrayref::at are never recorded, so assigning
+  // to them is ignored.
+
+  enum { SITE_DEPTH = 12, REPORT_MAX = 20 };
+
+  struct Site
+  {
+    int depth;
+    void* frames [SITE_DEPTH];
+  };
+
+  // An entry's handle is 0 if it is free and DELETED if it was erased.
+  static const void* const DELETED = (const void*) 1;
+
+  struct Handle
+  {
+    const void* handle;
+    const void* sv;
+    const void* perl;    // the interpreter, or 0 without MULTIPLICITY
+    Site* site;          // 0 unless sampled
+  };
+
+#ifdef PERL_IMPLICIT_CONTEXT
+#  define MY_PERL ((const void*) aTHX)
+#else
+#  define MY_PERL ((const void*) 0)
+#endif
+
+  struct Table
+  {
+    pthread_mutex_t lock;
+    Handle* entries;
+    size_t size;         // a power of 2, or 0
+    size_t used;         // entries not free
+    unsigned long until_sample;
+    Table* next;
+  };
+
+  static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+  static Table* all_tables;
+  static unsigned long sample_rate = 256;
+  static __thread Table* my_table
+#ifdef __GNUC__
+    __attribute__ ((tls_model ("initial-exec")))
+#endif
+    ;
+
+  static Table*
+  table ()
+  {
+    Table* t = my_table;
+    if (t)
+      return t;
+
+    t = (Table*) calloc (1, sizeof *t);
+    if (! t)
+      return 0;
+    pthread_mutex_init (&t->lock, 0);
+    pthread_mutex_lock (&tables_lock);
+    if (! all_tables)
+      {
+	const char* rate = getenv ("PICKLE_TRACK_SAMPLE");
+	if (rate)
+	  sample_rate = strtoul (rate, 0, 10);
+      }
+    t->next = all_tables;
+    all_tables = t;
+    pthread_mutex_unlock (&tables_lock);
+    return my_table = t;
+  }
+
+  static inline size_t
+  hash (const void* p)
+  {
+    unsigned long h = (unsigned long) p >> 3;
+    h *= 2654435761UL;
+    return h ^ (h >> 16);
+  }
+
+  // Return HANDLE's entry, or 0.
+  static Handle*
+  find (Table* t, const void* handle)
+  {
+    if (! t->size)
+      return 0;
+    size_t mask = t->size - 1;
+    for (size_t i = hash (handle) & mask; ; i = (i + 1) & mask)
+      {
+	Handle* e = &t->entries [i];
+	if (e->handle == handle)
+	  return e;
+	if (e->handle == 0)
+	  return 0;
+      }
+  }
+
+  // Rebuild the table at twice the number of live entries or more,
+  // dropping deleted ones.  Keep the load factor at most 1/2.  The
+  // caller holds T's lock.
+  static bool
+  grow (Table* t)
+  {
+    size_t live = 0;
+    for (size_t i = 0; i < t->size; i++)
+      if (t->entries [i] .handle > DELETED)
+	live++;
+    size_t size = 64;
+    while (size < 4 * (live + 1))
+      size *= 2;
+
+    Handle* entries = (Handle*) calloc (size, sizeof *entries);
+    if (! entries)
+      return false;
+    for (size_t i = 0; i < t->size; i++)
+      {
+	Handle& e = t->entries [i];
+	if (e.handle <= DELETED)
+	  continue;
+	size_t j = hash (e.handle) & (size - 1);
+	while (entries [j] .handle)
+	  j = (j + 1) & (size - 1);
+	entries [j] = e;
+      }
+
+    free (t->entries);
+    t->entries = entries;
+    t->size = size;
+    t->used = live;
+    return true;
+  }
+
+  static Site*
+  sample (Table* t)
+  {
+    if (sample_rate == 0)
+      return 0;
+    if (t->until_sample > 1)
+      {
+	t->until_sample--;
+	return 0;
+      }
+    t->until_sample = sample_rate;
+
+    Site* site = (Site*) malloc (sizeof *site);
+    if (site)
+      site->depth = backtrace (site->frames, SITE_DEPTH);
+    return site;
+  }
+
+  void
+  track_new (const void* handle, const void* sv)
+  {
+    dTHX;
+    Table* t = table ();
+    if (! t)
+      return;
+    pthread_mutex_lock (&t->lock);
+    if (2 * (t->used + 1) > t->size && ! grow (t))
+      {
+	pthread_mutex_unlock (&t->lock);
+	return;
+      }
+
+    // A new Scalar can have the address of one destroyed unrecorded,
+    // for instance by longjmp.
+    Handle* e = find (t, handle);
+    if (e && e->site)
+      free (e->site);
+    else if (! e)
+      {
+	size_t mask = t->size - 1;
+	size_t i = hash (handle) & mask;
+	while (t->entries [i] .handle > DELETED)
+	  i = (i + 1) & mask;
+	e = &t->entries [i];
+	if (e->handle == 0)
+	  t->used++;
+      }
+    e->sv = sv;
+    e->perl = MY_PERL;
+    e->site = sample (t);
+    e->handle = handle;
+    pthread_mutex_unlock (&t->lock);
+  }
+
+  // XXX A Scalar changed by a thread other than its maker's is still
+  // reported with its old SV.
+  void
+  track_set (const void* handle, const void* sv)
+  {
+    Table* t = my_table;
+    if (! t)
+      return;
+    pthread_mutex_lock (&t->lock);
+    Handle* e = find (t, handle);
+    if (e)
+      e->sv = sv;
+    pthread_mutex_unlock (&t->lock);
+  }
+
+  static void
+  erase (Handle* e)
+  {
+    if (e->site)
+      free (e->site);
+    e->handle = DELETED;
+  }
+
+  void
+  track_delete (const void* handle)
+  {
+    Table* t = my_table;
+    if (t)
+      {
+	pthread_mutex_lock (&t->lock);
+	Handle* e = find (t, handle);
+	if (e)
+	  erase (e);
+	pthread_mutex_unlock (&t->lock);
+	if (e)
+	  return;
+      }
+
+    pthread_mutex_lock (&tables_lock);
+    for (Table* o = all_tables; o; o = o->next)
+      if (o != t)
+	{
+	  pthread_mutex_lock (&o->lock);
+	  Handle* e = find (o, handle);
+	  if (e)
+	    erase (e);
+	  pthread_mutex_unlock (&o->lock);
+	  if (e)
+	    break;
+	}
+    pthread_mutex_unlock (&tables_lock);
+  }
+
+  // Whether E is a live Scalar holding an SV of PERL, or of any
+  // interpreter if PERL is 0.
+  static inline bool
+  live (const Handle& e, const void* perl)
+  {
+    return e.handle > DELETED && e.sv && (! perl || e.perl == perl);
+  }
+
+  static unsigned long
+  count (const void* perl)
+  {
+    unsigned long n = 0;
+    pthread_mutex_lock (&tables_lock);
+    for (Table* t = all_tables; t; t = t->next)
+      {
+	pthread_mutex_lock (&t->lock);
+	for (size_t j = 0; j < t->size; j++)
+	  if (live (t->entries [j], perl))
+	    n++;
+	pthread_mutex_unlock (&t->lock);
+      }
+    pthread_mutex_unlock (&tables_lock);
+    return n;
+  }
+
+  unsigned long
+  track_live_handles ()
+  {
+    return count (0);
+  }
+
+  unsigned long
+  track_live_handles (const Interpreter& i)
+  {
+    dInterpOf (i);
+    return count (MY_PERL);
+  }
+
+  void
+  track_each (pTHX_ void (*fn) (const void* sv, void* arg), void* arg)
+  {
+    pthread_mutex_lock (&tables_lock);
+    for (Table* t = all_tables; t; t = t->next)
+      {
+	pthread_mutex_lock (&t->lock);
+	for (size_t j = 0; j < t->size; j++)
+	  if (live (t->entries [j], MY_PERL))
+	    fn (t->entries [j] .sv, arg);
+	pthread_mutex_unlock (&t->lock);
+      }
+    pthread_mutex_unlock (&tables_lock);
+  }
+
+  // List I's Scalars still holding an SV, those with a sampled call
+  // stack first.
+  void
+  track_report (ostream& os, const Interpreter& i)
+  {
+    dInterpOf (i);
+    unsigned long n = count (MY_PERL);
+    if (n == 0)
+      return;
+
+    os << "pickle: " << n << " Scalar" << (n == 1 ? "" : "s")
+       << " outstanding" << endl;
+    unsigned long shown = 0;
+    pthread_mutex_lock (&tables_lock);
+    for (int pass = 0; pass < 2; pass++)
+      for (Table* t = all_tables; t && shown < REPORT_MAX; t = t->next)
+	{
+	  pthread_mutex_lock (&t->lock);
+	  for (size_t j = 0; j < t->size && shown < REPORT_MAX; j++)
+	    {
+	      Handle& e = t->entries [j];
+	      if (! live (e, MY_PERL) || (pass == 0) != (e.site != 0))
+		continue;
+	      SV* sv = (SV*) e.sv;
+	      os << "  Scalar " << e.handle << " SV " << e.sv << " ";
+	      if (SvROK (sv))
+		os << sv_reftype (SvRV (sv), 0) << " ref";
+	      else
+		os << (SvOK (sv) ? "scalar" : "undef");
+	      os << " refcnt " << SvREFCNT (sv) << endl;
+	      if (e.site)
+		{
+		  char** names = backtrace_symbols (e.site->frames,
+						    e.site->depth);
+		  // Skip track_new.
+		  for (int f = 1; names && f < e.site->depth; f++)
+		    os << "      " << names [f] << endl;
+		  free (names);
+		}
+	      shown++;
+	    }
+	  pthread_mutex_unlock (&t->lock);
+	}
+    pthread_mutex_unlock (&tables_lock);
+    if (n > shown)
+      os << "  ..." << endl;
+  }
+
+}
+
+#endif  // PICKLE_TRACK